@@ -28,8 +28,9 @@ SOFTWARE. ]]
     print("sent pong")
 until size ~= -1 ]]
 
-for i = 0, 10000000, 1 do
-    err, err_msg = udp_recv(0XF6EE77EEE7)
+for i = 0, 100, 1 do
+    -- waits at most 100 ms for the next message
+    err, err_msg = udp_recv(0XF6EE77EEE7, 100)
     if err then
         if err_msg then
             print("error " .. err_msg)
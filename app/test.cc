@@ -63,9 +63,16 @@ auto callback_func(void *message) -> void
     if(msg->eventCode == ZTS_EVENT_NETWORK_READY_IP6)
     {
         std::cout << "Network ready for IP6" << std::endl;
+        standby_network::CommLayer::network_changed();
         network_ready = true;
         return;
     }
+    if(msg->eventCode == ZTS_EVENT_NETWORK_DOWN || msg->eventCode == ZTS_EVENT_NETWORK_UPDATE)
+    {
+        std::cout << "Network " << std::hex << msg->network->nwid << " changed" << std::endl;
+        standby_network::CommLayer::network_changed();
+        return;
+    }
     if(msg->eventCode == ZTS_EVENT_NETWORK_REQ_CONFIG)
     {
         std::cout << "Requesting network configuration" << std::endl;
@@ -0,0 +1,84 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <udp_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// What a udp_send costs its caller, with and without the sender thread, and whether every message
+// arrived (and in async mode, was reported by udp_completions)
+auto run(const char *name, std::shared_ptr<Transport> a, std::shared_ptr<Transport> b, int port, bool async) -> void
+{
+    const int count = 20000;
+    CommOptions options;
+    options.shm.enabled = false;
+    options.async_send = async;
+    options.completion_capacity = count;
+    options.send_limits.queue_msgs = count;
+    options.recv_limits.queue_msgs = count;
+    CommLayer sender(a, port, options);
+    CommLayer receiver(b, port, options);
+    const uint64_t from = a->node_id();
+    const uint64_t to = b->node_id();
+
+    int failed = 0;
+    const double ns = ns_per_op(count, [&, i = 0]() mutable {
+        failed += sender.udp_send(to, 1, std::to_string(i++)) <= 0;
+    });
+    int received = 0;
+    bool ordered = true;
+    while(MsgRef m = receiver.udp_recv_buf(from, 1, std::chrono::milliseconds(500)))
+    {
+        ordered = ordered && m.str() == std::to_string(received);
+        received++;
+    }
+    std::size_t completed = 0;
+    for(const send_completion &c : sender.udp_completions())
+    {
+        completed += c.result > 0;
+    }
+    std::cout << name << (async ? " async" : " sync") << ": " << ns << " ns per udp_send, " << failed << " failed, "
+              << received << "/" << count << " received" << (ordered ? "" : " out of order") << ", "
+              << completed << " completions" << std::endl;
+}
+
+}
+
+// Needs 127.0.0.2 and 127.0.0.3 for udp (any 127/8 address works on Linux)
+auto main() -> int
+{
+    const std::unordered_map<uint64_t, std::string> book = { { 0xa, "127.0.0.2" }, { 0xb, "127.0.0.3" } };
+    int port = 9700;
+    for(bool async : { false, true })
+    {
+        auto network = std::make_shared<LoopbackNetwork>();
+        run("loopback", std::make_shared<LoopbackTransport>(network, 0xa), std::make_shared<LoopbackTransport>(network, 0xb), port += 2, async);
+        run("udp", std::make_shared<UdpTransport>(0xa, book), std::make_shared<UdpTransport>(0xb, book), port += 2, async);
+    }
+    return 0;
+}
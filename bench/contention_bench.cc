@@ -0,0 +1,84 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <thread>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+// Receive throughput against the number of consumer threads, each draining the queue of its own peer
+auto main() -> int
+{
+    const std::size_t per_peer = 20000;
+    const std::string msg(64, 'm');
+    std::cout << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    for(std::size_t consumers : { 1, 2, 4, 8 })
+    {
+        auto network = std::make_shared<LoopbackNetwork>();
+        CommOptions options;
+        options.shm.enabled = false;
+        options.recv_limits = QueueLimits();
+        CommLayer receiver(std::make_shared<LoopbackTransport>(network, 0x1), 9000, options);
+        std::vector<std::unique_ptr<CommLayer>> senders;
+        for(std::size_t i = 0; i < consumers; i++)
+        {
+            senders.push_back(std::make_unique<CommLayer>(std::make_shared<LoopbackTransport>(network, 0x100 + i), 9000, options));
+            for(std::size_t j = 0; j < per_peer; j++)
+            {
+                senders.back()->udp_send(0x1, msg);
+            }
+        }
+        const std::size_t total = consumers * per_peer;
+        if(!wait_until([&] { return receiver.udp_recv_stats().msgs == total; }, std::chrono::seconds(30)))
+        {
+            std::cerr << "only " << receiver.udp_recv_stats().msgs << " of " << total << " messages arrived" << std::endl;
+            return 1;
+        }
+
+        std::atomic<std::size_t> received{0};
+        std::vector<std::thread> threads;
+        const auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < consumers; i++)
+        {
+            threads.emplace_back([&, i] {
+                std::vector<MsgRef> out;
+                std::size_t n = 0;
+                while(n < per_peer)
+                {
+                    out.clear();
+                    n += receiver.udp_recv_many(0x100 + i, 0, 64, out);
+                }
+                received += n;
+            });
+        }
+        for(auto &t : threads)
+        {
+            t.join();
+        }
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << consumers << " consumer(s): " << received / secs / 1e6 << " M msgs/s" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <functional>
+#include <thread>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <udp_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const std::size_t SENDERS = 8;
+const std::size_t PER_SENDER = 50000;
+
+// Ingest throughput of one receiver with listeners listener threads, SENDERS peers sending at once.
+// The datagrams are spread over the listeners by sender (SO_REUSEPORT hashing, or the node id on
+// the loopback), so every listener has work
+auto run(const char *name, std::function<std::shared_ptr<Transport>(uint64_t)> make, std::size_t listeners, int port) -> void
+{
+    CommOptions options;
+    options.shm.enabled = false;
+    options.recv_limits = QueueLimits();
+    CommOptions receiver_options = options;
+    receiver_options.listener_threads = listeners;
+    CommLayer receiver(make(0x1), port, receiver_options);
+    std::vector<std::unique_ptr<CommLayer>> senders;
+    for(std::size_t i = 0; i < SENDERS; i++)
+    {
+        senders.push_back(std::make_unique<CommLayer>(make(0x100 + i), port, options));
+    }
+    const std::string msg(64, 'm');
+    const std::size_t total = SENDERS * PER_SENDER;
+    // stay within the socket buffers, a drop would leave the count short
+    const std::size_t window = 512;
+
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < SENDERS; i++)
+    {
+        threads.emplace_back([&, i] {
+            for(std::size_t j = 0; j < PER_SENDER; j++)
+            {
+                while(j * SENDERS > receiver.udp_recv_stats().msgs + window * SENDERS)
+                {
+                    std::this_thread::yield();
+                }
+                senders[i]->udp_send(0x1, msg);
+            }
+        });
+    }
+    const bool arrived = wait_until([&] { return receiver.udp_recv_stats().msgs == total; }, std::chrono::seconds(30));
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(auto &t : threads)
+    {
+        t.join();
+    }
+    std::cout << name << ", " << listeners << " listener(s): " << receiver.udp_recv_stats().msgs / secs / 1e6 << " M msgs/s"
+              << (arrived ? "" : " (some messages were lost)") << std::endl;
+}
+
+}
+
+// Receive throughput against the number of listener threads. The senders share the cores with the
+// listeners, the scaling shows only with cores to spare. Needs 127.0.0.1 to 127.0.0.9 for udp
+// (any 127/8 address works on Linux)
+auto main() -> int
+{
+    std::cout << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    std::unordered_map<uint64_t, std::string> book = { { 0x1, "127.0.0.1" } };
+    for(std::size_t i = 0; i < SENDERS; i++)
+    {
+        book[0x100 + i] = "127.0.0." + std::to_string(2 + i);
+    }
+    int port = 9600;
+    for(std::size_t listeners : { 1, 2, 4, 8 })
+    {
+        auto network = std::make_shared<LoopbackNetwork>();
+        run("loopback", [&](uint64_t node_id) { return std::make_shared<LoopbackTransport>(network, node_id); }, listeners, port += 2);
+        run("udp mmsg", [&](uint64_t node_id) { return std::make_shared<UdpTransport>(node_id, book); }, listeners, port += 2);
+    }
+    return 0;
+}
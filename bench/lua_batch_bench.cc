@@ -0,0 +1,103 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <thread>
+
+#include <loopback_transport.h>
+#include <zt_lua_wrap.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const int COUNT = 100000;
+// Messages sent before they are received. Small enough for the receive buffers to stay in the
+// cache, like they do when the receiver keeps up
+const int ROUND = 1024;
+
+// Runs chunk on l, returns how long it took and adds the number it returned, if any, to result
+auto time_chunk(lua_State *l, const std::string &chunk, lua_Integer &result) -> std::chrono::nanoseconds
+{
+    const auto start = std::chrono::steady_clock::now();
+    if(luaL_dostring(l, chunk.c_str()))
+    {
+        std::cerr << lua_tostring(l, -1) << std::endl;
+    }
+    const auto took = std::chrono::steady_clock::now() - start;
+    result += lua_isinteger(l, -1) ? lua_tointeger(l, -1) : 0;
+    lua_settop(l, 0);
+    return took;
+}
+
+// Per message cost of the Lua calls, one crossing per message against one per batch of 64. The
+// messages go in rounds of ROUND, each received once the listener queued it
+auto run(const char *name, const std::string &send, const std::string &recv) -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    options.recv_limits = QueueLimits();
+    ZTLua a(std::make_shared<LoopbackTransport>(network, 0xa), 9000, options);
+    ZTLua b(std::make_shared<LoopbackTransport>(network, 0xb), 9000, options);
+    lua_State *la = luaL_newstate();
+    lua_State *lb = luaL_newstate();
+    luaL_openlibs(la);
+    luaL_openlibs(lb);
+    a.register_wrappers(la);
+    b.register_wrappers(lb);
+    const std::string prelude = "N = " + std::to_string(ROUND) + " m = string.rep('x', 64) ";
+    luaL_dostring(la, prelude.c_str());
+    luaL_dostring(lb, prelude.c_str());
+
+    std::chrono::nanoseconds send_time(0);
+    std::chrono::nanoseconds recv_time(0);
+    lua_Integer unused = 0;
+    lua_Integer received = 0;
+    for(int i = 0; i < COUNT / ROUND; i++)
+    {
+        send_time += time_chunk(la, send, unused);
+        // the listener has all of them queued long before that
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        recv_time += time_chunk(lb, recv, received);
+    }
+    const int sent = COUNT / ROUND * ROUND;
+    std::cout << name << ": " << send_time.count() / static_cast<double>(sent) << " ns per message sent, "
+              << recv_time.count() / static_cast<double>(sent) << " ns per message received, " << received << "/" << sent
+              << " received" << std::endl;
+    lua_close(la);
+    lua_close(lb);
+}
+
+}
+
+auto main() -> int
+{
+    run("udp_send/udp_recv",
+        "for i = 1, N do udp_send(0xb, m) end",
+        "local n = 0 while udp_recv(0xa) do n = n + 1 end return n");
+    run("udp_send_many/udp_recv_many",
+        "local t = {} for i = 1, 64 do t[i] = m end for i = 1, N // 64 do udp_send_many(0xb, t) end",
+        "local n, c = 0 repeat out, c = udp_recv_many(0xa, 64, out) n = n + c until c == 0 return n");
+    return 0;
+}
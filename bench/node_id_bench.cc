@@ -0,0 +1,55 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <random>
+#include <vector>
+
+#include <legacy_node_id.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+// Decoding the sender of a datagram: the old string round trip against addr_to_node_id
+auto main() -> int
+{
+    const uint64_t nwid = 0x8056c2e21c000001;
+    const std::size_t count = 1000000;
+    std::mt19937_64 rng(42);
+    std::vector<zts_sockaddr_in6> addrs;
+    for(int i = 0; i < 1024; i++)
+    {
+        addrs.push_back(node_addr(nwid, rng() & ((1ull << 40) - 1), 9000));
+    }
+
+    std::size_t i = 0;
+    volatile uint64_t sink = 0;
+    double legacy_ns = ns_per_op(count, [&] {
+        sink = sink + legacy::addr_str_to_id(*legacy::addr_to_string(&addrs[i++ % addrs.size()]));
+    });
+    double decode_ns = ns_per_op(count, [&] {
+        sink = sink + addr_to_node_id(nwid, addrs[i++ % addrs.size()]).value_or(0);
+    });
+
+    std::cout << "addr_to_string + addr_str_to_id: " << legacy_ns << " ns" << std::endl;
+    std::cout << "addr_to_node_id: " << decode_ns << " ns" << std::endl;
+    return 0;
+}
@@ -0,0 +1,77 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+// Receive cost against the depth of the peer's queue, it should stay flat up to 100k
+auto main() -> int
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    options.recv_limits = QueueLimits();
+    CommLayer sender(std::make_shared<LoopbackTransport>(network, 0xa), 9000, options);
+    CommLayer receiver(std::make_shared<LoopbackTransport>(network, 0xb), 9000, options);
+
+    const std::string msg(64, 'm');
+    std::vector<MsgRef> out;
+    for(std::size_t depth : { 100, 1000, 10000, 100000 })
+    {
+        for(bool many : { false, true })
+        {
+            for(std::size_t i = 0; i < depth; i++)
+            {
+                sender.udp_send(0xb, msg);
+            }
+            if(!wait_until([&] { return receiver.udp_recv_stats().msgs == depth; }, std::chrono::seconds(30)))
+            {
+                std::cerr << "only " << receiver.udp_recv_stats().msgs << " of " << depth << " messages arrived" << std::endl;
+                return 1;
+            }
+            std::size_t received = 0;
+            double ns = 0;
+            if(many)
+            {
+                ns = ns_per_op(depth / 64 + 1, [&] {
+                    out.clear();
+                    received += receiver.udp_recv_many(0xa, 0, 64, out);
+                }) * (depth / 64 + 1) / depth;
+            }
+            else
+            {
+                ns = ns_per_op(depth, [&] { received += static_cast<bool>(receiver.udp_recv_buf(0xa)); });
+            }
+            out.clear();
+            if(received != depth)
+            {
+                std::cerr << "received " << received << " of " << depth << " messages" << std::endl;
+                return 1;
+            }
+            std::cout << "depth " << depth << (many ? " udp_recv_many(64): " : " udp_recv_buf: ") << ns << " ns/msg" << std::endl;
+        }
+    }
+    return 0;
+}
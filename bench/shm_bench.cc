@@ -0,0 +1,85 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <thread>
+
+#include <unistd.h>
+
+#include <comm_layer.h>
+#include <udp_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// Round trips of udp_send/udp_recv between two CommLayers of this process, half of one is the latency
+auto run(const char *name, bool shm, int port) -> void
+{
+    const std::unordered_map<uint64_t, std::string> book = { { 0xa, "127.0.0.2" }, { 0xb, "127.0.0.3" } };
+    CommOptions options;
+    options.shm.enabled = shm;
+    options.shm.scope = "shm_bench" + std::to_string(getpid());
+    CommLayer a(std::make_shared<UdpTransport>(0xa, book), port, options);
+    CommLayer b(std::make_shared<UdpTransport>(0xb, book), port, options);
+    const std::chrono::milliseconds timeout(500);
+    const int count = 20000;
+    const std::string msg(64, 'x');
+
+    std::thread echo([&] {
+        for(int i = 0; i < count + 100; i++)
+        {
+            MsgRef m = b.udp_recv_buf(0xa, timeout);
+            if(!m)
+            {
+                return;
+            }
+            b.udp_send(0xa, std::string_view(m.data(), m.size()));
+        }
+    });
+    // the first round trips go through the handshakes
+    for(int i = 0; i < 100; i++)
+    {
+        a.udp_send(0xb, msg);
+        a.udp_recv_buf(0xb, timeout);
+    }
+    int lost = 0;
+    const double ns = ns_per_op(count, [&] {
+        a.udp_send(0xb, msg);
+        lost += !a.udp_recv_buf(0xb, timeout);
+    });
+    echo.join();
+    std::cout << name << ": " << ns / 2000 << " us one way, " << lost << " lost" << std::endl;
+}
+
+}
+
+// Same-host latency through shared memory against the kernel udp transport. Every hop wakes a
+// listener and a receiver thread, so below a few cores the thread switches dominate either way.
+// Needs 127.0.0.2 and 127.0.0.3 (any 127/8 address works on Linux)
+auto main() -> int
+{
+    run("udp", false, 9500);
+    run("shm", true, 9502);
+    return 0;
+}
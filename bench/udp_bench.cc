@@ -0,0 +1,182 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <thread>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <udp_transport.h>
+#include <zt_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// What udp_send did before it kept its send sockets: bind a socket, sendto once and close it for
+// every datagram. Receiving goes through a plain UdpTransport
+class SocketPerSend : public Transport
+{
+public:
+    SocketPerSend(uint64_t node_id, const std::unordered_map<uint64_t, std::string> &book, const UdpOptions &options) :
+        inner(node_id, book, options),
+        book(book)
+    {
+    }
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override
+    {
+        return inner.bind(port);
+    }
+
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override
+    {
+        sockaddr_in local = { AF_INET, 0, {}, {} };
+        sockaddr_in remote = { AF_INET, htons(port), {}, {} };
+        inet_pton(AF_INET, book.at(inner.node_id()).c_str(), &local.sin_addr);
+        inet_pton(AF_INET, book.at(node_id).c_str(), &remote.sin_addr);
+        int fd;
+        if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            return -errno;
+        }
+        int err = 0;
+        if(::bind(fd, (const sockaddr *)&local, sizeof(local)) < 0 || sendto(fd, data, len, 0, (const sockaddr *)&remote, sizeof(remote)) < 0)
+        {
+            err = -errno;
+        }
+        close(fd);
+        return err < 0 ? err : static_cast<int>(len);
+    }
+
+    auto node_id() const -> uint64_t override
+    {
+        return inner.node_id();
+    }
+
+private:
+    UdpTransport inner;
+    std::unordered_map<uint64_t, std::string> book;
+};
+
+// One sender, one receiver thread, messages/s of udp_send/udp_recv between two CommLayers
+auto run(const char *name, std::shared_ptr<Transport> a, std::shared_ptr<Transport> b, int port, std::size_t size, int count) -> void
+{
+    CommOptions options;
+    options.shm.enabled = false;
+    CommLayer sender(a, port, options);
+    CommLayer receiver(b, port, options);
+    const uint64_t from = a->node_id();
+    const uint64_t to = b->node_id();
+    const std::string msg(size, 'x');
+
+    std::atomic<int> received{0};
+    // stay within the receive queue's cap and the socket buffers, a drop would stall the receiver for 500ms
+    const int window = static_cast<int>(std::min<std::size_t>(2048, 1024 * 1024 / size));
+    const auto start = std::chrono::steady_clock::now();
+    std::thread rx([&] {
+        while(received < count && receiver.udp_recv_buf(from, std::chrono::milliseconds(500)))
+        {
+            received++;
+        }
+    });
+    for(int i = 0; i < count; i++)
+    {
+        while(i - received.load() > window)
+        {
+            std::this_thread::yield();
+        }
+        sender.udp_send(to, msg);
+    }
+    rx.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ", " << size << " B: " << received.load() << "/" << count << " received, " << received / secs / 1000 << "k msgs/s" << std::endl;
+}
+
+}
+
+// The kernel udp transport's engines against the in-process loopback. Needs 127.0.0.2 and 127.0.0.3
+// (any 127/8 address works on Linux). A socket per datagram against the kept socket shows what
+// reusing send sockets saves, on the libzt transport as well if there's a ZeroTier node
+auto main() -> int
+{
+    const std::unordered_map<uint64_t, std::string> book = { { 0xa, "127.0.0.2" }, { 0xb, "127.0.0.3" } };
+    int port = 9400;
+    for(std::size_t size : { 100, 20000 })
+    {
+        const int count = size < 1000 ? 200000 : 5000;
+        auto network = std::make_shared<LoopbackNetwork>();
+        run("loopback", std::make_shared<LoopbackTransport>(network, 0xa), std::make_shared<LoopbackTransport>(network, 0xb), port += 2, size, count);
+
+        UdpOptions plain;
+        plain.gso = false;
+        plain.gro = false;
+        plain.batch_depth = 1;
+        run("udp socket per datagram", std::make_shared<SocketPerSend>(0xa, book, plain), std::make_shared<UdpTransport>(0xb, book, plain), port += 2, size, count);
+        run("udp sendto/recvfrom", std::make_shared<UdpTransport>(0xa, book, plain), std::make_shared<UdpTransport>(0xb, book, plain), port += 2, size, count);
+
+        UdpOptions mmsg;
+        mmsg.gso = false;
+        mmsg.gro = false;
+        run("udp mmsg", std::make_shared<UdpTransport>(0xa, book, mmsg), std::make_shared<UdpTransport>(0xb, book, mmsg), port += 2, size, count);
+
+        run("udp mmsg+gso/gro", std::make_shared<UdpTransport>(0xa, book), std::make_shared<UdpTransport>(0xb, book), port += 2, size, count);
+
+        UdpOptions uring;
+        uring.engine = UdpEngine::io_uring;
+        run("udp io_uring", std::make_shared<UdpTransport>(0xa, book, uring), std::make_shared<UdpTransport>(0xb, book, uring), port += 2, size, count);
+    }
+
+    // a process is a single libzt node, so the zt numbers are of sends to itself, without CommLayer
+    const uint64_t nwid = 0x8056c2e21c000001;
+    zts_join(nwid);
+    ZtTransport probe(nwid);
+    auto endpoint = probe.bind(port += 2);
+    if(!endpoint)
+    {
+        std::cout << "zt: no libzt node, skipped" << std::endl;
+        return 0;
+    }
+    const std::string msg(100, 'x');
+    const uint64_t self = probe.node_id();
+    // the socket setup and teardown udp_send used to pay around every send
+    std::cout << "zt socket per datagram, 100 B: " << 1e6 / ns_per_op(20000, [&] {
+        int fd = zts_socket(ZTS_PF_INET6, ZTS_SOCK_DGRAM, 0);
+        probe.send(self, port, msg.data(), msg.size());
+        zts_close(fd);
+    }) << "k msgs/s sent" << std::endl;
+    for(bool per_peer : { false, true })
+    {
+        ZtOptions zt;
+        zt.per_peer_send_socks = per_peer;
+        ZtTransport transport(nwid, zt);
+        std::cout << (per_peer ? "zt connected socket per peer" : "zt shared socket") << ", 100 B: "
+                  << 1e6 / ns_per_op(20000, [&] { transport.send(self, port, msg.data(), msg.size()); }) << "k msgs/s sent" << std::endl;
+    }
+    return 0;
+}
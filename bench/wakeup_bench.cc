@@ -0,0 +1,90 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+using namespace std::chrono;
+
+// Time from udp_send to a receiver parked in udp_recv(timeout) having the message, with the
+// receiver busy-polling udp_recv_buf as the baseline. The sender pauses between messages so the
+// receiver (and the listener without listener_spin) is parked every time
+auto main() -> int
+{
+    const std::size_t COUNT = 2000;
+    for(auto spin : { microseconds(0), microseconds(50) })
+    {
+        for(bool blocking : { true, false })
+        {
+            auto network = std::make_shared<LoopbackNetwork>();
+            CommOptions options;
+            options.shm.enabled = false;
+            options.listener_spin = spin;
+            CommLayer sender(std::make_shared<LoopbackTransport>(network, 0xa), 9000, options);
+            CommLayer receiver(std::make_shared<LoopbackTransport>(network, 0xb), 9000, options);
+
+            std::vector<double> latencies;
+            latencies.reserve(COUNT);
+            std::thread t([&]() {
+                while(latencies.size() < COUNT)
+                {
+                    MsgRef msg = blocking ? receiver.udp_recv_buf(0xa, 0, seconds(5)) : receiver.udp_recv_buf(0xa);
+                    if(!msg)
+                    {
+                        if(blocking)
+                        {
+                            return;
+                        }
+                        continue;
+                    }
+                    const auto now = steady_clock::now().time_since_epoch().count();
+                    int64_t sent;
+                    std::memcpy(&sent, msg.data(), sizeof(sent));
+                    latencies.push_back((now - sent) / 1000.0);
+                }
+            });
+            for(std::size_t i = 0; i < COUNT; i++)
+            {
+                std::this_thread::sleep_for(microseconds(500));
+                const int64_t now = steady_clock::now().time_since_epoch().count();
+                sender.udp_send(0xb, std::string_view(reinterpret_cast<const char *>(&now), sizeof(now)));
+            }
+            t.join();
+            if(latencies.size() < COUNT)
+            {
+                std::cerr << "only " << latencies.size() << " of " << COUNT << " messages arrived" << std::endl;
+                return 1;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            std::cout << "listener_spin " << spin.count() << " us, " << (blocking ? "udp_recv(timeout): " : "polling udp_recv: ")
+                      << "median " << latencies[COUNT / 2] << " us, p99 " << latencies[COUNT * 99 / 100] << " us" << std::endl;
+        }
+    }
+    return 0;
+}
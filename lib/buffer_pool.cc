@@ -0,0 +1,249 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <buffer_pool.h>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------MsgRef------------------------------------------------------------------
+
+MsgRef::MsgRef() :
+    buf(nullptr)
+{ }
+
+MsgRef::MsgRef(recv_buffer *buf) :
+    buf(buf)
+{ }
+
+MsgRef::MsgRef(const MsgRef &copy) :
+    buf(copy.buf)
+{
+    if(buf)
+    {
+        BufferPool::retain(buf);
+    }
+}
+
+MsgRef::MsgRef(MsgRef &&move) :
+    buf(move.buf)
+{
+    move.buf = nullptr;
+}
+
+MsgRef::~MsgRef()
+{
+    if(buf)
+    {
+        BufferPool::release(buf);
+    }
+}
+
+auto MsgRef::operator=(const MsgRef &copy) -> const MsgRef &
+{
+    if(copy.buf)
+    {
+        BufferPool::retain(copy.buf);
+    }
+    if(buf)
+    {
+        BufferPool::release(buf);
+    }
+    buf = copy.buf;
+    return *this;
+}
+
+auto MsgRef::operator=(MsgRef &&move) -> const MsgRef &
+{
+    std::swap(buf, move.buf);
+    return *this;
+}
+
+MsgRef::operator bool() const
+{
+    return buf != nullptr;
+}
+
+auto MsgRef::data() const -> const char *
+{
+    return buf->data + buf->offset;
+}
+
+auto MsgRef::size() const -> std::size_t
+{
+    return buf->len;
+}
+
+auto MsgRef::str() const -> std::string
+{
+    return std::string(buf->data + buf->offset, buf->len);
+}
+
+//--------------------------------------------------------------BufferPool--------------------------------------------------------------
+
+BufferPool::BufferPool(std::size_t buffer_size, std::size_t buffers_per_slab) :
+    BUFFER_SIZE(buffer_size),
+    SLAB_BUFFERS(buffers_per_slab ? buffers_per_slab : 1),
+    free_list(nullptr)
+{ }
+
+BufferPool::~BufferPool()
+{ }
+
+auto BufferPool::acquire() -> recv_buffer *
+{
+    recv_buffer *buf;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!free_list)
+        {
+            grow();
+        }
+        buf = free_list;
+        free_list = buf->next.load(std::memory_order_relaxed);
+    }
+    buf->next.store(nullptr, std::memory_order_relaxed);
+    buf->refs.store(1, std::memory_order_relaxed);
+    buf->offset = 0;
+    buf->len = 0;
+    return buf;
+}
+
+auto BufferPool::acquire(std::size_t size) -> recv_buffer *
+{
+    if(size <= BUFFER_SIZE)
+    {
+        return acquire();
+    }
+    recv_buffer *buf = new recv_buffer;
+    buf->next.store(nullptr, std::memory_order_relaxed);
+    buf->refs.store(1, std::memory_order_relaxed);
+    buf->pool = this;
+    buf->data = new char[size];
+    buf->cap = size;
+    buf->offset = 0;
+    buf->len = 0;
+    buf->jumbo = true;
+    return buf;
+}
+
+auto BufferPool::buffer_size() const -> std::size_t
+{
+    return BUFFER_SIZE;
+}
+
+auto BufferPool::allocated() const -> std::size_t
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return headers.size() * SLAB_BUFFERS;
+}
+
+auto BufferPool::retain(recv_buffer *buf) -> void
+{
+    buf->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto BufferPool::release(recv_buffer *buf) -> void
+{
+    if(buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        buf->pool->recycle(buf);
+    }
+}
+
+auto BufferPool::release(std::vector<MsgRef> &msgs) -> void
+{
+    BufferPool *pool = nullptr;
+    recv_buffer *first = nullptr;
+    recv_buffer *last = nullptr;
+    for(MsgRef &m : msgs)
+    {
+        recv_buffer *buf = m.buf;
+        m.buf = nullptr;
+        if(!buf || buf->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            continue;
+        }
+        if(buf->jumbo)
+        {
+            buf->pool->recycle(buf);
+            continue;
+        }
+        if(buf->pool != pool && first)
+        {
+            pool->recycle(first, last);
+            first = nullptr;
+        }
+        pool = buf->pool;
+        buf->next.store(first, std::memory_order_relaxed);
+        last = first ? last : buf;
+        first = buf;
+    }
+    if(first)
+    {
+        pool->recycle(first, last);
+    }
+    msgs.clear();
+}
+
+auto BufferPool::recycle(recv_buffer *first, recv_buffer *last) -> void
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    last->next.store(free_list, std::memory_order_relaxed);
+    free_list = first;
+}
+
+auto BufferPool::recycle(recv_buffer *buf) -> void
+{
+    if(buf->jumbo)
+    {
+        delete[] buf->data;
+        delete buf;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    buf->next.store(free_list, std::memory_order_relaxed);
+    free_list = buf;
+}
+
+auto BufferPool::grow() -> void
+{
+    std::unique_ptr<recv_buffer[]> hdrs(new recv_buffer[SLAB_BUFFERS]);
+    std::unique_ptr<char[]> slab(new char[SLAB_BUFFERS * BUFFER_SIZE]);
+    for(std::size_t i = 0; i < SLAB_BUFFERS; i++)
+    {
+        recv_buffer &b = hdrs[i];
+        b.refs.store(0, std::memory_order_relaxed);
+        b.pool = this;
+        b.data = slab.get() + i * BUFFER_SIZE;
+        b.cap = BUFFER_SIZE;
+        b.offset = 0;
+        b.len = 0;
+        b.jumbo = false;
+        b.next.store(free_list, std::memory_order_relaxed);
+        free_list = &b;
+    }
+    headers.push_back(std::move(hdrs));
+    slabs.push_back(std::move(slab));
+}
+
+} // namespace standby_network
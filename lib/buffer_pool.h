@@ -0,0 +1,133 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <bits/stdint-uintn.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace standby_network
+{
+
+class BufferPool;
+
+/**
+ * A reference-counted receive buffer. The listener receives straight into data and the same
+ * buffer travels through the peer queue (next links it there) to the consumer, so a payload is
+ * only ever copied by whoever finally needs it somewhere else (e.g. lua_pushlstring).
+ */
+struct recv_buffer
+{
+    std::atomic<recv_buffer *> next;
+    std::atomic<int> refs;
+    BufferPool *pool;
+    char *data;
+    uint32_t cap;
+    // the message is data[offset, offset + len), offset skips the frame header
+    uint32_t offset;
+    uint32_t len;
+    // arrival order within a PeerTable
+    uint64_t seq;
+    // allocated on its own by acquire(size), freed instead of recycled
+    bool jumbo;
+};
+
+// Owning handle of a received message, releases its buffer when destroyed
+class MsgRef
+{
+public:
+    MsgRef();
+    explicit MsgRef(recv_buffer *buf);
+    MsgRef(const MsgRef &copy);
+    MsgRef(MsgRef &&move);
+    ~MsgRef();
+
+public:
+    auto operator=(const MsgRef &copy) -> const MsgRef &;
+    auto operator=(MsgRef &&move) -> const MsgRef &;
+    explicit operator bool() const;
+
+public:
+    auto data() const -> const char *;
+    auto size() const -> std::size_t;
+    auto str() const -> std::string;
+
+private:
+    friend class BufferPool;
+
+    recv_buffer *buf;
+};
+
+/**
+ * Slab allocator of fixed-size receive buffers. Released buffers go back to a free list,
+ * so once the pool grew to the working set receiving allocates nothing.
+ * Buffers (and MsgRefs) must not outlive their pool.
+ */
+class BufferPool
+{
+public:
+    BufferPool(std::size_t buffer_size, std::size_t buffers_per_slab = 64);
+    BufferPool(const BufferPool &) = delete;
+    ~BufferPool();
+
+public:
+    auto operator=(const BufferPool &) -> const BufferPool & = delete;
+
+public:
+    // returns a buffer with a single reference
+    auto acquire() -> recv_buffer *;
+    // Same, but at least size bytes long. Bigger than buffer_size() means a one-off allocation
+    auto acquire(std::size_t size) -> recv_buffer *;
+    auto buffer_size() const -> std::size_t;
+    auto allocated() const -> std::size_t;
+
+    static auto retain(recv_buffer *buf) -> void;
+    static auto release(recv_buffer *buf) -> void;
+    // Releases every message of msgs and clears it. The buffers of a run from the same pool go
+    // back to it under a single lock
+    static auto release(std::vector<MsgRef> &msgs) -> void;
+
+private:
+    // expects mutex to be locked
+    auto grow() -> void;
+    auto recycle(recv_buffer *buf) -> void;
+    // recycles the chain first -> ... -> last of this pool's (non jumbo) buffers
+    auto recycle(recv_buffer *first, recv_buffer *last) -> void;
+
+private:
+    const std::size_t BUFFER_SIZE;
+    const std::size_t SLAB_BUFFERS;
+
+    mutable std::mutex mutex;
+    recv_buffer *free_list;
+    std::vector<std::unique_ptr<recv_buffer[]>> headers;
+    std::vector<std::unique_ptr<char[]>> slabs;
+};
+
+} // namespace standby_network
+
+#endif // _BUFFER_POOL_H_
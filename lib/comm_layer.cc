@@ -1,365 +1,1507 @@
 #include <comm_layer.h>
 
 #include <iostream>
-#include <sstream>
+#include <algorithm>
+#include <cerrno>
 
-#include <ZeroTierSockets.h>
+#include <frame.h>
 
 namespace standby_network
 {
 
 //--------------------------------------------------------------helpers-----------------------------------------------------------------
 
-auto string_to_addr(const std::string str) -> std::optional<zts_sockaddr_in6>
+// Fragments handed to Transport::send_many at once
+const std::size_t SEND_BATCH = 64;
+// udp_queues keys hold the channel and the priority above the node id, ZeroTier node ids are 40 bits long
+const int CHANNEL_KEY_SHIFT = 56;
+const int PRIORITY_KEY_SHIFT = 48;
+const uint64_t NODE_KEY_MASK = (1ull << PRIORITY_KEY_SHIFT) - 1;
+
+auto udp_queue_key(uint64_t node_id, uint8_t channel, UdpPriority priority) -> uint64_t
+{
+    return (node_id & NODE_KEY_MASK) | static_cast<uint64_t>(priority) << PRIORITY_KEY_SHIFT | static_cast<uint64_t>(channel) << CHANNEL_KEY_SHIFT;
+}
+
+auto udp_queue_node(uint64_t key) -> uint64_t
+{
+    return key & NODE_KEY_MASK;
+}
+
+auto udp_queue_channel(uint64_t key) -> uint8_t
+{
+    return static_cast<uint8_t>(key >> CHANNEL_KEY_SHIFT);
+}
+
+auto udp_queue_priority(uint64_t key) -> UdpPriority
+{
+    return static_cast<UdpPriority>(static_cast<uint8_t>(key >> PRIORITY_KEY_SHIFT));
+}
+
+// The priority class of a received frame, bulk for values we don't know
+auto frame_priority(uint8_t header) -> UdpPriority
+{
+    return static_cast<UdpPriority>(std::min<std::size_t>((header & FRAME_PRIORITY_MASK) >> FRAME_PRIORITY_SHIFT, UDP_PRIORITIES - 1));
+}
+
+// Length of the trailer frames of channel get
+auto channel_trailer_length(uint8_t channel) -> std::size_t
+{
+    return channel != 0 ? CHANNEL_TRAILER_LENGTH : 0;
+}
+
+// The flags of the header byte of a frame
+auto frame_flags(uint8_t channel, UdpPriority priority) -> uint8_t
+{
+    return (channel != 0 ? FRAME_CHANNEL : 0) | static_cast<uint8_t>(priority) << FRAME_PRIORITY_SHIFT;
+}
+
+// Frames msg as a single FRAME_DATA datagram into out, which has to have room for it. Returns its length
+auto write_data_frame(char *out, uint8_t channel, UdpPriority priority, std::string_view msg) -> std::size_t
+{
+    out[0] = static_cast<char>(frame_flags(channel, priority) | FRAME_DATA);
+    std::copy(msg.begin(), msg.end(), out + DATA_HEADER_LENGTH);
+    if(channel != 0)
+    {
+        out[DATA_HEADER_LENGTH + msg.size()] = static_cast<char>(channel);
+    }
+    return DATA_HEADER_LENGTH + msg.size() + channel_trailer_length(channel);
+}
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+CommLayer::CommLayer(uint64_t nwid, int port, const CommOptions &options) : 
+    CommLayer(std::make_shared<ZtTransport>(nwid, options.zt), port, options)
+{
+    NWID = nwid;
+}
+
+CommLayer::CommLayer(std::shared_ptr<Transport> transport, int port, const CommOptions &options) : 
+    run(true),
+    PORT(port),
+    opts(options),
+    transport(transport),
+    udp_endpoints(transport->bind_shared(port, std::max<std::size_t>(options.listener_threads, 1))),
+    rudp_endpoint(transport->bind(port + RUDP_PORT_OFFSET)),
+    // without its node id (a libzt node that isn't online yet) other local nodes couldn't tell who sent what
+    local(options.shm.enabled && transport->node_id() ? std::make_shared<ShmTransport>(transport->node_id(), options.shm) : nullptr),
+    local_endpoint(local ? local->bind(port) : nullptr),
+    buffers(std::make_unique<BufferPool>(MSG_MAX_LENGTH)),
+    udp_usage(std::make_unique<queue_usage>()),
+    udp_queues{
+        std::make_unique<PeerTable>(options.peer_table_capacity, options.listener_threads, options.recv_limits, udp_usage.get()),
+        std::make_unique<PeerTable>(options.peer_table_capacity, options.listener_threads, options.recv_limits, udp_usage.get()),
+        std::make_unique<PeerTable>(options.peer_table_capacity, options.listener_threads, options.recv_limits, udp_usage.get())},
+    rudp_queues(std::make_unique<PeerTable>(options.peer_table_capacity, 1, options.recv_limits, udp_usage.get())),
+    rudp(std::make_unique<Rudp>(
+        [this](uint64_t node_id, const char *data, std::size_t len) { return rudp_send_datagram(node_id, data, len); },
+        [this](uint64_t node_id, const char *data, std::size_t len) { rudp_deliver(node_id, data, len); },
+        options.rudp)),
+    send_lanes(std::make_unique<SendLanes>(options.send_limits, options.interactive_quantum, options.bulk_quantum)),
+    outbox(std::make_unique<Outbox>()),
+    rudp_thread(&CommLayer::rudp_listener, this),
+    flush_thread(&CommLayer::coalesce_flusher, this),
+    send_thread(options.async_send ? std::thread(&CommLayer::async_sender, this) : std::thread())
+{
+    if(udp_endpoints.empty())
+    {
+        std::cerr << "Couldn't bind port " << PORT << ", not listening" << std::endl;
+    }
+    else if(udp_endpoints.size() < opts.listener_threads)
+    {
+        std::cerr << "The transport can't share port " << PORT << " between " << opts.listener_threads
+                  << " listeners, receiving on " << udp_endpoints.size() << std::endl;
+    }
+    reassembly_share = opts.reassembly_memory / std::max<std::size_t>(udp_endpoints.size() + (local_endpoint ? 1 : 0), 1);
+    for(auto &endpoint : udp_endpoints)
+    {
+        start_udp_listener(endpoint.get());
+    }
+    if(local && !local_endpoint)
+    {
+        std::cerr << "Couldn't bind port " << PORT << " for same-host peers, they can only reach us over the network" << std::endl;
+    }
+    if(local_endpoint)
+    {
+        start_udp_listener(local_endpoint.get());
+    }
+}
+
+CommLayer::~CommLayer()
+{
+    {
+        // run is flipped under send_mutex, so the flusher can't miss the notification
+        std::lock_guard<std::mutex> lock(send_mutex);
+        run = false;
+        flush_cv.notify_all();
+    }
+    if(flush_thread.joinable())
+    {
+        flush_thread.join();
+    }
+    if(send_thread.joinable())
+    {
+        // it sends what's left in the outbox before it returns
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            outbox_cv.notify_all();
+        }
+        send_thread.join();
+    }
+    notify_arrival();
+    for(auto &endpoint : udp_endpoints)
+    {
+        endpoint->wakeup();
+    }
+    if(rudp_endpoint)
+    {
+        rudp_endpoint->wakeup();
+    }
+    if(local_endpoint)
+    {
+        local_endpoint->wakeup();
+    }
+    for(auto &thread : udp_threads)
+    {
+        thread.join();
+    }
+    if(rudp_thread.joinable())
+    {
+        rudp_thread.join();
+    }
+    drain_send_lanes();
+    // blocked receivers were woken up above and see run cleared, they still touch the members
+    // on their way out
+    while(waiters.load() > 0)
+    {
+        std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(send_mutex);
+    for(auto &b : bundles)
+    {
+        flush_coalesced(b.first, b.second);
+    }
+}
+
+auto CommLayer::udp_send(uint64_t node_id, std::string_view msg) -> int
+{
+    return udp_send(node_id, 0, msg);
+}
+
+auto CommLayer::udp_send(uint64_t node_id, uint8_t channel, std::string_view msg, UdpPriority priority) -> int
+{
+    return send_udp(node_id, channel, msg, priority, nullptr);
+}
+
+auto CommLayer::send_udp(uint64_t node_id, uint8_t channel, std::string_view msg, UdpPriority priority, peer_routes *routes) -> int
+{
+    if(msg.size() > opts.max_message_size)
+    {
+        std::cerr << "Message too long: " << msg.size() << " bytes" << std::endl;
+        return -1;
+    }
+
+    if(opts.async_send)
+    {
+        int ticket;
+        if((ticket = queue_outbox(node_id, channel, priority, msg)) < 0)
+        {
+            return ticket;
+        }
+        // pairs with the one in async_sender, either it sees the entry or we see it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sender_parked.load())
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            outbox_cv.notify_one();
+        }
+        return ticket;
+    }
+
+    bool direct;
+    send_waiter waiter;
+    {
+        std::lock_guard<std::mutex> lock(lanes_mutex);
+        // nothing queued and nobody sending: msg goes out right away, the caller gets its result
+        direct = send_lanes->empty() && !sending.exchange(true);
+        if(!direct && !push_lane({ node_id, channel, priority, std::string(msg), 0, &waiter }))
+        {
+            // a dropped message is lost like a datagram would be, only a rejected one is reported
+            return opts.send_limits.policy == OverflowPolicy::reject ? -EAGAIN : static_cast<int>(msg.size());
+        }
+    }
+    if(!direct)
+    {
+        wait_sent(waiter);
+        return waiter.failed == SIZE_MAX ? static_cast<int>(msg.size()) : waiter.error;
+    }
+    int err;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        err = send_now(node_id, channel, priority, msg, routes);
+    }
+    sending = false;
+    // others may have queued messages meanwhile
+    drain_send_lanes();
+    return err;
+}
+
+auto CommLayer::udp_coalesce(uint64_t node_id, bool enable) -> void
+{
+    std::lock_guard<std::mutex> lock(send_mutex);
+    if(enable)
+    {
+        coalesced.insert(node_id);
+        return;
+    }
+    if(coalesced.erase(node_id) == 0)
+    {
+        return;
+    }
+    for(auto it = bundles.begin(); it != bundles.end();)
+    {
+        if(udp_queue_node(it->first) == udp_queue_node(node_id))
+        {
+            flush_coalesced(it->first, it->second);
+            it = bundles.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+auto CommLayer::udp_flush(uint64_t node_id) -> int
+{
+    std::lock_guard<std::mutex> lock(send_mutex);
+    int err = 0;
+    for(auto &b : bundles)
+    {
+        int e;
+        if(udp_queue_node(b.first) == udp_queue_node(node_id) && (e = flush_coalesced(b.first, b.second)) < 0)
+        {
+            err = e;
+        }
+    }
+    return err;
+}
+
+auto CommLayer::udp_flush() -> int
+{
+    std::lock_guard<std::mutex> lock(send_mutex);
+    int err = 0;
+    for(auto &b : bundles)
+    {
+        int e;
+        if((e = flush_coalesced(b.first, b.second)) < 0)
+        {
+            err = e;
+        }
+    }
+    return err;
+}
+
+auto CommLayer::udp_send_many(const outgoing_msg *msgs, std::size_t count, std::vector<int> *tickets) -> int
+{
+    std::size_t n = 0;
+    while(n < count && msgs[n].data.size() <= opts.max_message_size)
+    {
+        n++;
+    }
+    if(n < count)
+    {
+        std::cerr << "Message too long: " << msgs[n].data.size() << " bytes" << std::endl;
+        if(n == 0)
+        {
+            return -1;
+        }
+    }
+
+    if(opts.async_send)
+    {
+        std::size_t queued = 0;
+        int ticket;
+        while(queued < n && (ticket = queue_outbox(msgs[queued].node_id, msgs[queued].channel, msgs[queued].priority, msgs[queued].data)) > 0)
+        {
+            if(tickets)
+            {
+                tickets->push_back(ticket);
+            }
+            queued++;
+        }
+        // one wakeup for the whole batch, see udp_send
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(queued > 0 && sender_parked.load())
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            outbox_cv.notify_one();
+        }
+        return queued > 0 ? static_cast<int>(queued) : -EAGAIN;
+    }
+
+    bool direct;
+    std::size_t queued = 0;
+    send_waiter waiter;
+    {
+        std::lock_guard<std::mutex> lock(lanes_mutex);
+        direct = send_lanes->empty() && !sending.exchange(true);
+        while(!direct && queued < n && push_lane({ msgs[queued].node_id, msgs[queued].channel, msgs[queued].priority, std::string(msgs[queued].data), 0, &waiter, queued }))
+        {
+            queued++;
+        }
+    }
+    if(!direct)
+    {
+        wait_sent(waiter);
+        if(waiter.failed != SIZE_MAX)
+        {
+            return waiter.failed > 0 ? static_cast<int>(waiter.failed) : waiter.error;
+        }
+        if(queued < n && opts.send_limits.policy != OverflowPolicy::reject)
+        {
+            // the rest was dropped, like datagrams would be
+            return n;
+        }
+        return queued > 0 ? static_cast<int>(queued) : -EAGAIN;
+    }
+    int sent;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        sent = send_msgs(msgs, n);
+    }
+    sending = false;
+    drain_send_lanes();
+    return sent;
+}
+
+auto CommLayer::udp_completions(std::size_t max) -> std::vector<send_completion>
+{
+    std::lock_guard<std::mutex> lock(completion_mutex);
+    const std::size_t n = std::min(max, completions.size());
+    std::vector<send_completion> out(completions.begin(), completions.begin() + n);
+    completions.erase(completions.begin(), completions.begin() + n);
+    return out;
+}
+
+auto CommLayer::udp_recv(uint64_t node_id) -> std::optional<std::string>
+{
+    return udp_recv(node_id, 0);
+}
+
+auto CommLayer::udp_recv_buf(uint64_t node_id) -> MsgRef
+{
+    return udp_recv_buf(node_id, 0);
+}
+
+auto CommLayer::udp_recv_many(uint64_t node_id, std::size_t max) -> std::vector<std::string>
+{
+    return udp_recv_many(node_id, 0, max);
+}
+
+auto CommLayer::udp_recv(uint64_t node_id, uint8_t channel) -> std::optional<std::string>
+{
+    // return message from the queue
+    MsgRef msg = pop_udp(node_id, channel);
+    if(msg)
+    {
+        return msg.str();
+    }
+    return std::nullopt;
+}
+
+auto CommLayer::udp_recv_buf(uint64_t node_id, uint8_t channel) -> MsgRef
+{
+    return pop_udp(node_id, channel);
+}
+
+auto CommLayer::udp_recv_many(uint64_t node_id, uint8_t channel, std::size_t max) -> std::vector<std::string>
+{
+    std::vector<MsgRef> msgs;
+    udp_recv_many(node_id, channel, max, msgs);
+    std::vector<std::string> out;
+    out.reserve(msgs.size());
+    for(const MsgRef &msg : msgs)
+    {
+        out.push_back(msg.str());
+    }
+    return out;
+}
+
+auto CommLayer::udp_recv_many(uint64_t node_id, uint8_t channel, std::size_t max, std::vector<MsgRef> &out) -> std::size_t
+{
+    std::size_t count = 0;
+    for(std::size_t p = 0; p < UDP_PRIORITIES && count < max; p++)
+    {
+        count += udp_queues[p]->pop_many(udp_queue_key(node_id, channel, static_cast<UdpPriority>(p)), max - count, out);
+    }
+    return count;
+}
+
+auto CommLayer::udp_recv(uint64_t node_id, std::chrono::milliseconds timeout) -> std::optional<std::string>
+{
+    return udp_recv(node_id, 0, timeout);
+}
+
+auto CommLayer::udp_recv_buf(uint64_t node_id, std::chrono::milliseconds timeout) -> MsgRef
+{
+    return udp_recv_buf(node_id, 0, timeout);
+}
+
+auto CommLayer::udp_recv(uint64_t node_id, uint8_t channel, std::chrono::milliseconds timeout) -> std::optional<std::string>
+{
+    MsgRef msg = udp_recv_buf(node_id, channel, timeout);
+    if(msg)
+    {
+        return msg.str();
+    }
+    return std::nullopt;
+}
+
+auto CommLayer::udp_recv_buf(uint64_t node_id, uint8_t channel, std::chrono::milliseconds timeout) -> MsgRef
+{
+    return wait_for_msg(timeout, [this, node_id, channel]() { return pop_udp(node_id, channel); });
+}
+
+auto CommLayer::udp_recv_any(std::chrono::milliseconds timeout) -> std::optional<std::pair<uint64_t, std::string>>
+{
+    uint64_t node_id;
+    MsgRef msg = udp_recv_any_buf(node_id, timeout);
+    if(msg)
+    {
+        return std::make_pair(node_id, msg.str());
+    }
+    return std::nullopt;
+}
+
+auto CommLayer::udp_recv_any_buf(uint64_t &node_id, std::chrono::milliseconds timeout) -> MsgRef
+{
+    uint8_t channel;
+    return udp_recv_any_buf(node_id, channel, timeout);
+}
+
+auto CommLayer::udp_recv_any_buf(uint64_t &node_id, uint8_t &channel, std::chrono::milliseconds timeout) -> MsgRef
+{
+    uint64_t key = 0;
+    MsgRef msg = wait_for_msg(timeout, [this, &key]() { return pop_udp_any(key); });
+    node_id = udp_queue_node(key);
+    channel = udp_queue_channel(key);
+    return msg;
+}
+
+auto CommLayer::udp_peer(uint64_t node_id) -> UdpPeer
+{
+    UdpPeer peer(*this, node_id);
+    if(local)
+    {
+        peer.routes.local = local->resolve(node_id, PORT);
+    }
+    peer.routes.net = transport->resolve(node_id, PORT);
+    return peer;
+}
+
+auto CommLayer::rudp_send(uint64_t node_id, std::string_view msg) -> int
+{
+    // the reliable channel doesn't fragment, a message has to fit in a single datagram
+    if(msg.size() > max_datagram() - Rudp::DATA_HEADER)
+    {
+        std::cerr << "Message too long for the reliable channel: " << msg.size() << " bytes (at most "
+                  << max_datagram() - Rudp::DATA_HEADER << ")" << std::endl;
+        return -1;
+    }
+    return rudp->send(node_id, msg);
+}
+
+auto CommLayer::rudp_recv(uint64_t node_id) -> std::optional<std::string>
+{
+    MsgRef msg = rudp_queues->pop(node_id);
+    if(msg)
+    {
+        return msg.str();
+    }
+    return std::nullopt;
+}
+
+auto CommLayer::rudp_recv_buf(uint64_t node_id) -> MsgRef
+{
+    return rudp_queues->pop(node_id);
+}
+
+auto CommLayer::port() const -> int
+{
+    return PORT;
+}
+
+auto CommLayer::nwid() const -> uint64_t
+{
+    return NWID;
+}
+
+auto CommLayer::async_send() const -> bool
+{
+    return opts.async_send;
+}
+
+auto CommLayer::recv_batch_histogram() const -> std::array<uint64_t, RECV_BATCH_BUCKETS>
+{
+    std::array<uint64_t, RECV_BATCH_BUCKETS> out;
+    for(std::size_t i = 0; i < RECV_BATCH_BUCKETS; i++)
+    {
+        out[i] = recv_batch_counts[i];
+    }
+    return out;
+}
+
+auto CommLayer::udp_recv_stats() const -> queue_stats
+{
+    // messages the tables couldn't even find a queue for count as dropped too
+    uint64_t full = 0;
+    for(auto &q : udp_queues)
+    {
+        full += q->dropped();
+    }
+    full += rudp_queues->dropped();
+    return { udp_usage->msgs.load(), udp_usage->bytes.load(), udp_usage->dropped.load() + full, udp_usage->rejected.load() };
+}
+
+auto CommLayer::udp_send_stats() -> queue_stats
+{
+    std::lock_guard<std::mutex> lock(lanes_mutex);
+    queue_stats s = send_lanes->stats();
+    // in async mode every queued message holds its outbox room until it's sent, the ones in the
+    // send lanes included
+    if(opts.async_send)
+    {
+        s.msgs = outbox->size();
+        s.bytes = outbox->bytes();
+    }
+    s.rejected += outbox_rejected.load();
+    return s;
+}
+
+auto CommLayer::udp_recv_memory() const -> std::size_t
+{
+    std::size_t bytes = 0;
+    for(auto &pool : listener_buffers)
+    {
+        bytes += pool->allocated() * pool->buffer_size();
+    }
+    for(auto &pool : listener_small_buffers)
+    {
+        bytes += pool->allocated() * pool->buffer_size();
+    }
+    return bytes;
+}
+
+auto CommLayer::network_changed() -> void
+{
+    ZtTransport::network_changed();
+}
+
+auto CommLayer::start_udp_listener(Endpoint *endpoint) -> void
+{
+    listener_buffers.push_back(std::make_unique<BufferPool>(MSG_MAX_LENGTH));
+    listener_small_buffers.push_back(std::make_unique<BufferPool>(SMALL_MSG_LENGTH));
+    udp_threads.emplace_back(&CommLayer::udp_listener, this, endpoint, listener_buffers.back().get(), listener_small_buffers.back().get());
+}
+
+auto CommLayer::udp_listener(Endpoint *endpoint, BufferPool *pool, BufferPool *small_pool) -> void
+{
+    const std::size_t batch_size = std::max<std::size_t>(opts.recv_batch_size, 1);
+    // bufs[i] backs dgrams[i], a slot gets a fresh buffer once its last one went into a queue
+    std::vector<recv_buffer *> bufs(batch_size, nullptr);
+    std::vector<datagram> dgrams(batch_size);
+    msg_batch batch;
+    batch.reserve(batch_size);
+    // the batch split by priority class when it's published
+    std::array<msg_batch, UDP_PRIORITIES> class_batches;
+    auto spin_until = std::chrono::steady_clock::now();
+    Reassembler reassembler(*pool, opts.max_message_size, reassembly_share, opts.reassembly_timeout);
+    auto last_expiry = std::chrono::steady_clock::now();
+    // queues are never removed, so a key found once doesn't have to be checked again for the next message
+    uint64_t last_admitted = ~0ull;
+    while(run)
+    {
+        // drain whatever is readable (up to batch_size datagrams) before publishing it
+        bool got_any = false;
+        while(batch.size() < batch_size)
+        {
+            const std::size_t want = batch_size - batch.size();
+            for(std::size_t i = 0; i < want; i++)
+            {
+                if(!bufs[i])
+                {
+                    bufs[i] = pool->acquire();
+                }
+                dgrams[i] = { bufs[i]->data, bufs[i]->cap, 0, 0 };
+            }
+            int recvd;
+            if((recvd = endpoint->recv(dgrams.data(), want)) <= 0)
+            {
+                break;
+            }
+            got_any = true;
+            for(int i = 0; i < recvd; i++)
+            {
+                recv_buffer *buf = bufs[i];
+                const uint64_t node_id = dgrams[i].node_id;
+                std::size_t len = dgrams[i].len;
+                // empty datagrams are wakeups (see Endpoint::wakeup), only run needs to be rechecked for them
+                if(len == 0)
+                {
+                    continue;
+                }
+                const UdpPriority priority = frame_priority(buf->data[0]);
+                uint64_t key = udp_queue_key(node_id, 0, priority);
+                if(buf->data[0] & FRAME_CHANNEL)
+                {
+                    if(len < DATA_HEADER_LENGTH + CHANNEL_TRAILER_LENGTH)
+                    {
+                        continue;
+                    }
+                    len -= CHANNEL_TRAILER_LENGTH;
+                    key = udp_queue_key(node_id, buf->data[len], priority);
+                }
+                switch(buf->data[0] & FRAME_TYPE_MASK)
+                {
+                case FRAME_DATA:
+                    buf->offset = DATA_HEADER_LENGTH;
+                    buf->len = len - DATA_HEADER_LENGTH;
+                    batch.emplace_back(key, buf);
+                    bufs[i] = nullptr;
+                    break;
+                case FRAME_FRAGMENT:
+                    // the fragment is copied into its message, buf can receive the next datagram.
+                    // Message ids are unique per sender, whatever the channel
+                    if(recv_buffer *done = reassembler.add(node_id, buf->data, len))
+                    {
+                        batch.emplace_back(key, done);
+                    }
+                    break;
+                case FRAME_BUNDLE:
+                    unbundle(key, buf->data, len, *pool, *small_pool, batch);
+                    break;
+                default:
+                    std::cerr << "Dropping datagram with unknown frame type " << (buf->data[0] & FRAME_TYPE_MASK) << std::endl;
+                    break;
+                }
+            }
+            if(static_cast<std::size_t>(recvd) < want)
+            {
+                break;
+            }
+        }
+        if(!batch.empty())
+        {
+            record_recv_batch(batch.size());
+            std::size_t refused = 0;
+            for(auto &m : batch)
+            {
+                const std::size_t p = static_cast<std::size_t>(udp_queue_priority(m.first));
+                if(m.first != last_admitted && !udp_queues[p]->find(m.first))
+                {
+                    if(!admit_udp_queue(m.first))
+                    {
+                        BufferPool::release(m.second);
+                        refused++;
+                        continue;
+                    }
+                    // opened right away, so the next messages of the batch for it find it
+                    udp_queues[p]->find_or_insert(m.first);
+                }
+                last_admitted = m.first;
+                class_batches[p].push_back(m);
+            }
+            batch.clear();
+            if(refused > 0)
+            {
+                udp_usage->dropped += refused;
+                std::cerr << "Peers are over max_queues_per_peer, dropped " << refused << " messages" << std::endl;
+            }
+            std::size_t dropped = 0;
+            for(std::size_t p = 0; p < UDP_PRIORITIES; p++)
+            {
+                if(!class_batches[p].empty())
+                {
+                    dropped += udp_queues[p]->push_many(class_batches[p]);
+                    class_batches[p].clear();
+                }
+            }
+            if(dropped > 0)
+            {
+                std::cerr << "Peer table is full, dropped " << dropped << " messages" << std::endl;
+            }
+            // pairs with the waiters increment in wait_for_msg, see there
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(waiters.load())
+            {
+                notify_arrival();
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_expiry >= opts.reassembly_timeout / 4)
+        {
+            reassembler.expire(now);
+            last_expiry = now;
+        }
+        if(got_any)
+        {
+            spin_until = now + opts.listener_spin;
+            continue;
+        }
+
+        // nothing to read: keep spinning for a while after the last datagram if asked to, park otherwise
+        if(opts.listener_spin.count() > 0 && std::chrono::steady_clock::now() < spin_until)
+        {
+            continue;
+        }
+        endpoint->wait(opts.listener_poll_timeout);
+    }
+    for(recv_buffer *buf : bufs)
+    {
+        if(buf)
+        {
+            BufferPool::release(buf);
+        }
+    }
+}
+
+auto CommLayer::unbundle(uint64_t key, const char *datagram, std::size_t len, BufferPool &pool, BufferPool &small_pool, msg_batch &batch) -> void
 {
-    zts_sockaddr_in6 addr;
-    if(zts_inet_pton(ZTS_AF_INET6, str.c_str(), &addr.sin6_addr) > 0)
+    // every message gets its own buffer, so they can be consumed and released independently. Bundles
+    // carry small messages, a full size buffer each would hold 10KB per message of a few bytes
+    std::size_t pos = DATA_HEADER_LENGTH;
+    while(pos + BUNDLE_ENTRY_HEADER_LENGTH <= len)
     {
-        addr.sin6_family = ZTS_AF_INET6;
-        return addr;
+        std::size_t msg_len = static_cast<uint8_t>(datagram[pos]) << 8 | static_cast<uint8_t>(datagram[pos + 1]);
+        pos += BUNDLE_ENTRY_HEADER_LENGTH;
+        if(pos + msg_len > len)
+        {
+            std::cerr << "Dropping the rest of a malformed bundle from " << std::hex << udp_queue_node(key) << std::dec << std::endl;
+            return;
+        }
+        recv_buffer *buf = msg_len <= small_pool.buffer_size() ? small_pool.acquire() : pool.acquire();
+        std::copy(datagram + pos, datagram + pos + msg_len, buf->data);
+        buf->len = msg_len;
+        batch.emplace_back(key, buf);
+        pos += msg_len;
     }
-    
-    return std::nullopt;
-    
 }
 
-auto addr_to_string(zts_sockaddr_in6 *addr) -> std::optional<std::string>
+auto CommLayer::record_recv_batch(std::size_t size) -> void
 {
-    char ad[ZTS_INET6_ADDRSTRLEN];
-    if(zts_inet_ntop(ZTS_AF_INET6, &(addr->sin6_addr), ad, ZTS_INET6_ADDRSTRLEN))
+    std::size_t bucket = 0;
+    while(size >>= 1)
     {
-        std::string s(ad);
+        bucket++;
+    }
+    recv_batch_counts[std::min(bucket, RECV_BATCH_BUCKETS - 1)]++;
+}
 
-        return s;
+auto CommLayer::admit_udp_queue(uint64_t key) -> bool
+{
+    // two listeners seeing the same new key both count it, which errs on the safe side
+    std::lock_guard<std::mutex> lock(queue_count_mutex);
+    std::size_t &count = queue_counts[udp_queue_node(key)];
+    if(count >= opts.max_queues_per_peer)
+    {
+        return false;
     }
-    return std::nullopt;
+    count++;
+    return true;
+}
+
+auto CommLayer::udp_queue_count(uint64_t node_id) -> std::size_t
+{
+    std::lock_guard<std::mutex> lock(queue_count_mutex);
+    auto it = queue_counts.find(udp_queue_node(node_id));
+    return it != queue_counts.end() ? it->second : 0;
+}
+
+auto CommLayer::notify_arrival() -> void
+{
+    // taking the mutex makes sure a waiter is either before its last queue check or already waiting
+    std::lock_guard<std::mutex> lock(arrival_mutex);
+    arrival_cv.notify_all();
+}
+
+auto CommLayer::pop_udp(uint64_t node_id, uint8_t channel) -> MsgRef
+{
+    MsgRef msg;
+    for(std::size_t p = 0; p < UDP_PRIORITIES && !msg; p++)
+    {
+        msg = udp_queues[p]->pop(udp_queue_key(node_id, channel, static_cast<UdpPriority>(p)));
+    }
+    return msg;
+}
+
+auto CommLayer::pop_udp_any(uint64_t &key) -> MsgRef
+{
+    MsgRef msg;
+    for(std::size_t p = 0; p < UDP_PRIORITIES && !msg; p++)
+    {
+        msg = udp_queues[p]->pop_any(key);
+    }
+    return msg;
 }
 
-auto id_to_addr_str(const CommLayer &c, uint64_t node_id) -> std::string
+template<typename F>
+auto CommLayer::wait_for_msg(std::chrono::milliseconds timeout, F try_pop) -> MsgRef
 {
-    std::stringstream ss;
-    ss << "fd" << std::hex << c.nwid() << "9993" << node_id;
-    std::string out;
-    for(int i = 0; i < ss.str().length(); i++)
+    MsgRef msg = try_pop();
+    if(msg || timeout.count() == 0)
+    {
+        return msg;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    // waiters has to be raised before the queue is checked again, the listener reads it after publishing
+    waiters++;
+    std::unique_lock<std::mutex> lock(arrival_mutex);
+    while(!(msg = try_pop()) && run)
     {
-        out.push_back(ss.str()[i]);
-        if(i % 4 == 3 && i < ss.str().length() - 1)
+        if(timeout.count() < 0)
         {
-            out.push_back(':');
+            arrival_cv.wait(lock);
+        }
+        else if(arrival_cv.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+            msg = try_pop();
+            break;
         }
     }
-
-    return out;
+    lock.unlock();
+    waiters--;
+    return msg;
 }
 
-auto addr_str_to_id(const std::string addr) -> uint64_t
-{
-    constexpr int hexa_digit_count = 10;
-    constexpr int max_zeroes_to_fill = 3;
-    std::string num_str("");
-    int position_in_addr = addr.length() - 1;
-    /**
-     * The following is a simple state machine. States below.
-     * We don't know, how many digits are between the colons in the address, because maximally
-     * 1 zero can be present between any two colons. The statemachine works as follows:
-     * We need exactly 10 digits in a string so we repeat until the length becomes equal to 10.
-     * We keep track of our current position inside the addr string starting at the end and decrementing it everytime we get the
-     * current character from the string and we decrement it in state 3 if the current character isn't a colon to make sure state 0
-     * could see only digits.
-     * In any state (except 0; in that state we have only 1 option: insert the current digit and continue to next state)
-     * we have 2 options:
-     *   1. we see a colon -> we know that we need more digits, so we have to fill in zeroes and continue to the next state
-     *   2. we see a digit -> we fill in the digit and continue to the next state
-     * The next state depends on how many more digits we need totally and in the current 4 digit group:
-     *   1. if we are in any state and we had to fill in zeroes or the state is 3 (usual boolean operator precedence) ->
-     *     a) if we need 2 more digits to complete the string
-     *       we set the state to 2 (meaning 2 more digits to come before a colon (which is a lie in this case, because
-     *       no colon is coming, but we are going to finish the while cycle anyways))
-     *     b) otherwise
-     *       we set the state to 0
-     *   2. if we are in any state except 3 -> 
-     *     we continue to the next state
-     */ 
-    // states: 0 -> 4 more digits needed before the next colon comes, 1 -> 3 more digits ..., 2 -> 2 more, 3 -> 1 more
-    int state = 0;
-    while(num_str.length() != 10)
-    {
-        if(!state)
-        {
-            num_str = addr[position_in_addr--] + num_str;
-            state++;
-            continue;
+auto CommLayer::rudp_listener() -> void
+{
+    if(!rudp_endpoint)
+    {
+        std::cerr << "Couldn't bind port " << PORT + RUDP_PORT_OFFSET << ", the reliable channel can't receive" << std::endl;
+        return;
+    }
+
+    // the payload is copied into its own queue buffer by rudp_deliver, so one scratch buffer is enough
+    recv_buffer *scratch = buffers->acquire();
+    datagram dgram;
+    while(run)
+    {
+        dgram = { scratch->data, scratch->cap, 0, 0 };
+        while(rudp_endpoint->recv(&dgram, 1) > 0)
+        {
+            if(dgram.len > 0)
+            {
+                rudp->on_datagram(dgram.node_id, dgram.data, dgram.len);
+            }
+            dgram = { scratch->data, scratch->cap, 0, 0 };
         }
-        char c;
-        if((c = addr[position_in_addr--]) == ':')
+
+        // sleep until the next retransmission is due at the latest
+        auto timer = std::chrono::duration_cast<std::chrono::milliseconds>(rudp->on_timer());
+        rudp_endpoint->wait(std::min(opts.listener_poll_timeout, std::max(timer, std::chrono::milliseconds(1))));
+    }
+
+    BufferPool::release(scratch);
+}
+
+auto CommLayer::coalesce_flusher() -> void
+{
+    std::unique_lock<std::mutex> lock(send_mutex);
+    while(run)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto next = std::chrono::steady_clock::time_point::max();
+        for(auto &b : bundles)
         {
-            for(int i = 0; i < max_zeroes_to_fill - state; i++)
+            if(b.second.frame.empty())
             {
-                num_str = "0" + num_str;
+                continue;
             }
-            if(num_str.length() == 8)
+            if(b.second.deadline <= now)
             {
-                state = 2;
+                flush_coalesced(b.first, b.second);
             }
             else
             {
-                state = 0;
+                next = std::min(next, b.second.deadline);
             }
-            continue;
+        }
+        // coalesce() notifies whenever it starts a new bundle
+        if(next == std::chrono::steady_clock::time_point::max())
+        {
+            flush_cv.wait(lock);
         }
         else
         {
-            num_str = /* don't ask, I don't get it */ (char)c + num_str;
-            if(state == 3)
+            flush_cv.wait_until(lock, next);
+        }
+    }
+}
+
+auto CommLayer::async_sender() -> void
+{
+    pending_msg m;
+    while(run || !outbox->empty())
+    {
+        take_outbox();
+        {
+            // one lock of send_mutex per batch, pops interleave with take_outbox() so the lanes
+            // keep scheduling what arrives meanwhile
+            std::lock_guard<std::mutex> send_lock(send_mutex);
+            for(std::size_t sent = 0;; sent++)
             {
-                if(num_str.length() == 8)
+                if(sent % SEND_BATCH == SEND_BATCH - 1)
                 {
-                    state = 2;
+                    take_outbox();
                 }
-                else
                 {
-                    state = 0;
+                    std::lock_guard<std::mutex> lock(lanes_mutex);
+                    if(!send_lanes->pop(m))
+                    {
+                        break;
+                    }
                 }
-                position_in_addr--;
-                continue;
+                send_pending(m);
             }
-            else
+        }
+
+        // park until udp_send hands over something new
+        sender_parked = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(outbox_mutex);
+            if(outbox->empty() && run)
             {
-                state++;
+                outbox_cv.wait_for(lock, opts.listener_poll_timeout);
             }
         }
+        sender_parked = false;
     }
-    return std::stoull(num_str, 0, 16);
 }
 
-auto lstring_to_string(const char *lstr, int len) -> const std::string
+auto CommLayer::queue_outbox(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg) -> int
 {
-    std::string ret;
-    for(int i = 0; i < len; i++)
+    if(!outbox->reserve(msg.size(), opts.send_limits.total_msgs, opts.send_limits.total_bytes))
     {
-        ret.push_back(lstr[i]);
+        outbox_rejected++;
+        return -EAGAIN;
     }
+    // tickets are positive and wrap around
+    int ticket;
+    do
+    {
+        ticket = next_ticket.fetch_add(1, std::memory_order_relaxed) & INT32_MAX;
+    } while(ticket == 0);
+    outbox->push(new outbox_entry{ {nullptr}, { node_id, channel, priority, std::string(msg), ticket } });
+    return ticket;
+}
 
-    return ret;
+auto CommLayer::take_outbox() -> void
+{
+    std::vector<pending_msg> evicted;
+    std::lock_guard<std::mutex> lock(lanes_mutex);
+    outbox_entry *e;
+    while((e = outbox->pop()))
+    {
+        if(!send_lanes->push(std::move(e->msg), &evicted))
+        {
+            outbox->release(e->msg.data.size());
+            complete(e->msg, opts.send_limits.policy == OverflowPolicy::reject ? -EAGAIN : -ENOBUFS);
+        }
+        delete e;
+    }
+    for(const pending_msg &m : evicted)
+    {
+        outbox->release(m.data.size());
+        complete(m, -ENOBUFS);
+    }
 }
 
-auto create_sock() -> int
+auto CommLayer::complete(const pending_msg &m, int result) -> void
 {
-    return zts_socket(ZTS_PF_INET6, ZTS_SOCK_DGRAM, 0);
+    std::lock_guard<std::mutex> lock(completion_mutex);
+    if(completions.size() >= std::max<std::size_t>(opts.completion_capacity, 1))
+    {
+        completions.pop_front();
+    }
+    completions.push_back({ m.ticket, m.node_id, m.channel, result });
 }
 
-//--------------------------------------------------------------members-----------------------------------------------------------------
+auto CommLayer::rudp_send_datagram(uint64_t node_id, const char *data, std::size_t len) -> int
+{
+    return transport->send(node_id, PORT + RUDP_PORT_OFFSET, data, len);
+}
 
-CommLayer::CommLayer(uint64_t nwid, int port) : 
-    run(true),
-    PORT(port),
-    NWID(nwid),
-    udp_thread(&CommLayer::udp_listener, this),
-    rudp_thread(&CommLayer::rudp_listener, this)
+auto CommLayer::rudp_deliver(uint64_t node_id, const char *data, std::size_t len) -> void
 {
-    
+    recv_buffer *buf = buffers->acquire();
+    std::copy(data, data + len, buf->data);
+    buf->len = len;
+    if(!rudp_queues->push(node_id, buf))
+    {
+        std::cerr << "Peer table is full or over the receive limits, dropping reliable message from " << std::hex << node_id << std::dec << std::endl;
+    }
 }
 
-CommLayer::CommLayer(CommLayer &&move)
+auto CommLayer::drain_send_lanes() -> void
 {
-    *this = std::move(move);
+    pending_msg m;
+    // sending is dropped before the lanes are checked one last time, so a message queued while we
+    // were sending is either seen here or its sender finds sending clear and drains itself
+    while(!sending.exchange(true))
+    {
+        {
+            std::lock_guard<std::mutex> send_lock(send_mutex);
+            for(;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(lanes_mutex);
+                    if(!send_lanes->pop(m))
+                    {
+                        break;
+                    }
+                }
+                send_pending(m);
+            }
+        }
+        sending = false;
+        std::lock_guard<std::mutex> lock(lanes_mutex);
+        if(send_lanes->empty())
+        {
+            return;
+        }
+    }
 }
 
-CommLayer::~CommLayer()
+auto CommLayer::push_lane(pending_msg &&m) -> bool
 {
-    run = false;
-    if(udp_thread.joinable())
+    // messages drop_oldest makes room with are lost like datagrams would be
+    thread_local std::vector<pending_msg> evicted;
+    evicted.clear();
+    send_waiter *waiter = m.waiter;
+    if(!send_lanes->push(std::move(m), &evicted))
     {
-        udp_thread.join();
+        return false;
     }
-    if(rudp_thread.joinable())
+    if(waiter)
     {
-        rudp_thread.join();
+        waiter->pending++;
+    }
+    for(const pending_msg &e : evicted)
+    {
+        settle(e, e.data.size());
     }
+    return true;
 }
 
-const CommLayer & CommLayer::operator=(CommLayer &&move)
+auto CommLayer::settle(const pending_msg &m, int result) -> void
 {
-    std::swap(run, move.run);
-    int *p = const_cast<int *>(&PORT);
-    *p = move.PORT;
-    uint64_t *n = const_cast<uint64_t *>(&NWID);
-    *n = move.NWID;
+    if(!m.waiter)
+    {
+        return;
+    }
+    if(result < 0 && m.index < m.waiter->failed)
+    {
+        m.waiter->failed = m.index;
+        m.waiter->error = result;
+    }
+    if(--m.waiter->pending == 0)
+    {
+        sent_cv.notify_all();
+    }
+}
 
-    std::swap(udp_thread, move.udp_thread);
-    std::swap(rudp_thread, move.rudp_thread);
+auto CommLayer::wait_sent(send_waiter &w) -> void
+{
+    drain_send_lanes();
+    std::unique_lock<std::mutex> lock(lanes_mutex);
+    // the thread that held sending drains until the lanes are empty, so it gets to w's messages
+    sent_cv.wait(lock, [&w]() { return w.pending == 0; });
+}
 
-    udp_msg_q_mutex.lock();
-    move.udp_msg_q_mutex.lock();
-    std::swap(udp_msg_queue, move.udp_msg_queue);
-    move.udp_msg_q_mutex.unlock();
-    udp_msg_q_mutex.unlock();
+auto CommLayer::send_pending(pending_msg &m) -> void
+{
+    int err = send_now(m.node_id, m.channel, m.priority, m.data);
+    if(m.ticket != 0)
+    {
+        outbox->release(m.data.size());
+        complete(m, err);
+    }
+    if(m.waiter)
+    {
+        std::lock_guard<std::mutex> lock(lanes_mutex);
+        settle(m, err);
+    }
+}
 
-    rudp_msg_q_mutex.lock();
-    move.rudp_msg_q_mutex.lock();
-    std::swap(rudp_msg_queue, move.rudp_msg_queue);
-    move.rudp_msg_q_mutex.unlock();
-    rudp_msg_q_mutex.unlock();
+auto CommLayer::send_msgs(const outgoing_msg *msgs, std::size_t count) -> int
+{
+    const std::size_t datagram = max_datagram();
+    std::size_t sent = 0;
+    int err = 0;
+    // send_frames holds a run of single datagram messages to one peer, they go out together
+    send_frames.clear();
+    auto flush_run = [this, &sent, &err]()
+    {
+        int n;
+        if((n = send_datagrams(send_frames.data(), send_frames.size())) < 0)
+        {
+            err = n;
+        }
+        else
+        {
+            sent += n;
+            err = static_cast<std::size_t>(n) < send_frames.size() ? -1 : 0;
+        }
+        send_frames.clear();
+    };
+    for(std::size_t i = 0; i < count && err >= 0; i++)
+    {
+        const outgoing_msg &m = msgs[i];
+        const bool single = DATA_HEADER_LENGTH + m.data.size() + channel_trailer_length(m.channel) <= datagram && coalesced.count(m.node_id) == 0;
+        if(!send_frames.empty() && (!single || m.node_id != send_frames.front().node_id || send_frames.size() == SEND_BATCH))
+        {
+            flush_run();
+            if(err < 0)
+            {
+                break;
+            }
+        }
+        if(!single)
+        {
+            if((err = send_now(m.node_id, m.channel, m.priority, m.data)) >= 0)
+            {
+                sent++;
+            }
+            continue;
+        }
+        if(send_frames.empty())
+        {
+            // send_msg() may have shrunk it
+            send_frame.resize(SEND_BATCH * datagram);
+        }
+        char *frame = send_frame.data() + send_frames.size() * datagram;
+        send_frames.push_back({ m.node_id, PORT, frame, write_data_frame(frame, m.channel, m.priority, m.data) });
+    }
+    if(!send_frames.empty() && err >= 0)
+    {
+        flush_run();
+    }
+    if(err < 0)
+    {
+        std::cout << "Couldn't send any data. err: " << err << std::endl;
+    }
+    return sent > 0 || err >= 0 ? static_cast<int>(sent) : err;
+}
 
-    return *this;
+auto CommLayer::send_now(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg, peer_routes *routes) -> int
+{
+    if(coalesced.count(node_id) > 0)
+    {
+        return coalesce(node_id, channel, priority, bundles[udp_queue_key(node_id, channel, priority)], msg, routes);
+    }
+    return send_msg(node_id, channel, priority, msg, routes);
 }
 
-auto CommLayer::udp_send(uint64_t node_id, const std::string &msg) -> int
+auto CommLayer::send_msg(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg, peer_routes *routes) -> int
 {
-    // create fd
-    int fd;
-    if((fd = create_sock()) < 0)
+    const std::size_t datagram = max_datagram();
+    const std::size_t trailer = channel_trailer_length(channel);
+    const uint8_t flags = frame_flags(channel, priority);
+    send_frame.resize(datagram);
+    int err;
+    if(DATA_HEADER_LENGTH + msg.size() + trailer <= datagram)
+    {
+        err = send_datagram(node_id, send_frame.data(), write_data_frame(send_frame.data(), channel, priority, msg), routes);
+    }
+    else
+    {
+        // too big for one datagram: cut it into equally sized fragments
+        const std::size_t max_chunk = datagram - FRAGMENT_HEADER_LENGTH - trailer;
+        const std::size_t count = (msg.size() + max_chunk - 1) / max_chunk;
+        if(count > UINT16_MAX)
+        {
+            std::cerr << "Message too long to fragment: " << msg.size() << " bytes" << std::endl;
+            return -1;
+        }
+        fragment_header h = { next_msg_id++, 0, static_cast<uint16_t>(count), static_cast<uint32_t>(msg.size()) };
+        const std::size_t chunk = fragment_chunk(h);
+        // the fragments are framed SEND_BATCH at a time and handed to the transport together,
+        // which can send each group in a single syscall
+        send_frame.resize(SEND_BATCH * datagram);
+        err = 0;
+        for(std::size_t offset = 0; h.index < count && err >= 0;)
+        {
+            send_frames.clear();
+            for(; h.index < count && send_frames.size() < SEND_BATCH; h.index++, offset += chunk)
+            {
+                std::size_t len = std::min(chunk, msg.size() - offset);
+                char *frame = send_frame.data() + send_frames.size() * datagram;
+                write_fragment_header(frame, flags, h);
+                std::copy(msg.begin() + offset, msg.begin() + offset + len, frame + FRAGMENT_HEADER_LENGTH);
+                if(trailer > 0)
+                {
+                    frame[FRAGMENT_HEADER_LENGTH + len] = static_cast<char>(channel);
+                }
+                send_frames.push_back({ node_id, PORT, frame, FRAGMENT_HEADER_LENGTH + len + trailer });
+            }
+            int sent;
+            if((sent = send_datagrams(send_frames.data(), send_frames.size(), routes)) < 0)
+            {
+                err = sent;
+            }
+            else if(static_cast<std::size_t>(sent) < send_frames.size())
+            {
+                // the rest would be useless without the missing fragment
+                err = -1;
+            }
+        }
+    }
+    if(err < 0)
     {
-        std::cerr << "Couldn't create UDP socket. err: " << fd << " errno: " << zts_errno << std::endl;
-        return zts_errno;
+        std::cout << "Couldn't send any data. err: " << err << std::endl;
+        return err;
     }
-    int max_tries = 10;
-    int tries = 0;
+    return msg.size();
+}
+
+auto CommLayer::coalesce(uint64_t node_id, uint8_t channel, UdpPriority priority, bundle &b, std::string_view msg, peer_routes *routes) -> int
+{
+    // the channel trailer is appended by flush_coalesced
+    const std::size_t room = max_datagram() - channel_trailer_length(channel);
+    const std::size_t limit = std::min(room, opts.coalesce_threshold);
+    const std::size_t entry = BUNDLE_ENTRY_HEADER_LENGTH + msg.size();
+    const uint64_t key = udp_queue_key(node_id, channel, priority);
     int err;
-    auto opt = string_to_addr(id_to_addr_str(*this, node_id));
-    if(static_cast<bool>(opt))
+    if(DATA_HEADER_LENGTH + entry > room)
     {
-        zts_sockaddr_in6 addr = opt.value();
-        addr.sin6_port = zts_htons(PORT);
-        // send
-        if((err = zts_sendto(fd, msg.c_str(), msg.length(), 0, (const zts_sockaddr *)&addr, sizeof(addr))) < 0)
+        // doesn't fit in a bundle anyway: send what's pending first to keep the order, then this one on its own
+        if((err = flush_coalesced(key, b, routes)) < 0)
         {
-            std::cout << "Couldn't send any data. err: " << err << " errno: " << zts_errno << std::endl;
-            err = zts_errno;
+            return err;
         }
+        return send_msg(node_id, channel, priority, msg, routes);
     }
-    else
+    if(!b.frame.empty() && b.frame.size() + entry > limit)
+    {
+        if((err = flush_coalesced(key, b, routes)) < 0)
+        {
+            return err;
+        }
+    }
+    if(b.frame.empty())
+    {
+        b.frame.reserve(max_datagram());
+        b.frame.push_back(static_cast<char>(frame_flags(channel, priority) | FRAME_BUNDLE));
+        b.deadline = std::chrono::steady_clock::now() + opts.coalesce_delay;
+        flush_cv.notify_one();
+    }
+    b.frame.push_back(static_cast<char>(msg.size() >> 8));
+    b.frame.push_back(static_cast<char>(msg.size()));
+    b.frame.insert(b.frame.end(), msg.begin(), msg.end());
+    if(b.frame.size() >= limit && (err = flush_coalesced(key, b, routes)) < 0)
     {
-        err = -1;
-        std::cerr << "An address-conversion error occurred" << std::endl;
+        return err;
     }
-    // close fd
-    zts_close(fd);
+    return msg.size();
+}
 
-    return err;
+auto CommLayer::flush_coalesced(uint64_t key, bundle &b, peer_routes *routes) -> int
+{
+    if(b.frame.empty())
+    {
+        return 0;
+    }
+    const uint8_t channel = udp_queue_channel(key);
+    if(channel != 0)
+    {
+        b.frame.push_back(static_cast<char>(channel));
+    }
+    int err;
+    if((err = send_datagram(udp_queue_node(key), b.frame.data(), b.frame.size(), routes)) < 0)
+    {
+        std::cout << "Couldn't send any data. err: " << err << std::endl;
+    }
+    // a bundle that couldn't be sent is lost, just like a single datagram would be
+    b.frame.clear();
+    return std::min(err, 0);
 }
 
-auto CommLayer::udp_recv(uint64_t node_id) -> std::optional<std::string>
+auto CommLayer::send_datagram(uint64_t node_id, const char *data, std::size_t len, peer_routes *routes) -> int
 {
-    // return message from the queue
-    auto opt = pop_msg(udp_msg_q_mutex, udp_msg_queue, node_id);
-    if(static_cast<bool>(opt))
+    int err;
+    if(routes && routes->local)
     {
-        return opt.value();
+        err = routes->local->send(data, len);
     }
-    return std::nullopt;
+    else
+    {
+        err = local ? local->send(node_id, PORT, data, len) : -EHOSTUNREACH;
+    }
+    if(err != -EHOSTUNREACH)
+    {
+        return err;
+    }
+    if(routes && routes->net)
+    {
+        return routes->net->send(data, len);
+    }
+    return transport->send(node_id, PORT, data, len);
 }
 
-auto CommLayer::rudp_send(uint64_t node_id, const std::string &msg) -> int
+auto CommLayer::send_datagrams(const outgoing *dgrams, std::size_t count, peer_routes *routes) -> int
 {
-    return 0;
+    // all of them go to the same peer, so the first one decides the way for the rest
+    int err;
+    if(routes && routes->local)
+    {
+        err = routes->local->send_many(dgrams, count);
+    }
+    else
+    {
+        err = local ? local->send_many(dgrams, count) : -EHOSTUNREACH;
+    }
+    if(err != -EHOSTUNREACH)
+    {
+        return err;
+    }
+    if(routes && routes->net)
+    {
+        return routes->net->send_many(dgrams, count);
+    }
+    return transport->send_many(dgrams, count);
 }
 
-auto CommLayer::rudp_recv(uint64_t node_id) -> int
+auto CommLayer::max_datagram() const -> std::size_t
 {
-    return 0;
+    return std::clamp<std::size_t>(opts.max_datagram_size, FRAGMENT_HEADER_LENGTH + CHANNEL_TRAILER_LENGTH + 1, MSG_MAX_LENGTH);
 }
 
-auto CommLayer::port() const -> int
+UdpPeer::UdpPeer(CommLayer &comm, uint64_t node_id) :
+    comm(&comm),
+    node(node_id)
 {
-    return PORT;
+
 }
 
-auto CommLayer::nwid() const -> uint64_t
+auto UdpPeer::node_id() const -> uint64_t
 {
-    return NWID;
+    return node;
 }
 
-auto CommLayer::udp_listener() -> void
+auto UdpPeer::send(std::string_view msg, uint8_t channel, UdpPriority priority) -> int
 {
-    // This lock in my opinion/theoretically guarantees, that no one is going to be able to manipulate the 
-    // threads vector until this function returns, if they use the mutex anyway, and that means, until 
-    // zt_lua::stop() is called;
-    int recv_fd;
-    if((recv_fd = create_sock()) < 0)
+    if(!comm)
     {
-        std::cerr << "Couldn't create socket to listen on: err: " << recv_fd << " zts_errno: " << zts_errno << std::endl;
-        return;
+        return -EBADF;
     }
-
     int err;
-    if((err = zts_fcntl(recv_fd, ZTS_F_SETFL, ZTS_O_NONBLOCK)) < 0)
+    if((err = comm->send_udp(node, channel, msg, priority, &routes)) < 0)
     {
-        std::cerr << "Couldn't set socket to be non blocking: err: " << err << " zts_errno: " << zts_errno << std::endl;
-        zts_close(recv_fd);
-        return;
+        counters.send_errors++;
+        return err;
     }
+    counters.sent_msgs++;
+    counters.sent_bytes += msg.size();
+    return err;
+}
 
-    auto opt = string_to_addr("::");
-    if(static_cast<bool>(opt))
+auto UdpPeer::recv(uint8_t channel) -> MsgRef
+{
+    MsgRef msg;
+    if(!comm)
+    {
+        return msg;
+    }
+    for(std::size_t p = 0; p < UDP_PRIORITIES && !msg; p++)
     {
-        zts_sockaddr_in6 addr = opt.value();
-        addr.sin6_port = zts_htons(port());
-        if((err = zts_bind(recv_fd, (const zts_sockaddr *)&addr, sizeof(addr))) < 0)
+        PeerQueue *q;
+        if((q = queue(channel, static_cast<UdpPriority>(p))))
         {
-            std::cerr << "Couldn't bind to \"any_address\": err: " << err << " zts_errno: " << zts_errno << std::endl;
-            zts_close(recv_fd);
-            return;
+            msg = comm->udp_queues[p]->pop(q);
         }
+    }
+    if(msg)
+    {
+        counters.recvd_msgs++;
+        counters.recvd_bytes += msg.size();
+    }
+    return msg;
+}
+
+auto UdpPeer::recv(uint8_t channel, std::chrono::milliseconds timeout) -> MsgRef
+{
+    if(!comm)
+    {
+        return MsgRef();
+    }
+    return comm->wait_for_msg(timeout, [this, channel]() { return recv(channel); });
+}
 
-        while(run)
+auto UdpPeer::stats() -> peer_stats
+{
+    peer_stats s = counters;
+    s.queued_msgs = 0;
+    s.queued_bytes = 0;
+    if(!comm)
+    {
+        return s;
+    }
+    // a queue is counted before it's inserted, so a scan may come too early for it and the next
+    // stats() scans again. Two listeners counting the same queue make it scan every time, which
+    // is only slower
+    if(opened.size() < comm->udp_queue_count(node))
+    {
+        opened.clear();
+        for(std::size_t channel = 0; channel < UDP_CHANNELS; channel++)
         {
-            char msg[MSG_MAX_LENGTH];
-            int recvd;
-            zts_sockaddr_in6 recv_addr;
-            zts_socklen_t recv_addr_len = sizeof(recv_addr);
-            if((recvd = zts_recvfrom(recv_fd, msg, MSG_MAX_LENGTH, 0, (zts_sockaddr *)&recv_addr, &recv_addr_len)) > 0)
+            for(std::size_t p = 0; p < UDP_PRIORITIES; p++)
             {
-                auto maybe = addr_to_string(&recv_addr);
-                if(maybe)
+                PeerQueue *q;
+                if((q = queue(channel, static_cast<UdpPriority>(p))))
                 {
-                    std::string s = maybe.value();
-                    push_msg(udp_msg_q_mutex, udp_msg_queue, addr_str_to_id(s), lstring_to_string(msg, recvd));
+                    opened.push_back(q);
                 }
-                else
-                {
-                    std::cerr << "Wrong address from zts_accept or addr_to_string is malfuncioning" << std::endl;
-                }
-            };
+            }
         }
     }
-    else
+    for(const PeerQueue *q : opened)
     {
-        std::cerr << "Wrong address string entered" << std::endl;
+        s.queued_msgs += q->size();
+        s.queued_bytes += q->bytes();
     }
-    
-    zts_close(recv_fd);
+    return s;
 }
 
-auto CommLayer::rudp_listener() -> void
+auto UdpPeer::close() -> void
 {
-
+    comm = nullptr;
+    routes.local.reset();
+    routes.net.reset();
+    queues.reset();
+    opened.clear();
 }
 
-auto CommLayer::push_msg(std::mutex &mutex, msg_map &map, const uint64_t node_id, const std::string &msg) -> void
+auto UdpPeer::closed() const -> bool
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    map[node_id].push(msg);
+    return !comm;
 }
 
-auto CommLayer::pop_msg(std::mutex &mutex, msg_map &map, uint64_t node_id) -> std::optional<std::string>
+auto UdpPeer::queue(uint8_t channel, UdpPriority priority) -> PeerQueue *
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    try
+    if(!queues)
     {
-        auto q = map.at(node_id);
-        if(!q.empty())
-        {
-            const std::string s = q.front();
-            q.pop();
-            return s;
-        }
-        return std::nullopt;
+        queues = std::make_unique<PeerQueue *[]>(UDP_CHANNELS * UDP_PRIORITIES);
     }
-    catch(const std::out_of_range &)
+    const std::size_t p = static_cast<std::size_t>(priority);
+    PeerQueue *&q = queues[channel * UDP_PRIORITIES + p];
+    if(!q)
     {
-        return std::nullopt;
+        q = comm->udp_queues[p]->find(udp_queue_key(node, channel, priority));
     }
+    return q;
 }
 
 } // namespace standby_network
\ No newline at end of file
@@ -24,64 +24,425 @@ SOFTWARE. */
 #define _COMM_LAYER_H_
 
 #include <bits/stdint-uintn.h>
+#include <cstdint>
 #include <thread>
 #include <mutex>
-#include <queue>
-#include <map>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <vector>
+
+#include <outbox.h>
+#include <peer_table.h>
+#include <rudp.h>
+#include <send_lanes.h>
+#include <shm_transport.h>
+#include <transport.h>
+#include <zt_transport.h>
 
 namespace standby_network
 {
 
+// Size of the receive buffers, so the longest datagram we accept
 const unsigned int MSG_MAX_LENGTH = 10000;
+// Size of the buffers the messages of a coalesced bundle are unpacked into when they fit
+const unsigned int SMALL_MSG_LENGTH = 256;
+// The reliable channel listens on port() + RUDP_PORT_OFFSET
+const int RUDP_PORT_OFFSET = 1;
+// Number of udp channels, see udp_send
+const unsigned int UDP_CHANNELS = 256;
+// recv_batch_histogram() bucket i counts the listener wakeups which drained [2^i, 2^(i+1)) datagrams
+const std::size_t RECV_BATCH_BUCKETS = 16;
+
+// The result of a message udp_send queued in async mode, see CommOptions::async_send
+struct send_completion
+{
+    int ticket;
+    uint64_t node_id;
+    uint8_t channel;
+    // the message's size if it was sent, a negative error otherwise
+    int result;
+};
+
+// One message of udp_send_many
+struct outgoing_msg
+{
+    uint64_t node_id;
+    uint8_t channel;
+    UdpPriority priority;
+    std::string_view data;
+};
+
+// Counters of a UdpPeer, see UdpPeer::stats
+struct peer_stats
+{
+    // messages sent (or queued) through the handle and their bytes, and the sends that failed
+    uint64_t sent_msgs;
+    uint64_t sent_bytes;
+    uint64_t send_errors;
+    // messages received through the handle and their bytes
+    uint64_t recvd_msgs;
+    uint64_t recvd_bytes;
+    // messages of the peer (all channels and priorities) waiting to be received, and the memory they hold
+    std::size_t queued_msgs;
+    std::size_t queued_bytes;
+};
+
+// What the transports keep of a UdpPeer's peer, nullptr where they have nothing (see Transport::resolve)
+struct peer_routes
+{
+    std::unique_ptr<Route> local;
+    std::unique_ptr<Route> net;
+};
+
+class UdpPeer;
 
-using msg_map = std::map<uint64_t, std::queue<std::string>>;
+struct CommOptions
+{
+    // The listener parks in its transport's wait for at most this long before rechecking whether it should stop
+    std::chrono::milliseconds listener_poll_timeout = std::chrono::milliseconds(100);
+    // After a datagram the listener busy-polls for this long before parking again, 0 disables spinning.
+    // Trades a core for lower wakeup latency under steady traffic
+    std::chrono::microseconds listener_spin = std::chrono::microseconds(0);
+    // Maximum number of datagrams the listener drains per wakeup before publishing them to the queues
+    std::size_t recv_batch_size = 64;
+    // Listener threads of the udp channel, each on its own endpoint of the port (see Transport::bind_shared)
+    // and with its own buffer pool. Only UdpTransport and LoopbackTransport share a port: the default
+    // libzt transport (and any other one) gets a single listener whatever this says
+    std::size_t listener_threads = 1;
+    // Number of distinct peers the receive queues can hold, rounded up to a power of two
+    std::size_t peer_table_capacity = 16384;
+    // Receive queues one peer may open, every (channel, priority) it sends on is one. Without a cap
+    // a single peer going through the 256 channels could take up peer_table_capacity on its own,
+    // datagrams that would open one more are dropped
+    std::size_t max_queues_per_peer = 32;
+    // Caps of the receive queues, one per (peer, channel, priority) and one per peer for rudp_recv,
+    // the totals are shared by all of them. Every queued datagram holds
+    // a buffer of MSG_MAX_LENGTH bytes, a reassembled message one of its own size and a message of a
+    // bundle one of SMALL_MSG_LENGTH bytes if it fits
+    QueueLimits recv_limits = { 4096, 0, 0, 256 * 1024 * 1024, OverflowPolicy::drop_newest };
+    // Longest datagram udp_send sends (headers included, at most MSG_MAX_LENGTH), longer messages get fragmented
+    std::size_t max_datagram_size = 1400;
+    // Longest message udp_send accepts and the receiver reassembles
+    std::size_t max_message_size = 16 * 1024 * 1024;
+    // Memory the listeners may hold in partially received messages, split evenly between them (a
+    // sender's fragments always reach the same listener)
+    std::size_t reassembly_memory = 64 * 1024 * 1024;
+    // Partially received messages are dropped after this long
+    std::chrono::milliseconds reassembly_timeout = std::chrono::seconds(5);
+    // A coalesced bundle (see udp_coalesce) is sent once it reaches this many bytes (capped by max_datagram_size)...
+    std::size_t coalesce_threshold = 1400;
+    // ...or when its first message has been waiting for this long
+    std::chrono::microseconds coalesce_delay = std::chrono::microseconds(200);
+    // Caps of the messages udp_send queues per (peer, priority) while another thread is sending, see
+    // SendLanes. With the reject policy udp_send returns -EAGAIN when they are full
+    QueueLimits send_limits = { 1024, 0, 0, 64 * 1024 * 1024, OverflowPolicy::reject };
+    // Bytes the interactive and bulk lanes may send per deficit round robin round, control messages
+    // are always sent first
+    std::size_t interactive_quantum = 16 * 1024;
+    std::size_t bulk_quantum = 4 * 1024;
+    // udp_send only puts the message in a lock-free outbox and returns a ticket, a sender thread
+    // sends it and records its result for udp_completions. The caller never waits on the network
+    bool async_send = false;
+    // Results kept for udp_completions, the oldest are dropped beyond
+    std::size_t completion_capacity = 4096;
+    // Window and retransmission timer settings of rudp_send/rudp_recv
+    RudpOptions rudp;
+    // Send socket and peer cache settings of the default libzt transport
+    ZtOptions zt;
+    // udp_send datagrams to peers on the same host skip the transport and go through shared memory
+    ShmOptions shm;
+};
 
 class CommLayer
 {
 public:
-    CommLayer(uint64_t network_id, int port = 9000);
+    // Communicates over the ZeroTier network network_id
+    CommLayer(uint64_t network_id, int port = 9000, const CommOptions &options = CommOptions());
+    // Communicates over any other transport, see transport.h
+    CommLayer(std::shared_ptr<Transport> transport, int port = 9000, const CommOptions &options = CommOptions());
+    // Not movable: the listener, flusher and sender threads hold on to this
     CommLayer(const CommLayer &) = delete;
-    CommLayer(CommLayer &&move);
+    CommLayer(CommLayer &&) = delete;
     ~CommLayer();
 
 public:
     auto operator=(const CommLayer &) -> const CommLayer & = delete;
-    auto operator=(CommLayer &&move) -> const CommLayer &;
+    auto operator=(CommLayer &&) -> const CommLayer & = delete;
 
 public:
-    auto udp_send(uint64_t node_id, const std::string &msg) -> int;
+    // msg may contain any bytes, including NULs. Messages longer than max_datagram_size are
+    // fragmented and reassembled by the receiver transparently. Peers on the same host get them
+    // through shared memory (see ShmOptions). Returns msg.size() or a negative error
+    auto udp_send(uint64_t node_id, std::string_view msg) -> int;
+    // Sends msg on one of the UDP_CHANNELS channels. The receiver queues every (peer, channel) pair
+    // on its own, so e.g. control messages don't wait behind bulk data of the same peer. The
+    // overloads without a channel use channel 0.
+    // The priority class decides both the order in which concurrent senders' messages go out (see
+    // SendLanes) and the order in which the receiver hands them out: udp_recv returns a peer's
+    // control messages first, then its interactive ones, then bulk. If another thread is sending,
+    // msg is queued for it to send and udp_send waits for the result, -EAGAIN is returned right
+    // away if it's over the send_limits (with the reject policy).
+    // In async mode it returns a ticket (> 0) once msg is in the outbox, or -EAGAIN if the outbox
+    // holds the send_limits totals already. The message's result is reported by udp_completions
+    auto udp_send(uint64_t node_id, uint8_t channel, std::string_view msg, UdpPriority priority = UdpPriority::interactive) -> int;
+    // Sends (or queues, see above) count messages at once, taking every lock once for all of them.
+    // Consecutive single datagram messages to the same peer go to the transport together. Stops at
+    // the first failure, returns the number of messages sent (so msgs[result] is the one that failed
+    // if result < count) or the error if that's none. Queued messages may go out in another order
+    // (see SendLanes), the ones after a failed one can have been sent then. In async mode the tickets of the queued
+    // messages are appended to tickets, in msgs order
+    auto udp_send_many(const outgoing_msg *msgs, std::size_t count, std::vector<int> *tickets = nullptr) -> int;
+    // The results of the messages sent in async mode since the last call (at most max), oldest first
+    auto udp_completions(std::size_t max = SIZE_MAX) -> std::vector<send_completion>;
+    // Opt-in per peer (for all of its channels): small messages sent to node_id are packed together
+    // into one datagram per channel, which goes out when full, after coalesce_delay, or on udp_flush.
+    // Receivers split them transparently
+    auto udp_coalesce(uint64_t node_id, bool enable) -> void;
+    auto udp_flush(uint64_t node_id) -> int;
+    auto udp_flush() -> int;
+
     auto udp_recv(uint64_t node_id) -> std::optional<std::string>;
+    // Same as udp_recv, but hands out the receive buffer itself instead of copying it into a string.
+    // The returned MsgRef must not outlive the CommLayer
+    auto udp_recv_buf(uint64_t node_id) -> MsgRef;
+    // Dequeues at most max messages of node_id in arrival order with one lock acquisition
+    auto udp_recv_many(uint64_t node_id, std::size_t max) -> std::vector<std::string>;
+    auto udp_recv(uint64_t node_id, uint8_t channel) -> std::optional<std::string>;
+    auto udp_recv_buf(uint64_t node_id, uint8_t channel) -> MsgRef;
+    auto udp_recv_many(uint64_t node_id, uint8_t channel, std::size_t max) -> std::vector<std::string>;
+    // Appends at most max messages to out, without copying them, returns how many
+    auto udp_recv_many(uint64_t node_id, uint8_t channel, std::size_t max, std::vector<MsgRef> &out) -> std::size_t;
 
-    auto rudp_send(uint64_t node_id, const std::string &msg) -> int;
-    auto rudp_recv(uint64_t node_id) -> int;
+    // Blocking variants: wait at most timeout for a message to arrive (forever if timeout is negative).
+    // They return early with nothing when the CommLayer is being destroyed, its destructor waits
+    // for them to leave
+    auto udp_recv(uint64_t node_id, std::chrono::milliseconds timeout) -> std::optional<std::string>;
+    auto udp_recv_buf(uint64_t node_id, std::chrono::milliseconds timeout) -> MsgRef;
+    auto udp_recv(uint64_t node_id, uint8_t channel, std::chrono::milliseconds timeout) -> std::optional<std::string>;
+    auto udp_recv_buf(uint64_t node_id, uint8_t channel, std::chrono::milliseconds timeout) -> MsgRef;
+    // The next message of any peer and channel (in arrival order within the most urgent priority class) together with its sender
+    auto udp_recv_any(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) -> std::optional<std::pair<uint64_t, std::string>>;
+    auto udp_recv_any_buf(uint64_t &node_id, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) -> MsgRef;
+    auto udp_recv_any_buf(uint64_t &node_id, uint8_t &channel, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) -> MsgRef;
+
+    // A handle on node_id for scripts that talk to a fixed set of peers, see UdpPeer
+    auto udp_peer(uint64_t node_id) -> UdpPeer;
+
+    // Reliable (retransmitted until acknowledged), unordered delivery. Returns 0 once msg is queued
+    // for sending, -1 if msg doesn't fit in a datagram (max_datagram_size), -EAGAIN if the peer's
+    // backlog (RudpOptions::max_backlog) is full
+    auto rudp_send(uint64_t node_id, std::string_view msg) -> int;
+    auto rudp_recv(uint64_t node_id) -> std::optional<std::string>;
+    auto rudp_recv_buf(uint64_t node_id) -> MsgRef;
 
 public:
     auto port() const -> int;
     auto nwid() const -> uint64_t;
+    auto async_send() const -> bool;
+    auto recv_batch_histogram() const -> std::array<uint64_t, RECV_BATCH_BUCKETS>;
+    // Occupancy and overflow counters of the receive queues (the reliable one included) and of the send lanes
+    auto udp_recv_stats() const -> queue_stats;
+    auto udp_send_stats() -> queue_stats;
+    // Bytes the listeners' buffer pools allocated, they grow with the messages held by the receive queues
+    auto udp_recv_memory() const -> std::size_t;
+
+public:
+    // Call this on ZeroTier network events, the libzt transports re-resolve their cached peers on their next send
+    static auto network_changed() -> void;
 
 private:
-    auto udp_listener() -> void;
+    friend class UdpPeer;
+
+    auto start_udp_listener(Endpoint *endpoint) -> void;
+    auto udp_listener(Endpoint *endpoint, BufferPool *pool, BufferPool *small_pool) -> void;
     auto rudp_listener() -> void;
+    auto coalesce_flusher() -> void;
+    auto async_sender() -> void;
+    // Puts msg in the outbox if it fits within send_limits, returns its ticket or -EAGAIN.
+    // Waking the sender thread is up to the caller
+    auto queue_outbox(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg) -> int;
+    // moves the outbox into the send lanes
+    auto take_outbox() -> void;
+    auto complete(const pending_msg &m, int result) -> void;
+    auto unbundle(uint64_t key, const char *datagram, std::size_t len, BufferPool &pool, BufferPool &small_pool, msg_batch &batch) -> void;
+    auto rudp_send_datagram(uint64_t node_id, const char *data, std::size_t len) -> int;
+    auto rudp_deliver(uint64_t node_id, const char *data, std::size_t len) -> void;
+    auto record_recv_batch(std::size_t size) -> void;
+    // Counts a receive queue about to be opened for the node of key, false if it has max_queues_per_peer already
+    auto admit_udp_queue(uint64_t key) -> bool;
+    // receive queues node_id opened (or is about to), see admit_udp_queue
+    auto udp_queue_count(uint64_t node_id) -> std::size_t;
+    auto notify_arrival() -> void;
+    // the next message of node_id on channel, of the most urgent priority class which has one
+    auto pop_udp(uint64_t node_id, uint8_t channel) -> MsgRef;
+    auto pop_udp_any(uint64_t &key) -> MsgRef;
+    template<typename F>
+    auto wait_for_msg(std::chrono::milliseconds timeout, F try_pop) -> MsgRef;
 
 private:
-    auto push_msg(std::mutex &mutex, msg_map &map, const uint64_t node_id, const std::string &msg) -> void;
-    auto pop_msg(std::mutex &mutex, msg_map &map, const uint64_t node_id) -> std::optional<std::string>;
+    struct bundle
+    {
+        // messages waiting to be sent as one FRAME_BUNDLE, empty if there are none
+        std::vector<char> frame;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // udp_send, through routes instead of the transports' lookups if it's sent right away
+    auto send_udp(uint64_t node_id, uint8_t channel, std::string_view msg, UdpPriority priority, peer_routes *routes) -> int;
+    // sends the messages queued in send_lanes, unless another thread already does
+    auto drain_send_lanes() -> void;
+    // hands the result of a message of send_lanes to the caller waiting for it, expects lanes_mutex to be locked
+    auto settle(const pending_msg &m, int result) -> void;
+    // pushes m to send_lanes and counts it in its waiter, expects lanes_mutex to be locked
+    auto push_lane(pending_msg &&m) -> bool;
+    // drains send_lanes, or waits for the thread that does, until all of w's messages are settled
+    auto wait_sent(send_waiter &w) -> void;
+    // these expect send_mutex to be locked
+    auto send_pending(pending_msg &m) -> void;
+    auto send_msgs(const outgoing_msg *msgs, std::size_t count) -> int;
+    auto send_now(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg, peer_routes *routes = nullptr) -> int;
+    auto send_msg(uint64_t node_id, uint8_t channel, UdpPriority priority, std::string_view msg, peer_routes *routes = nullptr) -> int;
+    // through shared memory if node_id is on this host, through the transport otherwise
+    auto send_datagram(uint64_t node_id, const char *data, std::size_t len, peer_routes *routes = nullptr) -> int;
+    auto send_datagrams(const outgoing *dgrams, std::size_t count, peer_routes *routes = nullptr) -> int;
+    auto coalesce(uint64_t node_id, uint8_t channel, UdpPriority priority, bundle &b, std::string_view msg, peer_routes *routes = nullptr) -> int;
+    auto flush_coalesced(uint64_t key, bundle &b, peer_routes *routes = nullptr) -> int;
+    auto max_datagram() const -> std::size_t;
 
 private:
-    bool run;
+    std::atomic<bool> run;
 
     const int PORT = 9000;
-    uint64_t NWID;
+    uint64_t NWID = 0;
+    CommOptions opts;
+
+    std::shared_ptr<Transport> transport;
+    // empty if the port couldn't be bound, nothing is received then
+    std::vector<std::unique_ptr<Endpoint>> udp_endpoints;
+    // nullptr if the port couldn't be bound, the listener gives up right away then
+    std::unique_ptr<Endpoint> rudp_endpoint;
+    // nullptr if disabled, the udp datagrams of same-host peers arrive on local_endpoint
+    std::shared_ptr<ShmTransport> local;
+    std::unique_ptr<Endpoint> local_endpoint;
+    // every listener's part of reassembly_memory
+    std::size_t reassembly_share = 0;
+
+    // declared before the queues, they hand their buffers back to them when destroyed.
+    // Every udp listener has a pool of its own, so they don't contend on one, and one of small
+    // buffers for the messages of bundles
+    std::unique_ptr<BufferPool> buffers;
+    std::vector<std::unique_ptr<BufferPool>> listener_buffers;
+    std::vector<std::unique_ptr<BufferPool>> listener_small_buffers;
+    // one table per priority class, they share the recv_limits totals with rudp_queues
+    std::unique_ptr<queue_usage> udp_usage;
+    std::array<std::unique_ptr<PeerTable>, UDP_PRIORITIES> udp_queues;
+    std::unique_ptr<PeerTable> rudp_queues;
+    // the udp_queues every node has, only touched for keys the tables don't know yet
+    std::mutex queue_count_mutex;
+    std::unordered_map<uint64_t, std::size_t> queue_counts;
+
+    std::unique_ptr<Rudp> rudp;
+
+    std::array<std::atomic<uint64_t>, RECV_BATCH_BUCKETS> recv_batch_counts{};
+
+    // blocking receivers park here, the listener only touches the mutex when waiters isn't 0
+    std::mutex arrival_mutex;
+    std::condition_variable arrival_cv;
+    std::atomic<int> waiters{0};
 
-    std::thread udp_thread;
+    // only one thread sends at a time (the one which set sending), the others leave their messages
+    // in send_lanes for it and wait on sent_cv for their results
+    std::mutex lanes_mutex;
+    std::condition_variable sent_cv;
+    std::unique_ptr<SendLanes> send_lanes;
+    std::atomic<bool> sending{false};
+
+    // async mode: the sender thread parks on outbox_cv, udp_send only touches the mutex if it does
+    std::unique_ptr<Outbox> outbox;
+    std::atomic<int> next_ticket{0};
+    std::atomic<bool> sender_parked{false};
+    std::atomic<uint64_t> outbox_rejected{0};
+    std::mutex outbox_mutex;
+    std::condition_variable outbox_cv;
+    std::mutex completion_mutex;
+    std::deque<send_completion> completions;
+
+    std::mutex send_mutex;
+    std::vector<char> send_frame;
+    std::vector<outgoing> send_frames;
+    uint32_t next_msg_id = 0;
+    // the peers udp_coalesce was enabled for, and their bundles by queue key (see udp_queue_key)
+    std::unordered_set<uint64_t> coalesced;
+    std::unordered_map<uint64_t, bundle> bundles;
+    std::condition_variable flush_cv;
+
+    // the background threads use every member above, so they are declared (and started) last.
+    // One udp listener per udp endpoint and one for local_endpoint
+    std::vector<std::thread> udp_threads;
     std::thread rudp_thread;
+    std::thread flush_thread;
+    // only in async mode
+    std::thread send_thread;
 
-    std::mutex udp_msg_q_mutex;
-    msg_map udp_msg_queue;
+};
 
-    std::mutex rudp_msg_q_mutex;
-    msg_map rudp_msg_queue;
+/**
+ * A handle on one peer for the hot paths of code that talks to a fixed set of peers. The peer is
+ * resolved once (see Transport::resolve: its socket address or a connected socket of its own, and
+ * its shared memory ring if it's on this host) and its receive queues are kept once they exist,
+ * so send() and recv() skip the lookups udp_send() and udp_recv() do on every call. Messages are
+ * framed, prioritized and limited just like theirs, the route is only used by sends that go out
+ * right away (not the ones queued in the send lanes or the async outbox).
+ *
+ * Used by one thread at a time. It must not be used once its CommLayer is gone, destroying it is fine.
+ */
+class UdpPeer
+{
+public:
+    UdpPeer(UdpPeer &&move) = default;
+
+public:
+    auto operator=(UdpPeer &&move) -> UdpPeer & = default;
+
+public:
+    auto node_id() const -> uint64_t;
+    // same as CommLayer::udp_send, -EBADF once closed
+    auto send(std::string_view msg, uint8_t channel = 0, UdpPriority priority = UdpPriority::interactive) -> int;
+    // same as CommLayer::udp_recv_buf, nothing once closed
+    auto recv(uint8_t channel = 0) -> MsgRef;
+    auto recv(uint8_t channel, std::chrono::milliseconds timeout) -> MsgRef;
+    // Sums up the queues the peer opened, they're only looked up again once it opened more
+    auto stats() -> peer_stats;
+    // Drops the routes (closing the sockets they hold) and the kept queues
+    auto close() -> void;
+    auto closed() const -> bool;
 
+private:
+    friend class CommLayer;
+
+    UdpPeer(CommLayer &comm, uint64_t node_id);
+
+    // nullptr as long as the peer sent nothing on channel with priority
+    auto queue(uint8_t channel, UdpPriority priority) -> PeerQueue *;
+
+private:
+    CommLayer *comm;
+    uint64_t node;
+    peer_routes routes;
+    // UDP_CHANNELS * UDP_PRIORITIES entries, allocated and filled in on first use. Receive queues are never removed
+    std::unique_ptr<PeerQueue *[]> queues;
+    // the non-null entries of queues, as far as stats() found them
+    std::vector<PeerQueue *> opened;
+    peer_stats counters{};
 };
 
 } // namespace standby_network
@@ -0,0 +1,195 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <frame.h>
+
+#include <algorithm>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+auto write_fragment_header(char *out, uint8_t flags, const fragment_header &h) -> void
+{
+    out[0] = static_cast<char>(flags | FRAME_FRAGMENT);
+    for(int i = 0; i < 4; i++)
+    {
+        out[1 + i] = static_cast<char>(h.msg_id >> (24 - 8 * i));
+    }
+    out[5] = static_cast<char>(h.index >> 8);
+    out[6] = static_cast<char>(h.index);
+    out[7] = static_cast<char>(h.count >> 8);
+    out[8] = static_cast<char>(h.count);
+    for(int i = 0; i < 4; i++)
+    {
+        out[9 + i] = static_cast<char>(h.total_len >> (24 - 8 * i));
+    }
+}
+
+auto read_fragment_header(const char *in, std::size_t len, fragment_header &h) -> bool
+{
+    if(len < FRAGMENT_HEADER_LENGTH)
+    {
+        return false;
+    }
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(in);
+    h.msg_id = (uint32_t)b[1] << 24 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 8 | b[4];
+    h.index = (uint16_t)(b[5] << 8 | b[6]);
+    h.count = (uint16_t)(b[7] << 8 | b[8]);
+    h.total_len = (uint32_t)b[9] << 24 | (uint32_t)b[10] << 16 | (uint32_t)b[11] << 8 | b[12];
+    if(h.count == 0 || h.index >= h.count || h.total_len < h.count)
+    {
+        return false;
+    }
+    // the payload has to be exactly where the chunk size says it is
+    std::size_t chunk = fragment_chunk(h);
+    std::size_t expected = h.index + 1 < h.count ? chunk : h.total_len - chunk * (h.count - 1);
+    return len - FRAGMENT_HEADER_LENGTH == expected;
+}
+
+auto fragment_chunk(const fragment_header &h) -> std::size_t
+{
+    return (h.total_len + h.count - 1) / h.count;
+}
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+Reassembler::Reassembler(BufferPool &pool, std::size_t max_message_size, std::size_t memory_cap, std::chrono::milliseconds timeout) :
+    pool(pool),
+    MAX_MESSAGE_SIZE(max_message_size),
+    MEMORY_CAP(memory_cap),
+    TIMEOUT(timeout),
+    used(0),
+    dropped_msgs(0)
+{ }
+
+Reassembler::~Reassembler()
+{
+    for(auto &p : partials)
+    {
+        BufferPool::release(p.second.buf);
+    }
+}
+
+auto Reassembler::add(uint64_t node_id, const char *datagram, std::size_t len) -> recv_buffer *
+{
+    fragment_header h;
+    if(!read_fragment_header(datagram, len, h) || h.total_len > MAX_MESSAGE_SIZE)
+    {
+        return nullptr;
+    }
+
+    auto key = std::make_pair(node_id, h.msg_id);
+    auto it = partials.find(key);
+    if(it == partials.end())
+    {
+        if(h.total_len > MEMORY_CAP)
+        {
+            // could never fit, so nothing is given up for it
+            dropped_msgs++;
+            return nullptr;
+        }
+        if(used + h.total_len > MEMORY_CAP)
+        {
+            // make room by giving up the oldest partial messages, they are the least likely to complete
+            expire(std::chrono::steady_clock::now());
+            while(used + h.total_len > MEMORY_CAP && !arrival_order.empty())
+            {
+                drop(partials.find(arrival_order.front()));
+            }
+            if(used + h.total_len > MEMORY_CAP)
+            {
+                dropped_msgs++;
+                return nullptr;
+            }
+        }
+        partial p{ pool.acquire(h.total_len), std::vector<bool>(h.count, false), h.count, std::chrono::steady_clock::now(),
+                   arrival_order.insert(arrival_order.end(), key) };
+        p.buf->len = h.total_len;
+        used += h.total_len;
+        it = partials.emplace(key, std::move(p)).first;
+    }
+
+    partial &p = it->second;
+    if(p.buf->len != h.total_len || p.have.size() != h.count)
+    {
+        // a different message reusing the id, the old one is never going to complete
+        drop(it);
+        return add(node_id, datagram, len);
+    }
+    if(p.have[h.index])
+    {
+        return nullptr;
+    }
+    const char *payload = datagram + FRAGMENT_HEADER_LENGTH;
+    std::copy(payload, datagram + len, p.buf->data + h.index * fragment_chunk(h));
+    p.have[h.index] = true;
+    if(--p.missing)
+    {
+        return nullptr;
+    }
+
+    recv_buffer *done = p.buf;
+    used -= h.total_len;
+    erase(it);
+    return done;
+}
+
+auto Reassembler::expire(std::chrono::steady_clock::time_point now) -> void
+{
+    while(!arrival_order.empty())
+    {
+        auto it = partials.find(arrival_order.front());
+        if(now - it->second.first_seen < TIMEOUT)
+        {
+            break;
+        }
+        drop(it);
+    }
+}
+
+auto Reassembler::memory() const -> std::size_t
+{
+    return used;
+}
+
+auto Reassembler::dropped() const -> uint64_t
+{
+    return dropped_msgs;
+}
+
+auto Reassembler::drop(std::map<partial_key, partial>::iterator it) -> void
+{
+    used -= it->second.buf->len;
+    BufferPool::release(it->second.buf);
+    erase(it);
+    dropped_msgs++;
+}
+
+auto Reassembler::erase(std::map<partial_key, partial>::iterator it) -> void
+{
+    arrival_order.erase(it->second.arrival);
+    partials.erase(it);
+}
+
+} // namespace standby_network
@@ -0,0 +1,134 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <bits/stdint-uintn.h>
+#include <chrono>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <buffer_pool.h>
+
+namespace standby_network
+{
+
+/**
+ * Every datagram of the UDP channel starts with a one byte frame header. Its low nibble is the
+ * frame type, the high nibble holds per-frame flags.
+ *   FRAME_DATA:     header | payload
+ *   FRAME_FRAGMENT: header | msg id (4) | index (2) | count (2) | total length (4) | payload
+ *   FRAME_BUNDLE:   header | (length (2) | payload)*, several small messages coalesced
+ * A fragmented message of total length L in C fragments is cut into chunks of ceil(L / C) bytes,
+ * the last one being shorter. All integers are big endian.
+ * Frames of a channel other than 0 (see CommLayer::udp_send) have FRAME_CHANNEL set in their
+ * header and end with a one byte channel trailer, the frame itself is parsed without it.
+ * Bits 5 and 6 of the header hold the priority class of the message (see UdpPriority), the
+ * receiver hands out the more urgent classes first.
+ */
+const uint8_t FRAME_DATA = 0x00;
+const uint8_t FRAME_FRAGMENT = 0x01;
+const uint8_t FRAME_BUNDLE = 0x02;
+const uint8_t FRAME_TYPE_MASK = 0x0f;
+const uint8_t FRAME_CHANNEL = 0x10;
+const uint8_t FRAME_PRIORITY_MASK = 0x60;
+const int FRAME_PRIORITY_SHIFT = 5;
+
+const std::size_t DATA_HEADER_LENGTH = 1;
+const std::size_t FRAGMENT_HEADER_LENGTH = 13;
+const std::size_t BUNDLE_ENTRY_HEADER_LENGTH = 2;
+const std::size_t CHANNEL_TRAILER_LENGTH = 1;
+
+struct fragment_header
+{
+    uint32_t msg_id;
+    uint16_t index;
+    uint16_t count;
+    uint32_t total_len;
+};
+
+auto write_fragment_header(char *out, uint8_t flags, const fragment_header &h) -> void;
+// false if the datagram is too short or the header is inconsistent
+auto read_fragment_header(const char *in, std::size_t len, fragment_header &h) -> bool;
+auto fragment_chunk(const fragment_header &h) -> std::size_t;
+
+/**
+ * Collects the fragments of messages. The whole message is allocated once, when its first
+ * fragment arrives, and every fragment is copied to its final place, so a completed message is
+ * handed out without any further copy. Partial messages expire after a timeout and the memory
+ * held by them is capped. Not thread safe, every listener owns one.
+ */
+class Reassembler
+{
+public:
+    Reassembler(BufferPool &pool, std::size_t max_message_size, std::size_t memory_cap, std::chrono::milliseconds timeout);
+    Reassembler(const Reassembler &) = delete;
+    ~Reassembler();
+
+public:
+    auto operator=(const Reassembler &) -> const Reassembler & = delete;
+
+public:
+    // Feeds a FRAME_FRAGMENT datagram, returns the completed message (with one reference) or nullptr
+    auto add(uint64_t node_id, const char *datagram, std::size_t len) -> recv_buffer *;
+    // drops the partial messages older than the timeout
+    auto expire(std::chrono::steady_clock::time_point now) -> void;
+
+    auto memory() const -> std::size_t;
+    auto dropped() const -> uint64_t;
+
+private:
+    using partial_key = std::pair<uint64_t, uint32_t>;
+
+    struct partial
+    {
+        recv_buffer *buf;
+        std::vector<bool> have;
+        uint16_t missing;
+        std::chrono::steady_clock::time_point first_seen;
+        // its place in arrival_order
+        std::list<partial_key>::iterator arrival;
+    };
+
+    auto drop(std::map<partial_key, partial>::iterator it) -> void;
+    // removes a partial message that completed or was given up on
+    auto erase(std::map<partial_key, partial>::iterator it) -> void;
+
+private:
+    BufferPool &pool;
+    const std::size_t MAX_MESSAGE_SIZE;
+    const std::size_t MEMORY_CAP;
+    const std::chrono::milliseconds TIMEOUT;
+
+    std::map<partial_key, partial> partials;
+    // the keys of partials by first_seen, oldest first: evicting and expiring only look at the front
+    std::list<partial_key> arrival_order;
+    std::size_t used;
+    uint64_t dropped_msgs;
+};
+
+} // namespace standby_network
+
+#endif // _FRAME_H_
@@ -0,0 +1,183 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <loopback_transport.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <string>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+auto endpoint_key(uint64_t node_id, int port) -> uint64_t
+{
+    return node_id << 16 | static_cast<uint16_t>(port);
+}
+
+class LoopbackEndpoint : public Endpoint
+{
+public:
+    LoopbackEndpoint(const LoopbackTransport &transport, std::shared_ptr<LoopbackNetwork> network, uint64_t key) :
+        transport(transport),
+        network(std::move(network)),
+        KEY(key)
+    {
+    }
+
+    ~LoopbackEndpoint() override
+    {
+        // once unregistered no sender can reach us anymore
+        std::lock_guard<std::mutex> lock(network->mutex);
+        auto it = network->endpoints.find(KEY);
+        if(it == network->endpoints.end())
+        {
+            return;
+        }
+        it->second.erase(std::remove(it->second.begin(), it->second.end(), this), it->second.end());
+        if(it->second.empty())
+        {
+            network->endpoints.erase(it);
+        }
+    }
+
+public:
+    auto recv(datagram *dgrams, std::size_t count) -> int override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t n = 0;
+        for(; n < count && !pending.empty(); pending.pop_front())
+        {
+            auto &p = pending.front();
+            // dropped like the other transports do, a cut off message would be handed on as if it was complete
+            if(p.second.size() > dgrams[n].cap)
+            {
+                transport.drop_truncated(dgrams[n].cap);
+                continue;
+            }
+            dgrams[n].len = p.second.size();
+            std::copy(p.second.begin(), p.second.end(), dgrams[n].data);
+            dgrams[n].node_id = p.first;
+            n++;
+        }
+        return n;
+    }
+
+    auto wait(std::chrono::milliseconds timeout) -> void override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(pending.empty())
+        {
+            cv.wait_for(lock, timeout);
+        }
+    }
+
+    auto wakeup() -> void override
+    {
+        deliver(0, "", 0);
+    }
+
+    auto deliver(uint64_t node_id, const char *data, std::size_t len) -> void
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace_back(node_id, std::string(data, len));
+        cv.notify_one();
+    }
+
+private:
+    const LoopbackTransport &transport;
+    std::shared_ptr<LoopbackNetwork> network;
+    const uint64_t KEY;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<uint64_t, std::string>> pending;
+};
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<LoopbackNetwork> network, uint64_t node_id) :
+    network(std::move(network)),
+    NODE_ID(node_id)
+{
+}
+
+auto LoopbackTransport::bind(int port) -> std::unique_ptr<Endpoint>
+{
+    auto endpoints = bind_shared(port, 1);
+    return endpoints.empty() ? nullptr : std::move(endpoints[0]);
+}
+
+auto LoopbackTransport::bind_shared(int port, std::size_t count) -> std::vector<std::unique_ptr<Endpoint>>
+{
+    const uint64_t key = endpoint_key(NODE_ID, port);
+    std::vector<std::unique_ptr<Endpoint>> out;
+    std::lock_guard<std::mutex> lock(network->mutex);
+    if(network->endpoints.count(key))
+    {
+        return out;
+    }
+    std::vector<LoopbackEndpoint *> &shards = network->endpoints[key];
+    for(std::size_t i = 0; i < std::max<std::size_t>(count, 1); i++)
+    {
+        auto endpoint = std::make_unique<LoopbackEndpoint>(*this, network, key);
+        shards.push_back(endpoint.get());
+        out.push_back(std::move(endpoint));
+    }
+    return out;
+}
+
+auto LoopbackTransport::send(uint64_t node_id, int port, const char *data, std::size_t len) -> int
+{
+    // delivering under the network's mutex keeps the endpoint from going away meanwhile
+    std::lock_guard<std::mutex> lock(network->mutex);
+    auto it = network->endpoints.find(endpoint_key(node_id, port));
+    if(it != network->endpoints.end())
+    {
+        // Fibonacci hashing, like PeerTable
+        const std::size_t shard = (NODE_ID * 0x9E3779B97F4A7C15ull >> 32) % it->second.size();
+        it->second[shard]->deliver(NODE_ID, data, len);
+    }
+    return len;
+}
+
+auto LoopbackTransport::node_id() const -> uint64_t
+{
+    return NODE_ID;
+}
+
+auto LoopbackTransport::truncated() const -> uint64_t
+{
+    return truncated_dgrams.load(std::memory_order_relaxed);
+}
+
+auto LoopbackTransport::drop_truncated(std::size_t cap) const -> void
+{
+    truncated_dgrams.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "Dropping datagram longer than the receive buffer of " << cap << " bytes" << std::endl;
+}
+
+} // namespace standby_network
@@ -0,0 +1,97 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _LOOPBACK_TRANSPORT_H_
+#define _LOOPBACK_TRANSPORT_H_
+
+#include <bits/stdint-uintn.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <transport.h>
+
+namespace standby_network
+{
+
+class LoopbackEndpoint;
+
+// The "wire" LoopbackTransports of the same process send through, share one between all of them
+class LoopbackNetwork
+{
+public:
+    LoopbackNetwork() = default;
+    LoopbackNetwork(const LoopbackNetwork &) = delete;
+
+public:
+    auto operator=(const LoopbackNetwork &) -> const LoopbackNetwork & = delete;
+
+private:
+    friend class LoopbackTransport;
+    friend class LoopbackEndpoint;
+
+    // keyed by node id << 16 | port, more than one if the port was bound with bind_shared
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::vector<LoopbackEndpoint *>> endpoints;
+};
+
+/**
+ * Datagrams between CommLayers of the same process, copied straight into the receiving endpoint.
+ * Nothing is ever lost or reordered, which makes it the baseline to measure the layers above the
+ * transport with.
+ */
+class LoopbackTransport : public Transport
+{
+public:
+    LoopbackTransport(std::shared_ptr<LoopbackNetwork> network, uint64_t node_id);
+    LoopbackTransport(const LoopbackTransport &) = delete;
+
+public:
+    auto operator=(const LoopbackTransport &) -> const LoopbackTransport & = delete;
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override;
+    // A sender always reaches the same endpoint, picked by a hash of its node id
+    auto bind_shared(int port, std::size_t count) -> std::vector<std::unique_ptr<Endpoint>> override;
+    // Datagrams to a port nobody bound are dropped, like UDP would
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override;
+    auto node_id() const -> uint64_t override;
+    // Datagrams dropped because they were longer than the receive buffer
+    auto truncated() const -> uint64_t;
+
+private:
+    friend class LoopbackEndpoint;
+
+    // counts a datagram the endpoints drop for not fitting in cap bytes
+    auto drop_truncated(std::size_t cap) const -> void;
+
+private:
+    std::shared_ptr<LoopbackNetwork> network;
+    const uint64_t NODE_ID;
+    mutable std::atomic<uint64_t> truncated_dgrams{0};
+};
+
+} // namespace standby_network
+
+#endif // _LOOPBACK_TRANSPORT_H_
@@ -0,0 +1,130 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <outbox.h>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+Outbox::Outbox() :
+    head(&stub),
+    tail(&stub),
+    count(0),
+    byte_count(0)
+{
+    stub.next = nullptr;
+}
+
+Outbox::~Outbox()
+{
+    outbox_entry *e;
+    while((e = pop()))
+    {
+        release(e->msg.data.size());
+        delete e;
+    }
+}
+
+auto Outbox::reserve(std::size_t len, std::size_t max_msgs, std::size_t max_bytes) -> bool
+{
+    // added before the check and taken back if it fails, so two senders can't both get the last
+    // room. Counted before the push, size() never goes below zero when the consumer is quick
+    const std::size_t msgs = count.fetch_add(1, std::memory_order_relaxed) + 1;
+    const std::size_t total = byte_count.fetch_add(len, std::memory_order_relaxed) + len;
+    if((max_msgs != 0 && msgs > max_msgs) || (max_bytes != 0 && total > max_bytes))
+    {
+        count.fetch_sub(1, std::memory_order_relaxed);
+        byte_count.fetch_sub(len, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+auto Outbox::push(outbox_entry *e) -> void
+{
+    link(e);
+}
+
+auto Outbox::link(outbox_entry *e) -> void
+{
+    e->next.store(nullptr, std::memory_order_relaxed);
+    outbox_entry *prev = head.exchange(e, std::memory_order_acq_rel);
+    prev->next.store(e, std::memory_order_release);
+}
+
+auto Outbox::pop() -> outbox_entry *
+{
+    outbox_entry *t = tail;
+    outbox_entry *next = t->next.load(std::memory_order_acquire);
+    if(t == &stub)
+    {
+        if(!next)
+        {
+            return nullptr;
+        }
+        tail = next;
+        t = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(!next)
+    {
+        if(t != head.load(std::memory_order_acquire))
+        {
+            // a producer swapped head but didn't link its entry yet
+            return nullptr;
+        }
+        // t is the last entry, put the stub behind it so t can be handed out
+        link(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if(!next)
+        {
+            return nullptr;
+        }
+    }
+    tail = next;
+    return t;
+}
+
+auto Outbox::release(std::size_t len) -> void
+{
+    count.fetch_sub(1, std::memory_order_relaxed);
+    byte_count.fetch_sub(len, std::memory_order_relaxed);
+}
+
+auto Outbox::empty() const -> bool
+{
+    return tail == &stub && !stub.next.load(std::memory_order_acquire);
+}
+
+auto Outbox::size() const -> std::size_t
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+auto Outbox::bytes() const -> std::size_t
+{
+    return byte_count.load(std::memory_order_relaxed);
+}
+
+} // namespace standby_network
\ No newline at end of file
@@ -0,0 +1,86 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _OUTBOX_H_
+#define _OUTBOX_H_
+
+#include <atomic>
+#include <cstddef>
+
+#include <send_lanes.h>
+
+namespace standby_network
+{
+
+struct outbox_entry
+{
+    std::atomic<outbox_entry *> next;
+    pending_msg msg;
+};
+
+/**
+ * The messages udp_send hands over to the sender thread in async mode. Intrusive MPSC queue (the
+ * same design as PeerQueue): pushing is a single exchange, so senders never block on each other or
+ * on the sender thread, which is the only one popping. Room is reserved before pushing, which keeps
+ * concurrent senders under the caps without a lock. A popped message keeps its room until it's
+ * released, so the caps cover the messages the sender thread took but didn't send yet too.
+ */
+class Outbox
+{
+public:
+    Outbox();
+    Outbox(const Outbox &) = delete;
+    ~Outbox();
+
+public:
+    auto operator=(const Outbox &) -> const Outbox & = delete;
+
+public:
+    // Counts in a message of len bytes if the outbox stays within max_msgs and max_bytes (0 is
+    // unbounded), false if it wouldn't. Every successful reservation is followed by one push
+    auto reserve(std::size_t len, std::size_t max_msgs, std::size_t max_bytes) -> bool;
+    // takes over e, which was reserved for
+    auto push(outbox_entry *e) -> void;
+    // consumer only, nullptr if there's nothing (completely pushed yet). The caller owns the entry
+    auto pop() -> outbox_entry *;
+    // gives back the room of a popped message of len bytes, once it was sent or dropped
+    auto release(std::size_t len) -> void;
+    // consumer only
+    auto empty() const -> bool;
+    // the reserved messages and bytes, popped ones included until they are released
+    auto size() const -> std::size_t;
+    auto bytes() const -> std::size_t;
+
+private:
+    auto link(outbox_entry *e) -> void;
+
+private:
+    std::atomic<outbox_entry *> head;
+    outbox_entry *tail;
+    outbox_entry stub;
+    std::atomic<std::size_t> count;
+    std::atomic<std::size_t> byte_count;
+};
+
+} // namespace standby_network
+
+#endif // _OUTBOX_H_
@@ -0,0 +1,535 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <peer_table.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------PeerQueue---------------------------------------------------------------
+
+PeerQueue::PeerQueue() :
+    head(&stub),
+    tail(&stub),
+    count(0),
+    byte_count(0)
+{
+    stub.next = nullptr;
+}
+
+PeerQueue::~PeerQueue()
+{
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    recv_buffer *n;
+    while((n = pop()))
+    {
+        BufferPool::release(n);
+    }
+}
+
+auto PeerQueue::push(recv_buffer *node) -> void
+{
+    link(node);
+    count.fetch_add(1, std::memory_order_relaxed);
+    byte_count.fetch_add(node->cap, std::memory_order_relaxed);
+}
+
+auto PeerQueue::link(recv_buffer *node) -> void
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    recv_buffer *prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+auto PeerQueue::pop() -> recv_buffer *
+{
+    recv_buffer *t = tail;
+    recv_buffer *next = t->next.load(std::memory_order_acquire);
+    if(t == &stub)
+    {
+        if(!next)
+        {
+            return nullptr;
+        }
+        tail = next;
+        t = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(next)
+    {
+        tail = next;
+        count.fetch_sub(1, std::memory_order_relaxed);
+        byte_count.fetch_sub(t->cap, std::memory_order_relaxed);
+        return t;
+    }
+    if(t != head.load(std::memory_order_acquire))
+    {
+        // a producer swapped head but didn't link its node yet, it will be there on the next pop
+        return nullptr;
+    }
+    // t is the last node, put the stub behind it so t can be handed out
+    link(&stub);
+    next = t->next.load(std::memory_order_acquire);
+    if(next)
+    {
+        tail = next;
+        count.fetch_sub(1, std::memory_order_relaxed);
+        byte_count.fetch_sub(t->cap, std::memory_order_relaxed);
+        return t;
+    }
+    return nullptr;
+}
+
+auto PeerQueue::front() const -> const recv_buffer *
+{
+    const recv_buffer *t = tail;
+    if(t == &stub)
+    {
+        t = t->next.load(std::memory_order_acquire);
+    }
+    return t;
+}
+
+auto PeerQueue::size() const -> std::size_t
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+auto PeerQueue::bytes() const -> std::size_t
+{
+    return byte_count.load(std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------ready_ring--------------------------------------------------------------
+
+auto PeerTable::ready_ring::empty() const -> bool
+{
+    return count == 0;
+}
+
+auto PeerTable::ready_ring::size() const -> std::size_t
+{
+    return count;
+}
+
+auto PeerTable::ready_ring::front() -> ready_entry &
+{
+    return entries[head];
+}
+
+auto PeerTable::ready_ring::at(std::size_t i) -> ready_entry &
+{
+    return entries[(head + i) & (entries.size() - 1)];
+}
+
+auto PeerTable::ready_ring::push_back(const ready_entry &e) -> void
+{
+    if(count == entries.size())
+    {
+        std::vector<ready_entry> grown(std::max<std::size_t>(entries.size() * 2, 64));
+        for(std::size_t i = 0; i < count; i++)
+        {
+            grown[i] = at(i);
+        }
+        entries.swap(grown);
+        head = 0;
+    }
+    entries[(head + count++) & (entries.size() - 1)] = e;
+}
+
+auto PeerTable::ready_ring::pop_front() -> void
+{
+    head = (head + 1) & (entries.size() - 1);
+    count--;
+}
+
+auto PeerTable::ready_ring::truncate(std::size_t count) -> void
+{
+    this->count = std::min(this->count, count);
+}
+
+//--------------------------------------------------------------PeerTable---------------------------------------------------------------
+
+PeerTable::PeerTable(std::size_t capacity, std::size_t shards, const QueueLimits &limits, queue_usage *usage) :
+    dropped_msgs(0),
+    next_seq(0),
+    queued_msgs(0),
+    shard_count(std::max<std::size_t>(shards, 1)),
+    shards(new ready_shard[shard_count]),
+    LIMITS(limits),
+    own_usage(usage ? nullptr : std::make_unique<queue_usage>()),
+    used(usage ? usage : own_usage.get())
+{
+    std::size_t cap = 1;
+    while(cap < capacity)
+    {
+        cap <<= 1;
+    }
+    mask = cap - 1;
+    slots.reset(new slot[cap]);
+    for(std::size_t i = 0; i < cap; i++)
+    {
+        slots[i].key = EMPTY_KEY;
+        slots[i].queue = nullptr;
+    }
+}
+
+PeerTable::~PeerTable()
+{
+    for(std::size_t i = 0; i <= mask; i++)
+    {
+        PeerQueue *q = slots[i].queue.load();
+        if(q)
+        {
+            // a shared usage outlives the table
+            used->msgs.fetch_sub(q->size(), std::memory_order_relaxed);
+            used->bytes.fetch_sub(q->bytes(), std::memory_order_relaxed);
+        }
+        delete q;
+    }
+}
+
+auto PeerTable::index_of(uint64_t key) const -> std::size_t
+{
+    // Fibonacci hashing, node ids of a network tend to share bit patterns
+    return (key * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+}
+
+auto PeerTable::shard_of(uint64_t key) const -> ready_shard &
+{
+    // the high bits of the hash, index_of uses the ones below
+    return shards[((key * 0x9E3779B97F4A7C15ull) >> 48) % shard_count];
+}
+
+auto PeerTable::find(uint64_t key) -> PeerQueue *
+{
+    std::size_t i = index_of(key);
+    for(std::size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+    {
+        uint64_t k = slots[i].key.load(std::memory_order_acquire);
+        if(k == EMPTY_KEY)
+        {
+            return nullptr;
+        }
+        if(k == key)
+        {
+            PeerQueue *q;
+            // the inserting thread publishes the queue right after claiming the key
+            while(!(q = slots[i].queue.load(std::memory_order_acquire)))
+            {
+                std::this_thread::yield();
+            }
+            return q;
+        }
+    }
+    return nullptr;
+}
+
+auto PeerTable::find_or_insert(uint64_t key) -> PeerQueue *
+{
+    std::size_t i = index_of(key);
+    for(std::size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+    {
+        uint64_t k = slots[i].key.load(std::memory_order_acquire);
+        if(k == EMPTY_KEY)
+        {
+            if(slots[i].key.compare_exchange_strong(k, key, std::memory_order_acq_rel))
+            {
+                PeerQueue *q = new PeerQueue();
+                slots[i].queue.store(q, std::memory_order_release);
+                return q;
+            }
+            // somebody else claimed the slot, k now holds their key
+        }
+        if(k == key)
+        {
+            PeerQueue *q;
+            while(!(q = slots[i].queue.load(std::memory_order_acquire)))
+            {
+                std::this_thread::yield();
+            }
+            return q;
+        }
+    }
+    return nullptr;
+}
+
+auto PeerTable::push(uint64_t key, recv_buffer *buf) -> bool
+{
+    PeerQueue *q = find_or_insert(key);
+    if(!q)
+    {
+        dropped_msgs.fetch_add(1, std::memory_order_relaxed);
+        BufferPool::release(buf);
+        return false;
+    }
+    ready_shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if(!admit(q, buf))
+    {
+        return false;
+    }
+    uint64_t seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+    buf->seq = seq;
+    q->push(buf);
+    shard.ready.push_back({ key, seq, q });
+    compact_ready_list(shard);
+    return true;
+}
+
+auto PeerTable::push_many(msg_batch &batch) -> std::size_t
+{
+    std::size_t dropped = 0;
+    // a peer always maps to the same shard and its seqs are taken under that shard's mutex, so
+    // they grow in queue order. pop_any() holds the mutex too, so it can't see an entry before
+    // the message is in its queue
+    for(std::size_t s = 0; s < shard_count; s++)
+    {
+        ready_shard &shard = shards[s];
+        std::size_t count = 0;
+        for(auto &m : batch)
+        {
+            count += &shard_of(m.first) == &shard;
+        }
+        if(count == 0)
+        {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        uint64_t seq = next_seq.fetch_add(count, std::memory_order_relaxed);
+        for(auto &m : batch)
+        {
+            if(&shard_of(m.first) != &shard)
+            {
+                continue;
+            }
+            PeerQueue *q = find_or_insert(m.first);
+            if(!q)
+            {
+                dropped++;
+                BufferPool::release(m.second);
+                continue;
+            }
+            if(!admit(q, m.second))
+            {
+                // counted in usage(), a skipped seq doesn't matter
+                continue;
+            }
+            m.second->seq = seq;
+            q->push(m.second);
+            shard.ready.push_back({ m.first, seq++, q });
+        }
+        compact_ready_list(shard);
+    }
+    dropped_msgs.fetch_add(dropped, std::memory_order_relaxed);
+    return dropped;
+}
+
+auto PeerTable::pop(uint64_t key) -> MsgRef
+{
+    PeerQueue *q = find(key);
+    if(!q)
+    {
+        return MsgRef();
+    }
+    return pop(q);
+}
+
+auto PeerTable::pop(PeerQueue *q) -> MsgRef
+{
+    std::lock_guard<std::mutex> lock(q->consumer_mutex);
+    recv_buffer *buf = q->pop();
+    if(buf)
+    {
+        popped(buf);
+    }
+    return MsgRef(buf);
+}
+
+auto PeerTable::pop_many(uint64_t key, std::size_t max) -> std::vector<MsgRef>
+{
+    std::vector<MsgRef> out;
+    pop_many(key, max, out);
+    return out;
+}
+
+auto PeerTable::pop_many(uint64_t key, std::size_t max, std::vector<MsgRef> &out) -> std::size_t
+{
+    PeerQueue *q = find(key);
+    if(!q)
+    {
+        return 0;
+    }
+    out.reserve(out.size() + std::min(max, q->size()));
+    std::lock_guard<std::mutex> lock(q->consumer_mutex);
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+    recv_buffer *n;
+    while(count < max && (n = q->pop()))
+    {
+        bytes += n->cap;
+        out.emplace_back(n);
+        count++;
+    }
+    // the shared counters are touched once for the whole batch
+    if(count > 0)
+    {
+        popped(count, bytes);
+    }
+    return count;
+}
+
+auto PeerTable::pop_any(uint64_t &key) -> MsgRef
+{
+    // all shards are locked (in order, producers only ever hold one) so the oldest entry among
+    // their fronts is the oldest message
+    for(std::size_t s = 0; s < shard_count; s++)
+    {
+        shards[s].mutex.lock();
+    }
+    MsgRef msg;
+    for(;;)
+    {
+        ready_shard *oldest = nullptr;
+        for(std::size_t s = 0; s < shard_count; s++)
+        {
+            if(!shards[s].ready.empty() && (!oldest || shards[s].ready.front().seq < oldest->ready.front().seq))
+            {
+                oldest = &shards[s];
+            }
+        }
+        if(!oldest)
+        {
+            break;
+        }
+        ready_entry e = oldest->ready.front();
+        oldest->ready.pop_front();
+        std::lock_guard<std::mutex> qlock(e.queue->consumer_mutex);
+        const recv_buffer *front = e.queue->front();
+        // a front newer than the entry means its message was taken by pop()/pop_many() already
+        if(front && front->seq <= e.seq)
+        {
+            recv_buffer *buf = e.queue->pop();
+            if(buf)
+            {
+                popped(buf);
+                key = e.key;
+                msg = MsgRef(buf);
+                break;
+            }
+        }
+    }
+    for(std::size_t s = shard_count; s-- > 0;)
+    {
+        shards[s].mutex.unlock();
+    }
+    return msg;
+}
+
+auto PeerTable::compact_ready_list(ready_shard &shard) -> void
+{
+    // stale entries pile up when messages are mostly taken by pop(), drop them once they are the majority
+    if(shard.ready.size() <= 2 * queued_msgs.load(std::memory_order_relaxed) + 1024)
+    {
+        return;
+    }
+    // in place, the live entries keep their order
+    std::size_t live = 0;
+    for(std::size_t i = 0; i < shard.ready.size(); i++)
+    {
+        const ready_entry &e = shard.ready.at(i);
+        std::lock_guard<std::mutex> qlock(e.queue->consumer_mutex);
+        const recv_buffer *front = e.queue->front();
+        if(front && front->seq <= e.seq)
+        {
+            shard.ready.at(live++) = e;
+        }
+    }
+    shard.ready.truncate(live);
+}
+
+auto PeerTable::admit(PeerQueue *q, recv_buffer *buf) -> bool
+{
+    if(!fits(q, buf) && LIMITS.policy == OverflowPolicy::drop_oldest)
+    {
+        // the evicted messages look like ones taken by pop(), their ready entries go stale
+        std::lock_guard<std::mutex> lock(q->consumer_mutex);
+        recv_buffer *old;
+        while(!fits(q, buf) && (old = q->pop()))
+        {
+            popped(old);
+            used->dropped.fetch_add(1, std::memory_order_relaxed);
+            BufferPool::release(old);
+        }
+    }
+    if(!fits(q, buf))
+    {
+        (LIMITS.policy == OverflowPolicy::reject ? used->rejected : used->dropped).fetch_add(1, std::memory_order_relaxed);
+        BufferPool::release(buf);
+        return false;
+    }
+    // several listeners may admit at once, so the totals can overshoot by a batch or so
+    used->msgs.fetch_add(1, std::memory_order_relaxed);
+    used->bytes.fetch_add(buf->cap, std::memory_order_relaxed);
+    queued_msgs.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+auto PeerTable::fits(const PeerQueue *q, const recv_buffer *buf) const -> bool
+{
+    return (LIMITS.queue_msgs == 0 || q->size() + 1 <= LIMITS.queue_msgs) &&
+           (LIMITS.queue_bytes == 0 || q->bytes() + buf->cap <= LIMITS.queue_bytes) &&
+           (LIMITS.total_msgs == 0 || used->msgs.load(std::memory_order_relaxed) + 1 <= LIMITS.total_msgs) &&
+           (LIMITS.total_bytes == 0 || used->bytes.load(std::memory_order_relaxed) + buf->cap <= LIMITS.total_bytes);
+}
+
+auto PeerTable::popped(const recv_buffer *buf) -> void
+{
+    popped(1, buf->cap);
+}
+
+auto PeerTable::popped(std::size_t msgs, std::size_t bytes) -> void
+{
+    used->msgs.fetch_sub(msgs, std::memory_order_relaxed);
+    used->bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    queued_msgs.fetch_sub(msgs, std::memory_order_relaxed);
+}
+
+auto PeerTable::usage() const -> const queue_usage &
+{
+    return *used;
+}
+
+auto PeerTable::queued() const -> std::size_t
+{
+    return queued_msgs.load(std::memory_order_relaxed);
+}
+
+auto PeerTable::dropped() const -> uint64_t
+{
+    return dropped_msgs.load(std::memory_order_relaxed);
+}
+
+} // namespace standby_network
@@ -0,0 +1,208 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _PEER_TABLE_H_
+#define _PEER_TABLE_H_
+
+#include <bits/stdint-uintn.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <buffer_pool.h>
+#include <queue_limits.h>
+
+namespace standby_network
+{
+
+using msg_batch = std::vector<std::pair<uint64_t, recv_buffer *>>;
+
+/**
+ * Unbounded message queue of a single peer, Dmitry Vyukov's intrusive MPSC queue.
+ * Pushing is wait-free, so the listener never blocks on consumers. Consumers are
+ * serialized by consumer_mutex, which producers never touch.
+ */
+class PeerQueue
+{
+public:
+    PeerQueue();
+    PeerQueue(const PeerQueue &) = delete;
+    ~PeerQueue();
+
+public:
+    auto operator=(const PeerQueue &) -> const PeerQueue & = delete;
+
+public:
+    // takes over the caller's reference of node
+    auto push(recv_buffer *node) -> void;
+    // expects consumer_mutex to be locked, nullptr if the queue is empty. The caller owns the returned reference
+    auto pop() -> recv_buffer *;
+    // expects consumer_mutex to be locked, the node the next pop() returns (or nullptr)
+    auto front() const -> const recv_buffer *;
+    auto size() const -> std::size_t;
+    // memory held by the queued nodes (their cap)
+    auto bytes() const -> std::size_t;
+
+public:
+    std::mutex consumer_mutex;
+
+private:
+    auto link(recv_buffer *node) -> void;
+
+private:
+    std::atomic<recv_buffer *> head;
+    recv_buffer *tail;
+    recv_buffer stub;
+    std::atomic<std::size_t> count;
+    std::atomic<std::size_t> byte_count;
+};
+
+/**
+ * Fixed capacity open-addressing (linear probing) table of peer queues. Peers are only ever
+ * inserted, so lookups need no locking: a slot's key is claimed with a CAS and its queue is
+ * published right after.
+ *
+ * Every message gets a table-wide sequence number and a (peer, seq) entry in a ready list,
+ * so pop_any() returns messages in arrival order in amortized O(1). Entries whose message was
+ * already taken with pop()/pop_many() are skipped lazily and compacted away when they start to
+ * dominate the list.
+ *
+ * The ready list is split into shards by a hash of the peer, each with its own mutex, so several
+ * listeners can push at once. A producer takes each shard's mutex once per push_many(),
+ * pop_any() takes all of them to find the oldest message.
+ *
+ * The queues can be bounded (see QueueLimits), messages over the caps are handled by the limits'
+ * overflow policy. The totals can be shared with other tables by handing them the same usage.
+ */
+class PeerTable
+{
+public:
+    // capacity is rounded up to a power of two. Without a usage of its own the table counts on its own
+    explicit PeerTable(std::size_t capacity, std::size_t shards = 1, const QueueLimits &limits = QueueLimits(), queue_usage *usage = nullptr);
+    PeerTable(const PeerTable &) = delete;
+    ~PeerTable();
+
+public:
+    auto operator=(const PeerTable &) -> const PeerTable & = delete;
+
+public:
+    // nullptr if the peer never sent anything
+    auto find(uint64_t key) -> PeerQueue *;
+    // nullptr if the table is full
+    auto find_or_insert(uint64_t key) -> PeerQueue *;
+
+    // Takes over the caller's reference of buf. If the table is full or the message goes over the
+    // limits it is dropped (and buf released), false is returned then
+    auto push(uint64_t key, recv_buffer *buf) -> bool;
+    // Pushes the whole batch, touching the ready list once. Returns the number of messages dropped
+    // because the table was full
+    auto push_many(msg_batch &batch) -> std::size_t;
+    // an empty MsgRef if there's nothing to receive
+    auto pop(uint64_t key) -> MsgRef;
+    // pops from a queue find() returned, skipping the lookup
+    auto pop(PeerQueue *q) -> MsgRef;
+    auto pop_many(uint64_t key, std::size_t max) -> std::vector<MsgRef>;
+    // appends to out instead, returns the number of messages popped
+    auto pop_many(uint64_t key, std::size_t max, std::vector<MsgRef> &out) -> std::size_t;
+    // The oldest message of any peer, key is set to its sender
+    auto pop_any(uint64_t &key) -> MsgRef;
+
+    // messages dropped because the table was full, see usage() for the ones over the limits
+    auto dropped() const -> uint64_t;
+    auto queued() const -> std::size_t;
+    auto usage() const -> const queue_usage &;
+
+private:
+    static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+    struct slot
+    {
+        std::atomic<uint64_t> key;
+        std::atomic<PeerQueue *> queue;
+    };
+
+    struct ready_entry
+    {
+        uint64_t key;
+        uint64_t seq;
+        PeerQueue *queue;
+    };
+
+    // FIFO of ready entries on a power of two ring, it only allocates while it grows to the working
+    // set (a std::deque allocates and frees a block every few entries)
+    struct ready_ring
+    {
+        std::vector<ready_entry> entries;
+        std::size_t head = 0;
+        std::size_t count = 0;
+
+        auto empty() const -> bool;
+        auto size() const -> std::size_t;
+        auto front() -> ready_entry &;
+        // the i-th entry from the front
+        auto at(std::size_t i) -> ready_entry &;
+        auto push_back(const ready_entry &e) -> void;
+        auto pop_front() -> void;
+        // keeps the first count entries
+        auto truncate(std::size_t count) -> void;
+    };
+
+    struct ready_shard
+    {
+        std::mutex mutex;
+        ready_ring ready;
+    };
+
+    auto index_of(uint64_t key) const -> std::size_t;
+    auto shard_of(uint64_t key) const -> ready_shard &;
+    // expects the shard's mutex to be locked
+    auto compact_ready_list(ready_shard &shard) -> void;
+    // Applies the limits to a new message of q: true if it may be pushed (and it's counted in
+    // then), otherwise it has been released
+    auto admit(PeerQueue *q, recv_buffer *buf) -> bool;
+    auto fits(const PeerQueue *q, const recv_buffer *buf) const -> bool;
+    // uncounts a popped message
+    auto popped(const recv_buffer *buf) -> void;
+    // uncounts msgs popped messages holding bytes
+    auto popped(std::size_t msgs, std::size_t bytes) -> void;
+
+private:
+    std::size_t mask;
+    std::unique_ptr<slot[]> slots;
+    std::atomic<uint64_t> dropped_msgs;
+    std::atomic<uint64_t> next_seq;
+    std::atomic<std::size_t> queued_msgs;
+
+    std::size_t shard_count;
+    std::unique_ptr<ready_shard[]> shards;
+
+    const QueueLimits LIMITS;
+    std::unique_ptr<queue_usage> own_usage;
+    queue_usage *used;
+};
+
+} // namespace standby_network
+
+#endif // _PEER_TABLE_H_
@@ -0,0 +1,78 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _QUEUE_LIMITS_H_
+#define _QUEUE_LIMITS_H_
+
+#include <bits/stdint-uintn.h>
+#include <atomic>
+#include <cstddef>
+
+namespace standby_network
+{
+
+// What a bounded queue does with a message that doesn't fit
+enum class OverflowPolicy
+{
+    // the new message is dropped and counted in dropped
+    drop_newest,
+    // the oldest messages of the new message's own queue are dropped (and counted) to make room,
+    // the new one is dropped if that's not enough. Other queues are never evicted, so a peer can't
+    // push out another one's messages: with the totals full, a message for an empty queue is dropped
+    drop_oldest,
+    // the new message is refused and counted in rejected, on the send side udp_send returns -EAGAIN
+    reject
+};
+
+// Caps of a set of queues, 0 means unlimited. Bytes are the memory the queued messages hold
+struct QueueLimits
+{
+    // of every single queue
+    std::size_t queue_msgs = 0;
+    std::size_t queue_bytes = 0;
+    // of all of them together
+    std::size_t total_msgs = 0;
+    std::size_t total_bytes = 0;
+    OverflowPolicy policy = OverflowPolicy::drop_newest;
+};
+
+// Occupancy and overflow counters of a set of queues, several tables can share one
+struct queue_usage
+{
+    std::atomic<std::size_t> msgs{0};
+    std::atomic<std::size_t> bytes{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> rejected{0};
+};
+
+// A snapshot of a queue_usage
+struct queue_stats
+{
+    std::size_t msgs;
+    std::size_t bytes;
+    uint64_t dropped;
+    uint64_t rejected;
+};
+
+} // namespace standby_network
+
+#endif // _QUEUE_LIMITS_H_
@@ -0,0 +1,432 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <rudp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <random>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+constexpr uint8_t RUDP_DATA = 0x01;
+constexpr uint8_t RUDP_ACK = 0x02;
+constexpr uint8_t RUDP_FORWARD = 0x03;
+constexpr std::size_t RUDP_ACK_LENGTH = 17;
+constexpr std::size_t RUDP_FORWARD_LENGTH = 9;
+
+// serial number arithmetic, sequence numbers wrap around
+auto seq_lt(uint32_t a, uint32_t b) -> bool
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+auto put_u32(char *out, uint32_t v) -> void
+{
+    for(int i = 0; i < 4; i++)
+    {
+        out[i] = static_cast<char>(v >> (24 - 8 * i));
+    }
+}
+
+auto put_u64(char *out, uint64_t v) -> void
+{
+    for(int i = 0; i < 8; i++)
+    {
+        out[i] = static_cast<char>(v >> (56 - 8 * i));
+    }
+}
+
+auto get_u32(const char *in) -> uint32_t
+{
+    uint32_t v = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        v = (v << 8) | static_cast<uint8_t>(in[i]);
+    }
+    return v;
+}
+
+auto get_u64(const char *in) -> uint64_t
+{
+    uint64_t v = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        v = (v << 8) | static_cast<uint8_t>(in[i]);
+    }
+    return v;
+}
+
+// never 0, that stands for no epoch
+auto new_rudp_epoch() -> uint32_t
+{
+    std::random_device rd;
+    uint32_t epoch;
+    while(!(epoch = rd() ^ static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count())))
+    {
+    }
+    return epoch;
+}
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+Rudp::Rudp(send_fn send, deliver_fn deliver, const RudpOptions &options) :
+    send_datagram(std::move(send)),
+    deliver(std::move(deliver)),
+    opts(options),
+    EPOCH(new_rudp_epoch())
+{
+    opts.window = std::clamp<uint32_t>(opts.window, 1, MAX_WINDOW);
+}
+
+auto Rudp::send(uint64_t node_id, std::string_view msg) -> int
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    peer_state &p = peer(node_id);
+    if(opts.max_backlog != 0 && p.backlog.size() >= opts.max_backlog)
+    {
+        return -EAGAIN;
+    }
+    std::string frame(DATA_HEADER + msg.size(), '\0');
+    frame[0] = RUDP_DATA;
+    put_u32(&frame[1], EPOCH);
+    std::copy(msg.begin(), msg.end(), frame.begin() + DATA_HEADER);
+    p.backlog.push_back(std::move(frame));
+    fill_window(node_id, p, clock::now());
+    return 0;
+}
+
+auto Rudp::on_datagram(uint64_t node_id, const char *data, std::size_t len) -> void
+{
+    if(len < 1)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if(data[0] == RUDP_DATA && len >= DATA_HEADER)
+    {
+        peer_state &p = peer(node_id);
+        if(accept_epoch(p, get_u32(data + 1)))
+        {
+            on_data(node_id, p, get_u32(data + 5), data + DATA_HEADER, len - DATA_HEADER);
+        }
+    }
+    else if(data[0] == RUDP_ACK && len >= RUDP_ACK_LENGTH)
+    {
+        // an ack for our previous run acks sequence numbers we reuse since
+        if(get_u32(data + 1) == EPOCH)
+        {
+            peer_state &p = peer(node_id);
+            on_ack(node_id, p, get_u32(data + 5), get_u64(data + 9));
+        }
+    }
+    else if(data[0] == RUDP_FORWARD && len >= RUDP_FORWARD_LENGTH)
+    {
+        peer_state &p = peer(node_id);
+        if(accept_epoch(p, get_u32(data + 1)))
+        {
+            on_forward(node_id, p, get_u32(data + 5));
+        }
+    }
+}
+
+auto Rudp::on_timer() -> clock::duration
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = clock::now();
+    clock::duration next = opts.max_rto;
+    for(auto &entry : peers)
+    {
+        peer_state &p = entry.second;
+        for(std::size_t i = 0; i < p.inflight.size(); i++)
+        {
+            pending &pkt = p.inflight[i];
+            if(pkt.acked)
+            {
+                continue;
+            }
+            auto due = pkt.sent_at + backoff(p.rto, pkt.retries);
+            if(due <= now)
+            {
+                if(pkt.retries >= opts.max_retries)
+                {
+                    // give the message up, so it doesn't hold the window forever
+                    pkt.acked = true;
+                    failures++;
+                    p.forward_pending = true;
+                    p.forward_end = p.snd_base + i + 1;
+                    continue;
+                }
+                pkt.retries++;
+                retransmits++;
+                transmit(entry.first, pkt, now);
+                due = now + backoff(p.rto, pkt.retries);
+            }
+            next = std::min(next, due - now);
+        }
+        advance(entry.first, p, now);
+    }
+    return next;
+}
+
+auto Rudp::retransmitted() const -> uint64_t
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return retransmits;
+}
+
+auto Rudp::failed() const -> uint64_t
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failures;
+}
+
+auto Rudp::peer(uint64_t node_id) -> peer_state &
+{
+    auto it = peers.find(node_id);
+    if(it == peers.end())
+    {
+        it = peers.emplace(node_id, peer_state()).first;
+        it->second.rto = opts.initial_rto;
+    }
+    return it->second;
+}
+
+auto Rudp::transmit(uint64_t node_id, pending &pkt, clock::time_point now) -> void
+{
+    pkt.sent_at = now;
+    send_datagram(node_id, pkt.frame.data(), pkt.frame.size());
+}
+
+auto Rudp::fill_window(uint64_t node_id, peer_state &p, clock::time_point now) -> void
+{
+    while(!p.backlog.empty() && p.inflight.size() < opts.window)
+    {
+        p.inflight.push_back({ std::move(p.backlog.front()), now, 0, false, false });
+        p.backlog.pop_front();
+        pending &pkt = p.inflight.back();
+        put_u32(&pkt.frame[5], p.snd_next++);
+        transmit(node_id, pkt, now);
+    }
+}
+
+auto Rudp::advance(uint64_t node_id, peer_state &p, clock::time_point now) -> void
+{
+    while(!p.inflight.empty() && p.inflight.front().acked)
+    {
+        p.inflight.pop_front();
+        p.snd_base++;
+    }
+    if(p.forward_pending && !seq_lt(p.snd_base, p.forward_end))
+    {
+        p.forward_pending = false;
+        send_forward(node_id, p);
+    }
+    fill_window(node_id, p, now);
+}
+
+auto Rudp::accept_epoch(peer_state &p, uint32_t epoch) -> bool
+{
+    if(epoch == p.rcv_epoch)
+    {
+        return true;
+    }
+    if(epoch == 0 || epoch == p.old_rcv_epoch)
+    {
+        // a straggler of the sender's previous run
+        return false;
+    }
+    // the sender restarted (or we did), its sequence numbers start over
+    p.old_rcv_epoch = p.rcv_epoch;
+    p.rcv_epoch = epoch;
+    p.rcv_next = 0;
+    p.rcv_seen.reset();
+    return true;
+}
+
+auto Rudp::on_data(uint64_t node_id, peer_state &p, uint32_t seq, const char *data, std::size_t len) -> void
+{
+    bool fresh = false;
+    if(!seq_lt(seq, p.rcv_next) && seq_lt(seq, p.rcv_next + MAX_WINDOW))
+    {
+        std::size_t bit = seq % MAX_WINDOW;
+        if(!p.rcv_seen[bit])
+        {
+            p.rcv_seen[bit] = true;
+            fresh = true;
+        }
+        while(p.rcv_seen[p.rcv_next % MAX_WINDOW])
+        {
+            p.rcv_seen[p.rcv_next % MAX_WINDOW] = false;
+            p.rcv_next++;
+        }
+    }
+    // duplicates and messages beyond the window are acked anyway, the ack may be what got lost
+    send_ack(node_id, p);
+    if(fresh)
+    {
+        deliver(node_id, data, len);
+    }
+}
+
+auto Rudp::send_ack(uint64_t node_id, peer_state &p) -> void
+{
+    uint64_t sack = 0;
+    for(uint32_t i = 0; i < 64; i++)
+    {
+        if(p.rcv_seen[(p.rcv_next + 1 + i) % MAX_WINDOW])
+        {
+            sack |= 1ull << i;
+        }
+    }
+    char frame[RUDP_ACK_LENGTH];
+    frame[0] = RUDP_ACK;
+    put_u32(frame + 1, p.rcv_epoch);
+    put_u32(frame + 5, p.rcv_next);
+    put_u64(frame + 9, sack);
+    send_datagram(node_id, frame, RUDP_ACK_LENGTH);
+}
+
+auto Rudp::send_forward(uint64_t node_id, peer_state &p) -> void
+{
+    char frame[RUDP_FORWARD_LENGTH];
+    frame[0] = RUDP_FORWARD;
+    put_u32(frame + 1, EPOCH);
+    put_u32(frame + 5, p.snd_base);
+    send_datagram(node_id, frame, RUDP_FORWARD_LENGTH);
+}
+
+auto Rudp::on_forward(uint64_t node_id, peer_state &p, uint32_t seq) -> void
+{
+    if(seq_lt(p.rcv_next, seq))
+    {
+        // forget what was seen of the skipped part, the window moves past it
+        if(seq - p.rcv_next >= MAX_WINDOW)
+        {
+            p.rcv_seen.reset();
+        }
+        else
+        {
+            for(uint32_t s = p.rcv_next; s != seq; s++)
+            {
+                p.rcv_seen[s % MAX_WINDOW] = false;
+            }
+        }
+        p.rcv_next = seq;
+        while(p.rcv_seen[p.rcv_next % MAX_WINDOW])
+        {
+            p.rcv_seen[p.rcv_next % MAX_WINDOW] = false;
+            p.rcv_next++;
+        }
+    }
+    send_ack(node_id, p);
+}
+
+auto Rudp::on_ack(uint64_t node_id, peer_state &p, uint32_t cum_ack, uint64_t sack) -> void
+{
+    auto now = clock::now();
+    if(seq_lt(p.snd_next, cum_ack))
+    {
+        // acks something we never sent
+        return;
+    }
+    auto mark = [this, &p, now](uint32_t seq) {
+        if(seq_lt(seq, p.snd_base) || !seq_lt(seq, p.snd_next))
+        {
+            return;
+        }
+        pending &pkt = p.inflight[seq - p.snd_base];
+        if(!pkt.acked)
+        {
+            pkt.acked = true;
+            // Karn's algorithm: only unambiguous samples
+            if(pkt.retries == 0 && !pkt.fast_retransmitted)
+            {
+                update_rtt(p, now - pkt.sent_at);
+            }
+        }
+    };
+    for(uint32_t seq = p.snd_base; seq_lt(seq, cum_ack); seq++)
+    {
+        mark(seq);
+    }
+    uint32_t highest_sacked = cum_ack;
+    for(uint32_t i = 0; i < 64; i++)
+    {
+        if(sack & (1ull << i))
+        {
+            mark(cum_ack + 1 + i);
+            highest_sacked = cum_ack + 1 + i;
+        }
+    }
+
+    // fast retransmit: a hole with at least 3 newer messages acknowledged past it is most likely lost
+    for(uint32_t seq = cum_ack; seq_lt(seq, p.snd_next) && seq_lt(seq + 3, highest_sacked + 1); seq++)
+    {
+        if(seq_lt(seq, p.snd_base))
+        {
+            continue;
+        }
+        pending &pkt = p.inflight[seq - p.snd_base];
+        if(!pkt.acked && !pkt.fast_retransmitted)
+        {
+            pkt.fast_retransmitted = true;
+            retransmits++;
+            transmit(node_id, pkt, now);
+        }
+    }
+
+    advance(node_id, p, now);
+    if(seq_lt(cum_ack, p.snd_base))
+    {
+        // the receiver waits for something we gave up, or restarted since it was acked
+        send_forward(node_id, p);
+    }
+}
+
+auto Rudp::backoff(clock::duration rto, int retries) const -> clock::duration
+{
+    // exponential backoff per message
+    return std::min<clock::duration>(rto * (1 << std::min(retries, 16)), opts.max_rto);
+}
+
+auto Rudp::update_rtt(peer_state &p, clock::duration sample) -> void
+{
+    // RFC 6298
+    if(p.srtt == clock::duration::zero())
+    {
+        p.srtt = sample;
+        p.rttvar = sample / 2;
+    }
+    else
+    {
+        auto err = p.srtt > sample ? p.srtt - sample : sample - p.srtt;
+        p.rttvar = (3 * p.rttvar + err) / 4;
+        p.srtt = (7 * p.srtt + sample) / 8;
+    }
+    p.rto = std::clamp<clock::duration>(p.srtt + 4 * p.rttvar, opts.min_rto, opts.max_rto);
+}
+
+} // namespace standby_network
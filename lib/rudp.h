@@ -0,0 +1,165 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _RUDP_H_
+#define _RUDP_H_
+
+#include <bits/stdint-uintn.h>
+#include <bitset>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace standby_network
+{
+
+struct RudpOptions
+{
+    // Maximum number of unacknowledged messages in flight per peer (at most Rudp::MAX_WINDOW),
+    // the rest waits in a backlog
+    uint32_t window = 256;
+    std::chrono::milliseconds initial_rto = std::chrono::milliseconds(200);
+    std::chrono::milliseconds min_rto = std::chrono::milliseconds(20);
+    std::chrono::milliseconds max_rto = std::chrono::seconds(5);
+    // A message is given up (and counted in failed()) after this many retransmissions
+    int max_retries = 10;
+    // Messages per peer waiting for room in the window, send returns -EAGAIN beyond. 0 means unlimited
+    std::size_t max_backlog = 4096;
+};
+
+/**
+ * Reliable, unordered datagram delivery. Every message gets a per-peer sequence number and is
+ * retransmitted until acknowledged. ACKs carry the cumulative ack and a 64 bit SACK bitmap of
+ * the messages received after it, so a single loss never stalls the others (messages are
+ * delivered as soon as they arrive, duplicates are suppressed).
+ *
+ * The class doesn't own any socket: datagrams go out through send_fn and the owner feeds the
+ * received ones into on_datagram() and calls on_timer() when the returned deadline expires.
+ * That keeps it usable over any datagram transport, including a lossy in-process one.
+ *
+ * Every instance picks a random epoch its sequence numbers count from 0 in. A receiver seeing a
+ * new epoch of a peer (the peer restarted) starts over with it, acks echo the epoch they are for
+ * so a restarted sender ignores the ones meant for its previous run. Whatever precedes the
+ * sender's window was either acked or given up, a FORWARD moves the receiver past it: it's sent
+ * once a given up message leaves the window and whenever an ack shows the receiver still waiting
+ * for something before it (a lost FORWARD, or a receiver that restarted).
+ *
+ * Wire format (big endian):
+ *   DATA:    0x01 | epoch (4) | seq (4) | payload
+ *   ACK:     0x02 | epoch (4) | cumulative ack (4) | SACK bitmap (8), bit i set = cumulative ack + 1 + i arrived
+ *   FORWARD: 0x03 | epoch (4) | seq (4), the sender never (re)sends anything before seq
+ */
+class Rudp
+{
+public:
+    using send_fn = std::function<int(uint64_t node_id, const char *data, std::size_t len)>;
+    using deliver_fn = std::function<void(uint64_t node_id, const char *data, std::size_t len)>;
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t DATA_HEADER = 9;
+    static constexpr uint32_t MAX_WINDOW = 1024;
+
+public:
+    Rudp(send_fn send, deliver_fn deliver, const RudpOptions &options = RudpOptions());
+    Rudp(const Rudp &) = delete;
+
+public:
+    auto operator=(const Rudp &) -> const Rudp & = delete;
+
+public:
+    // Queues msg for reliable delivery, transmits it right away if the window allows.
+    // -EAGAIN if the peer's backlog is full
+    auto send(uint64_t node_id, std::string_view msg) -> int;
+    auto on_datagram(uint64_t node_id, const char *data, std::size_t len) -> void;
+    // Retransmits whatever is due, returns the time until the next retransmission is due
+    auto on_timer() -> clock::duration;
+
+    auto retransmitted() const -> uint64_t;
+    auto failed() const -> uint64_t;
+
+private:
+    struct pending
+    {
+        std::string frame;
+        clock::time_point sent_at;
+        int retries;
+        bool acked;
+        bool fast_retransmitted;
+    };
+
+    struct peer_state
+    {
+        // sender side: inflight[i] has seq snd_base + i
+        uint32_t snd_base = 0;
+        uint32_t snd_next = 0;
+        std::deque<pending> inflight;
+        std::deque<std::string> backlog;
+        clock::duration srtt = clock::duration::zero();
+        clock::duration rttvar = clock::duration::zero();
+        clock::duration rto;
+        // a message before forward_end was given up, the receiver gets a FORWARD once it leaves the window
+        bool forward_pending = false;
+        uint32_t forward_end = 0;
+
+        // receiver side, rcv_epoch is the sender's current one and 0 before it sent anything: everything before rcv_next arrived, rcv_seen[seq % MAX_WINDOW] tells
+        // whether seq arrived for seq in [rcv_next, rcv_next + MAX_WINDOW)
+        uint32_t rcv_next = 0;
+        std::bitset<MAX_WINDOW> rcv_seen;
+        uint32_t rcv_epoch = 0;
+        uint32_t old_rcv_epoch = 0;
+    };
+
+    // these expect mutex to be locked
+    auto peer(uint64_t node_id) -> peer_state &;
+    auto transmit(uint64_t node_id, pending &pkt, clock::time_point now) -> void;
+    auto fill_window(uint64_t node_id, peer_state &p, clock::time_point now) -> void;
+    // drops the settled messages at the front of the window, sends a pending FORWARD and refills
+    auto advance(uint64_t node_id, peer_state &p, clock::time_point now) -> void;
+    // false for a stale epoch, a new one resets the receiver side
+    auto accept_epoch(peer_state &p, uint32_t epoch) -> bool;
+    auto on_data(uint64_t node_id, peer_state &p, uint32_t seq, const char *data, std::size_t len) -> void;
+    auto on_ack(uint64_t node_id, peer_state &p, uint32_t cum_ack, uint64_t sack) -> void;
+    auto on_forward(uint64_t node_id, peer_state &p, uint32_t seq) -> void;
+    auto send_ack(uint64_t node_id, peer_state &p) -> void;
+    auto send_forward(uint64_t node_id, peer_state &p) -> void;
+    auto update_rtt(peer_state &p, clock::duration sample) -> void;
+    auto backoff(clock::duration rto, int retries) const -> clock::duration;
+
+private:
+    send_fn send_datagram;
+    deliver_fn deliver;
+    RudpOptions opts;
+    const uint32_t EPOCH;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, peer_state> peers;
+    uint64_t retransmits = 0;
+    uint64_t failures = 0;
+};
+
+} // namespace standby_network
+
+#endif // _RUDP_H_
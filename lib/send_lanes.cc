@@ -0,0 +1,192 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <send_lanes.h>
+
+#include <algorithm>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+const std::size_t CONTROL_CLASS = static_cast<std::size_t>(UdpPriority::control);
+const std::size_t INTERACTIVE_CLASS = static_cast<std::size_t>(UdpPriority::interactive);
+const std::size_t BULK_CLASS = static_cast<std::size_t>(UdpPriority::bulk);
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+SendLanes::SendLanes(const QueueLimits &limits, std::size_t interactive_quantum, std::size_t bulk_quantum) :
+    LIMITS(limits),
+    round(INTERACTIVE_CLASS),
+    queued(0),
+    queued_bytes(0),
+    dropped(0),
+    rejected(0)
+{
+    classes[CONTROL_CLASS].quantum = 0;
+    classes[INTERACTIVE_CLASS].quantum = std::max<std::size_t>(interactive_quantum, 1);
+    classes[BULK_CLASS].quantum = std::max<std::size_t>(bulk_quantum, 1);
+    for(auto &c : classes)
+    {
+        c.deficit = c.quantum;
+    }
+}
+
+SendLanes::~SendLanes()
+{ }
+
+auto SendLanes::push(pending_msg &&msg, std::vector<pending_msg> *evicted) -> bool
+{
+    const uint64_t node_id = msg.node_id;
+    const std::size_t len = msg.data.size();
+    priority_class &c = classes[std::min(static_cast<std::size_t>(msg.priority), BULK_CLASS)];
+    // every lane in the map has one turn. drop_oldest may empty a lane, it keeps its turn and
+    // pop() skips it
+    auto [it, inserted] = c.lanes.try_emplace(node_id);
+    if(inserted)
+    {
+        c.turns.push_back(node_id);
+    }
+    lane &l = it->second;
+    if(LIMITS.policy == OverflowPolicy::drop_oldest)
+    {
+        while(!l.msgs.empty() && !fits(l, len))
+        {
+            l.bytes -= l.msgs.front().data.size();
+            queued_bytes -= l.msgs.front().data.size();
+            queued--;
+            dropped++;
+            if(evicted)
+            {
+                evicted->push_back(std::move(l.msgs.front()));
+            }
+            l.msgs.pop_front();
+        }
+    }
+    if(!fits(l, len))
+    {
+        (LIMITS.policy == OverflowPolicy::reject ? rejected : dropped)++;
+        return false;
+    }
+    l.msgs.push_back(std::move(msg));
+    l.bytes += len;
+    queued_bytes += len;
+    queued++;
+    return true;
+}
+
+auto SendLanes::pop(pending_msg &out) -> bool
+{
+    if(queued == 0)
+    {
+        return false;
+    }
+    if(ready(classes[CONTROL_CLASS]))
+    {
+        take(classes[CONTROL_CLASS], out);
+        return true;
+    }
+    // something is queued, so at least one of the two classes is backlogged and this ends
+    for(;;)
+    {
+        priority_class &c = classes[round];
+        if(ready(c))
+        {
+            const pending_msg &next = c.lanes[c.turns.front()].msgs.front();
+            if(next.data.size() <= c.deficit)
+            {
+                c.deficit -= next.data.size();
+                take(c, out);
+                return true;
+            }
+        }
+        else
+        {
+            // an idle class doesn't save up credit
+            c.deficit = 0;
+        }
+        round = round == INTERACTIVE_CLASS ? BULK_CLASS : INTERACTIVE_CLASS;
+        classes[round].deficit += classes[round].quantum;
+    }
+}
+
+auto SendLanes::empty() const -> bool
+{
+    return queued == 0;
+}
+
+auto SendLanes::size() const -> std::size_t
+{
+    return queued;
+}
+
+auto SendLanes::stats() const -> queue_stats
+{
+    return { queued, queued_bytes, dropped, rejected };
+}
+
+auto SendLanes::ready(priority_class &c) -> bool
+{
+    while(!c.turns.empty())
+    {
+        auto it = c.lanes.find(c.turns.front());
+        if(!it->second.msgs.empty())
+        {
+            return true;
+        }
+        c.lanes.erase(it);
+        c.turns.pop_front();
+    }
+    return false;
+}
+
+auto SendLanes::take(priority_class &c, pending_msg &out) -> void
+{
+    const uint64_t node_id = c.turns.front();
+    c.turns.pop_front();
+    auto it = c.lanes.find(node_id);
+    lane &l = it->second;
+    out = std::move(l.msgs.front());
+    l.msgs.pop_front();
+    l.bytes -= out.data.size();
+    queued_bytes -= out.data.size();
+    queued--;
+    if(l.msgs.empty())
+    {
+        c.lanes.erase(it);
+    }
+    else
+    {
+        c.turns.push_back(node_id);
+    }
+}
+
+auto SendLanes::fits(const lane &l, std::size_t len) const -> bool
+{
+    return (LIMITS.queue_msgs == 0 || l.msgs.size() + 1 <= LIMITS.queue_msgs) &&
+           (LIMITS.queue_bytes == 0 || l.bytes + len <= LIMITS.queue_bytes) &&
+           (LIMITS.total_msgs == 0 || queued + 1 <= LIMITS.total_msgs) &&
+           (LIMITS.total_bytes == 0 || queued_bytes + len <= LIMITS.total_bytes);
+}
+
+} // namespace standby_network
\ No newline at end of file
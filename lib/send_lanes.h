@@ -0,0 +1,136 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _SEND_LANES_H_
+#define _SEND_LANES_H_
+
+#include <bits/stdint-uintn.h>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <queue_limits.h>
+
+namespace standby_network
+{
+
+// Priority classes of the udp channel, from the most to the least urgent
+enum class UdpPriority : uint8_t
+{
+    control,
+    interactive,
+    bulk
+};
+
+const std::size_t UDP_PRIORITIES = 3;
+
+// A udp_send/udp_send_many caller waiting for the messages it left in SendLanes
+struct send_waiter
+{
+    // its messages not sent yet
+    std::size_t pending = 0;
+    // the first of them (in the caller's order) that failed, and its error
+    std::size_t failed = SIZE_MAX;
+    int error = 0;
+};
+
+// A message waiting in SendLanes
+struct pending_msg
+{
+    uint64_t node_id;
+    uint8_t channel;
+    UdpPriority priority;
+    std::string data;
+    // its udp_send ticket in async mode, 0 otherwise
+    int ticket;
+    // the caller waiting for its result and its index in the caller's messages, if there's one
+    send_waiter *waiter = nullptr;
+    std::size_t index = 0;
+};
+
+/**
+ * The messages waiting to be sent, in one bounded lane per (peer, priority class). pop() picks
+ * the next one: control messages always go first, interactive and bulk ones share what's left
+ * by deficit round robin, each getting its quantum of bytes per round. Within a class the peers
+ * take turns, one message each, and a lane keeps its order. The lanes are bounded by QueueLimits,
+ * its queue caps apply to every lane. Not thread safe.
+ */
+class SendLanes
+{
+public:
+    SendLanes(const QueueLimits &limits, std::size_t interactive_quantum, std::size_t bulk_quantum);
+    SendLanes(const SendLanes &) = delete;
+    ~SendLanes();
+
+public:
+    auto operator=(const SendLanes &) -> const SendLanes & = delete;
+
+public:
+    // false if msg went over the limits and was dropped or rejected (see the overflow policy), it's
+    // left untouched then. The messages drop_oldest made room with are moved to evicted, if given
+    auto push(pending_msg &&msg, std::vector<pending_msg> *evicted = nullptr) -> bool;
+    // the next message to send, false if there's none
+    auto pop(pending_msg &out) -> bool;
+    auto empty() const -> bool;
+    auto size() const -> std::size_t;
+    auto stats() const -> queue_stats;
+
+private:
+    struct lane
+    {
+        std::deque<pending_msg> msgs;
+        std::size_t bytes = 0;
+    };
+
+    struct priority_class
+    {
+        std::unordered_map<uint64_t, lane> lanes;
+        // the peers with queued messages, in turn order
+        std::deque<uint64_t> turns;
+        std::size_t quantum;
+        std::size_t deficit;
+    };
+
+    // false if none of c's lanes has a message, drops the emptied ones at the front of the turns
+    auto ready(priority_class &c) -> bool;
+    auto take(priority_class &c, pending_msg &out) -> void;
+    auto fits(const lane &l, std::size_t len) const -> bool;
+
+private:
+    const QueueLimits LIMITS;
+
+    std::array<priority_class, UDP_PRIORITIES> classes;
+    // the class whose round it is, interactive or bulk
+    std::size_t round;
+    std::size_t queued;
+    std::size_t queued_bytes;
+    uint64_t dropped;
+    uint64_t rejected;
+};
+
+} // namespace standby_network
+
+#endif // _SEND_LANES_H_
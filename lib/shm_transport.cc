@@ -0,0 +1,732 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <shm_transport.h>
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+// Start of every ring, its data follows. head and tail count the bytes ever read and written
+struct ring_header
+{
+    // only the receiver writes it
+    alignas(64) std::atomic<uint64_t> head;
+    // only the sender writes it
+    alignas(64) std::atomic<uint64_t> tail;
+    // raised by the receiver before it parks, the sender that finds it raised wakes it up
+    alignas(64) std::atomic<uint32_t> parked;
+};
+
+// A datagram in a ring is its length (uint32_t) followed by its bytes, padded to RECORD_ALIGN.
+// RECORD_WRAP in place of a length means the rest of the ring is unused, the next record is at its start
+const std::size_t RECORD_ALIGN = 8;
+const uint32_t RECORD_WRAP = UINT32_MAX;
+// While datagrams keep coming the endpoint never parks, so it looks for new and departed senders
+// every this many recv calls instead
+const unsigned SENDER_CHECK_INTERVAL = 64;
+// How long either side of a handshake waits for the other
+const int HANDSHAKE_TIMEOUT_MS = 1000;
+const std::size_t MIN_RING_SIZE = 4096;
+// The size of the peers map below which it isn't pruned
+const std::size_t MIN_PRUNE_AT = 64;
+
+auto record_size(std::size_t len) -> std::size_t
+{
+    return (sizeof(uint32_t) + len + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+auto shm_peer_key(uint64_t node_id, int port) -> uint64_t
+{
+    return node_id << 16 | static_cast<uint16_t>(port);
+}
+
+// The abstract unix socket node_id listens on for port, len is set to the length of the address
+auto listen_addr(const std::string &scope, uint64_t node_id, int port, socklen_t &len) -> sockaddr_un
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    // sun_path[0] stays 0, which makes the name abstract: it goes away with the socket
+    char name[sizeof(addr.sun_path) - 1];
+    int n = std::snprintf(name, sizeof(name), "%s/%llx:%d", scope.c_str(), static_cast<unsigned long long>(node_id), port);
+    n = std::clamp(n, 0, static_cast<int>(sizeof(name)) - 1);
+    std::copy(name, name + n, addr.sun_path + 1);
+    len = offsetof(sockaddr_un, sun_path) + 1 + n;
+    return addr;
+}
+
+auto set_handshake_timeout(int fd) -> void
+{
+    timeval tv = { HANDSHAKE_TIMEOUT_MS / 1000, (HANDSHAKE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Whether the process at the other end of fd runs as our user. Abstract unix sockets have no
+// file permissions, any process on the host could connect or listen under our names
+auto same_user(int fd) -> bool
+{
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+
+// Whether the other side of a connection closed it. Nothing is sent after the handshake,
+// so anything readable is the end of the stream
+auto hung_up(int fd) -> bool
+{
+    pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// A ring as mapped by either of its two sides
+struct shm_ring
+{
+    ring_header *header = nullptr;
+    char *data = nullptr;
+    std::size_t size = 0;
+
+    shm_ring() = default;
+    shm_ring(const shm_ring &) = delete;
+    ~shm_ring()
+    {
+        if(header)
+        {
+            munmap(header, sizeof(ring_header) + size);
+        }
+    }
+
+    auto operator=(const shm_ring &) -> const shm_ring & = delete;
+
+    auto map(int fd, std::size_t ring_size) -> bool
+    {
+        void *mem = mmap(nullptr, sizeof(ring_header) + ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(mem == MAP_FAILED)
+        {
+            return false;
+        }
+        header = static_cast<ring_header *>(mem);
+        data = static_cast<char *>(mem) + sizeof(ring_header);
+        size = ring_size;
+        return true;
+    }
+};
+
+// The receiving side of one sender's ring
+struct shm_sender
+{
+    // the connection the handshake went over, it hangs up once the sender is gone
+    int fd = -1;
+    uint64_t node_id = 0;
+    shm_ring ring;
+    bool gone = false;
+
+    shm_sender() = default;
+    shm_sender(const shm_sender &) = delete;
+    ~shm_sender()
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    auto operator=(const shm_sender &) -> const shm_sender & = delete;
+
+    auto empty() const -> bool
+    {
+        return ring.header->head.load(std::memory_order_relaxed) == ring.header->tail.load(std::memory_order_acquire);
+    }
+
+    auto read(datagram *dgrams, std::size_t count) -> std::size_t
+    {
+        ring_header *h = ring.header;
+        uint64_t head = h->head.load(std::memory_order_relaxed);
+        const uint64_t tail = h->tail.load(std::memory_order_acquire);
+        std::size_t n = 0;
+        while(head != tail && n < count)
+        {
+            const std::size_t offset = head & (ring.size - 1);
+            uint32_t len;
+            std::memcpy(&len, ring.data + offset, sizeof(len));
+            if(len == RECORD_WRAP)
+            {
+                head += ring.size - offset;
+                continue;
+            }
+            if(len > ring.size || offset + record_size(len) > ring.size)
+            {
+                // the sender wrote garbage into its own ring, nothing after this can be trusted
+                std::cerr << "Dropping the corrupt shared memory ring of " << std::hex << node_id << std::dec << std::endl;
+                gone = true;
+                head = tail;
+                break;
+            }
+            // like a datagram socket, whatever doesn't fit is cut off
+            dgrams[n].len = std::min<std::size_t>(len, dgrams[n].cap);
+            std::memcpy(dgrams[n].data, ring.data + offset + sizeof(len), dgrams[n].len);
+            dgrams[n].node_id = node_id;
+            head += record_size(len);
+            n++;
+        }
+        h->head.store(head, std::memory_order_release);
+        return n;
+    }
+};
+
+// A sender that connected but didn't introduce itself yet
+struct shm_handshake
+{
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+class ShmEndpoint : public Endpoint
+{
+public:
+    ShmEndpoint(int listen_fd, std::size_t ring_size) :
+        listen_fd(listen_fd),
+        wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        RING_SIZE(ring_size)
+    {
+    }
+
+    ~ShmEndpoint() override
+    {
+        for(const shm_handshake &h : handshakes)
+        {
+            close(h.fd);
+        }
+        close(listen_fd);
+        if(wake_fd >= 0)
+        {
+            close(wake_fd);
+        }
+    }
+
+public:
+    auto ok() const -> bool
+    {
+        return wake_fd >= 0;
+    }
+
+    auto recv(datagram *dgrams, std::size_t count) -> int override
+    {
+        if(++calls % SENDER_CHECK_INTERVAL == 0)
+        {
+            check_sockets(0);
+        }
+        std::size_t n = 0;
+        // a different sender goes first every time, so a busy one can't starve the others
+        const std::size_t senders_count = senders.size();
+        for(std::size_t i = 0; i < senders_count && n < count; i++)
+        {
+            n += senders[(next + i) % senders_count]->read(dgrams + n, count - n);
+        }
+        next++;
+        senders.erase(std::remove_if(senders.begin(), senders.end(),
+            [](const std::unique_ptr<shm_sender> &s) { return s->gone && s->empty(); }), senders.end());
+        return n;
+    }
+
+    auto wait(std::chrono::milliseconds timeout) -> void override
+    {
+        for(auto &s : senders)
+        {
+            s->ring.header->parked.store(1, std::memory_order_relaxed);
+        }
+        // pairs with the fence in ShmTransport::send: either the sender sees parked raised or we see its datagram
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(std::all_of(senders.begin(), senders.end(), [](const std::unique_ptr<shm_sender> &s) { return s->empty(); }))
+        {
+            check_sockets(timeout.count());
+        }
+        for(auto &s : senders)
+        {
+            s->ring.header->parked.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    auto wakeup() -> void override
+    {
+        uint64_t one = 1;
+        if(write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Couldn't wake up the shared memory listener: errno: " << errno << std::endl;
+        }
+    }
+
+private:
+    // Waits at most timeout for the eventfd, a new sender, one introducing itself or one hanging up
+    auto check_sockets(int timeout) -> void
+    {
+        pfds.clear();
+        pfds.push_back({ wake_fd, POLLIN, 0 });
+        pfds.push_back({ listen_fd, POLLIN, 0 });
+        for(auto &s : senders)
+        {
+            pfds.push_back({ s->fd, POLLIN, 0 });
+        }
+        for(const shm_handshake &h : handshakes)
+        {
+            pfds.push_back({ h.fd, POLLIN, 0 });
+        }
+        if(!handshakes.empty())
+        {
+            // the oldest handshake times out first
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(handshakes.front().deadline - std::chrono::steady_clock::now());
+            timeout = timeout < 0 ? std::max<int>(left.count(), 0) : std::clamp<int>(left.count(), 0, timeout);
+        }
+        if(poll(pfds.data(), pfds.size(), timeout) <= 0)
+        {
+            expire_handshakes();
+            return;
+        }
+        if(pfds[0].revents)
+        {
+            uint64_t count;
+            if(::read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            {
+                std::cerr << "Couldn't reset the shared memory wakeup: errno: " << errno << std::endl;
+            }
+        }
+        const std::size_t senders_count = senders.size();
+        for(std::size_t i = 0; i < senders_count; i++)
+        {
+            if(pfds[2 + i].revents)
+            {
+                // whatever it wrote before is still delivered, recv drops the ring once it's empty
+                senders[i]->gone = true;
+            }
+        }
+        // the handshakes accepted below aren't in pfds yet
+        std::size_t h = 0;
+        for(std::size_t i = 2 + senders_count; i < pfds.size(); i++)
+        {
+            if(pfds[i].revents)
+            {
+                complete_handshake(handshakes[h].fd);
+                handshakes.erase(handshakes.begin() + h);
+            }
+            else
+            {
+                h++;
+            }
+        }
+        expire_handshakes();
+        if(pfds[1].revents)
+        {
+            accept_senders();
+        }
+    }
+
+    // Only accepts, the listener thread doesn't wait for a sender to introduce itself. check_sockets
+    // polls the new connections with the others
+    auto accept_senders() -> void
+    {
+        int fd;
+        while((fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+        {
+            if(!same_user(fd))
+            {
+                std::cerr << "Dropping a shared memory sender of another user" << std::endl;
+                close(fd);
+                continue;
+            }
+            handshakes.push_back({ fd, std::chrono::steady_clock::now() + std::chrono::milliseconds(HANDSHAKE_TIMEOUT_MS) });
+        }
+    }
+
+    auto expire_handshakes() -> void
+    {
+        const auto now = std::chrono::steady_clock::now();
+        while(!handshakes.empty() && handshakes.front().deadline <= now)
+        {
+            std::cerr << "Dropping a shared memory sender that didn't introduce itself" << std::endl;
+            close(handshakes.front().fd);
+            handshakes.erase(handshakes.begin());
+        }
+    }
+
+    // fd is readable: the sender introduces itself with its node id and gets its ring and our eventfd back
+    auto complete_handshake(int fd) -> void
+    {
+        auto s = std::make_unique<shm_sender>();
+        s->fd = fd;
+        if(::recv(fd, &s->node_id, sizeof(s->node_id), MSG_DONTWAIT) != sizeof(s->node_id))
+        {
+            std::cerr << "Dropping a shared memory sender that didn't introduce itself" << std::endl;
+            return;
+        }
+        int mem;
+        if((mem = memfd_create("zt_lua_wrap ring", MFD_CLOEXEC)) < 0)
+        {
+            std::cerr << "Couldn't create a shared memory ring: errno: " << errno << std::endl;
+            return;
+        }
+        if(ftruncate(mem, sizeof(ring_header) + RING_SIZE) < 0 || !s->ring.map(mem, RING_SIZE))
+        {
+            std::cerr << "Couldn't map a shared memory ring: errno: " << errno << std::endl;
+            close(mem);
+            return;
+        }
+        new (s->ring.header) ring_header();
+
+        uint64_t size = RING_SIZE;
+        iovec iov = { &size, sizeof(size) };
+        alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        const int fds[2] = { mem, wake_fd };
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        // the sender holds its own reference to the memory now, our mapping keeps it alive on this side
+        close(mem);
+        if(sent != sizeof(size))
+        {
+            std::cerr << "Couldn't hand a shared memory ring to " << std::hex << s->node_id << std::dec << std::endl;
+            return;
+        }
+        senders.push_back(std::move(s));
+    }
+
+private:
+    const int listen_fd;
+    const int wake_fd;
+    const std::size_t RING_SIZE;
+
+    std::vector<std::unique_ptr<shm_sender>> senders;
+    // oldest first
+    std::vector<shm_handshake> handshakes;
+    std::vector<pollfd> pfds;
+    std::size_t next = 0;
+    unsigned calls = 0;
+};
+
+class ShmRoute : public Route
+{
+public:
+    ShmRoute(ShmTransport &transport, std::shared_ptr<ShmTransport::peer_entry> entry, uint64_t node_id, int port) :
+        transport(transport),
+        entry(std::move(entry)),
+        NODE_ID(node_id),
+        PORT(port)
+    {
+    }
+
+public:
+    auto send(const char *data, std::size_t len) -> int override
+    {
+        std::unique_lock<std::mutex> lock(transport.mutex);
+        return transport.send_to(lock, *entry, NODE_ID, PORT, data, len);
+    }
+
+private:
+    ShmTransport &transport;
+    const std::shared_ptr<ShmTransport::peer_entry> entry;
+    const uint64_t NODE_ID;
+    const int PORT;
+};
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+struct ShmTransport::peer
+{
+    // the connection the handshake went over, it hangs up once the receiver is gone.
+    // Peers found not to be local have neither, nor a ring
+    int fd = -1;
+    int wake_fd = -1;
+    shm_ring ring;
+    // the last head read, so the receiver's cache line is only touched when the ring looks full
+    uint64_t head = 0;
+    // when to probe again (no ring) or to check that the receiver is still there
+    std::chrono::steady_clock::time_point check_at;
+
+    ~peer()
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        if(wake_fd >= 0)
+        {
+            close(wake_fd);
+        }
+    }
+};
+
+struct ShmTransport::peer_entry
+{
+    // nullptr until the peer is probed, and again once it's due for a new probe
+    std::unique_ptr<peer> p;
+    // a handshake with the peer is going on, without the mutex
+    bool connecting = false;
+};
+
+ShmTransport::ShmTransport(uint64_t node_id, const ShmOptions &options) :
+    NODE_ID(node_id),
+    opts(options),
+    prune_at(MIN_PRUNE_AT)
+{
+    std::size_t size = MIN_RING_SIZE;
+    while(size < opts.ring_size)
+    {
+        size <<= 1;
+    }
+    opts.ring_size = size;
+}
+
+ShmTransport::~ShmTransport()
+{ }
+
+auto ShmTransport::bind(int port) -> std::unique_ptr<Endpoint>
+{
+    int fd;
+    if((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return nullptr;
+    }
+    socklen_t len;
+    sockaddr_un addr = listen_addr(opts.scope, NODE_ID, port, len);
+    if(::bind(fd, (const sockaddr *)&addr, len) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    auto endpoint = std::make_unique<ShmEndpoint>(fd, opts.ring_size);
+    if(!endpoint->ok())
+    {
+        return nullptr;
+    }
+    return endpoint;
+}
+
+auto ShmTransport::send(uint64_t node_id, int port, const char *data, std::size_t len) -> int
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // our own reference keeps the entry from being pruned while the lock is released
+    std::shared_ptr<peer_entry> entry = find_entry(node_id, port);
+    return send_to(lock, *entry, node_id, port, data, len);
+}
+
+auto ShmTransport::resolve(uint64_t node_id, int port) -> std::unique_ptr<Route>
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::make_unique<ShmRoute>(*this, find_entry(node_id, port), node_id, port);
+}
+
+auto ShmTransport::node_id() const -> uint64_t
+{
+    return NODE_ID;
+}
+
+auto ShmTransport::find_entry(uint64_t node_id, int port) -> std::shared_ptr<peer_entry>
+{
+    std::shared_ptr<peer_entry> &entry = peers[shm_peer_key(node_id, port)];
+    if(entry)
+    {
+        return entry;
+    }
+    entry = std::make_shared<peer_entry>();
+    std::shared_ptr<peer_entry> found = entry;
+    if(peers.size() >= prune_at)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        for(auto it = peers.begin(); it != peers.end();)
+        {
+            const std::unique_ptr<peer> &p = it->second->p;
+            if(it->second.use_count() == 1 && (!p || !p->ring.header || now >= p->check_at))
+            {
+                it = peers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        prune_at = std::max(MIN_PRUNE_AT, peers.size() * 2);
+    }
+    return found;
+}
+
+auto ShmTransport::send_to(std::unique_lock<std::mutex> &lock, peer_entry &entry, uint64_t node_id, int port, const char *data, std::size_t len) -> int
+{
+    std::unique_ptr<peer> &p = entry.p;
+    const auto now = std::chrono::steady_clock::now();
+    if(p && now >= p->check_at)
+    {
+        if(p->ring.header && !hung_up(p->fd))
+        {
+            p->check_at = now + opts.probe_interval;
+        }
+        else
+        {
+            p.reset();
+        }
+    }
+    if(!p)
+    {
+        if(entry.connecting)
+        {
+            // another thread is at the handshake, until it's done this goes over the network
+            return -EHOSTUNREACH;
+        }
+        // the handshake can take up to HANDSHAKE_TIMEOUT_MS, the other peers shouldn't wait for it
+        entry.connecting = true;
+        lock.unlock();
+        std::unique_ptr<peer> connected = connect(node_id, port);
+        if(!connected)
+        {
+            connected = std::make_unique<peer>();
+        }
+        connected->check_at = now + opts.probe_interval;
+        lock.lock();
+        entry.connecting = false;
+        p = std::move(connected);
+    }
+    if(!p->ring.header)
+    {
+        return -EHOSTUNREACH;
+    }
+
+    shm_ring &r = p->ring;
+    const std::size_t size = record_size(len);
+    if(size > r.size / 2)
+    {
+        return -EMSGSIZE;
+    }
+    uint64_t tail = r.header->tail.load(std::memory_order_relaxed);
+    std::size_t offset = tail & (r.size - 1);
+    // a record is never split, if it doesn't fit before the end of the ring it goes to its start
+    const std::size_t skip = r.size - offset < size ? r.size - offset : 0;
+    if(tail + skip + size - p->head > r.size)
+    {
+        p->head = r.header->head.load(std::memory_order_acquire);
+        if(tail + skip + size - p->head > r.size)
+        {
+            return -ENOBUFS;
+        }
+    }
+    if(skip > 0)
+    {
+        std::memcpy(r.data + offset, &RECORD_WRAP, sizeof(RECORD_WRAP));
+        tail += skip;
+        offset = 0;
+    }
+    const uint32_t len32 = len;
+    std::memcpy(r.data + offset, &len32, sizeof(len32));
+    std::memcpy(r.data + offset + sizeof(len32), data, len);
+    r.header->tail.store(tail + size, std::memory_order_release);
+
+    // pairs with the fence in ShmEndpoint::wait
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(r.header->parked.load(std::memory_order_relaxed) && r.header->parked.exchange(0))
+    {
+        uint64_t one = 1;
+        if(write(p->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Couldn't wake up the shared memory receiver: errno: " << errno << std::endl;
+        }
+    }
+    return len;
+}
+
+auto ShmTransport::connect(uint64_t node_id, int port) -> std::unique_ptr<peer>
+{
+    auto p = std::make_unique<peer>();
+    if((p->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return nullptr;
+    }
+    set_handshake_timeout(p->fd);
+    socklen_t len;
+    sockaddr_un addr = listen_addr(opts.scope, node_id, port, len);
+    if(::connect(p->fd, (const sockaddr *)&addr, len) < 0)
+    {
+        // nobody listens there: the peer isn't on this host
+        return nullptr;
+    }
+    if(!same_user(p->fd))
+    {
+        std::cerr << "The local peer " << std::hex << node_id << std::dec << " runs as another user, not sharing memory with it" << std::endl;
+        return nullptr;
+    }
+    if(::send(p->fd, &NODE_ID, sizeof(NODE_ID), MSG_NOSIGNAL) != sizeof(NODE_ID))
+    {
+        std::cerr << "Couldn't introduce ourselves to the local peer " << std::hex << node_id << std::dec << std::endl;
+        return nullptr;
+    }
+
+    uint64_t size = 0;
+    iovec iov = { &size, sizeof(size) };
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(p->fd, &msg, MSG_CMSG_CLOEXEC);
+    cmsghdr *cmsg = got == sizeof(size) ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    {
+        std::cerr << "The local peer " << std::hex << node_id << std::dec << " didn't hand out a shared memory ring" << std::endl;
+        return nullptr;
+    }
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    p->wake_fd = fds[1];
+    const bool mapped = size >= MIN_RING_SIZE && (size & (size - 1)) == 0 && p->ring.map(fds[0], size);
+    close(fds[0]);
+    if(!mapped)
+    {
+        std::cerr << "Couldn't map the shared memory ring of the local peer " << std::hex << node_id << std::dec << std::endl;
+        return nullptr;
+    }
+    return p;
+}
+
+} // namespace standby_network
\ No newline at end of file
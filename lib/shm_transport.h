@@ -0,0 +1,111 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _SHM_TRANSPORT_H_
+#define _SHM_TRANSPORT_H_
+
+#include <bits/stdint-uintn.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <transport.h>
+
+namespace standby_network
+{
+
+struct ShmOptions
+{
+    // CommLayer sends udp_send datagrams to peers on the same host through shared memory
+    // instead of its transport. Off by default, only processes of the same user share rings
+    bool enabled = false;
+    // Only nodes with the same scope find each other, e.g. to keep apart test runs on one host
+    std::string scope = "zt_lua_wrap";
+    // Bytes of the ring every sender gets at a receiver (a power of two), what doesn't fit is dropped
+    std::size_t ring_size = 1024 * 1024;
+    // How long a peer found not to be local isn't probed again, and how often a local one is
+    // checked for still being there
+    std::chrono::milliseconds probe_interval = std::chrono::seconds(1);
+};
+
+/**
+ * Datagrams between processes of the same host. Every bound port listens on an abstract unix
+ * socket named after the scope, the node id and the port. A sender connects to it the first time
+ * it sends to that node and port, and gets a ring in shared memory (memfd) plus the receiver's
+ * eventfd back. From then on a datagram is one copy into the ring and one out of it, the eventfd
+ * is only written when the receiver is parked.
+ *
+ * Every ring has a single sender, so datagrams are never reordered. send() fails with
+ * -EHOSTUNREACH for peers that aren't on this host, the caller sends over the network then.
+ * Both ends of a handshake check with SO_PEERCRED that the other one runs as the same user,
+ * the abstract socket names are open to everybody on the host.
+ */
+class ShmTransport : public Transport
+{
+public:
+    ShmTransport(uint64_t node_id, const ShmOptions &options = ShmOptions());
+    ShmTransport(const ShmTransport &) = delete;
+    ~ShmTransport();
+
+public:
+    auto operator=(const ShmTransport &) -> const ShmTransport & = delete;
+
+public:
+    // nullptr if another process of the same scope already bound node_id() and port
+    auto bind(int port) -> std::unique_ptr<Endpoint> override;
+    // -EHOSTUNREACH if node_id hasn't bound port on this host, -ENOBUFS if its ring is full
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override;
+    // The route shares the peer's entry, so it writes to the same ring as send() without looking it up
+    auto resolve(uint64_t node_id, int port) -> std::unique_ptr<Route> override;
+    auto node_id() const -> uint64_t override;
+
+private:
+    struct peer;
+    struct peer_entry;
+    friend class ShmRoute;
+
+    // expects lock to hold mutex, entry is node_id's entry in peers. The handshake with a peer
+    // not probed yet happens with the lock released
+    auto send_to(std::unique_lock<std::mutex> &lock, peer_entry &entry, uint64_t node_id, int port, const char *data, std::size_t len) -> int;
+    // expects mutex to be locked, node_id's entry in peers, added if there is none
+    auto find_entry(uint64_t node_id, int port) -> std::shared_ptr<peer_entry>;
+
+    // nullptr if nobody listens on node_id and port
+    auto connect(uint64_t node_id, int port) -> std::unique_ptr<peer>;
+
+private:
+    const uint64_t NODE_ID;
+    ShmOptions opts;
+
+    // keyed by node id << 16 | port, peers found not to be local have an entry without a ring.
+    // Entries nobody else holds (no route, no send in progress) are pruned once the map grows
+    // past prune_at, unless they have a ring that isn't due for its check yet
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<peer_entry>> peers;
+    std::size_t prune_at;
+};
+
+} // namespace standby_network
+
+#endif // _SHM_TRANSPORT_H_
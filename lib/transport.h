@@ -0,0 +1,153 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <bits/stdint-uintn.h>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace standby_network
+{
+
+// One receive slot of Endpoint::recv: data and cap are filled in by the caller, len and node_id by the endpoint
+struct datagram
+{
+    char *data;
+    std::size_t cap;
+    std::size_t len;
+    uint64_t node_id;
+};
+
+// One datagram of Transport::send_many
+struct outgoing
+{
+    uint64_t node_id;
+    int port;
+    const char *data;
+    std::size_t len;
+};
+
+/**
+ * A bound datagram socket of a Transport. Only the thread that owns the endpoint calls recv()
+ * and wait(), wakeup() may be called from any thread.
+ */
+class Endpoint
+{
+public:
+    virtual ~Endpoint() = default;
+
+public:
+    // Receives at most count datagrams without blocking and returns how many were received,
+    // 0 if none were pending. An empty datagram (len 0) is a wakeup
+    virtual auto recv(datagram *dgrams, std::size_t count) -> int = 0;
+    // Blocks until a datagram is pending, wakeup() is called or timeout expires
+    virtual auto wait(std::chrono::milliseconds timeout) -> void = 0;
+    // Makes a concurrent wait() return right away
+    virtual auto wakeup() -> void = 0;
+};
+
+/**
+ * A peer resolved once by Transport::resolve, so sending to it skips the lookups Transport::send
+ * does per datagram. Used by one thread at a time, and only while its transport exists.
+ */
+class Route
+{
+public:
+    virtual ~Route() = default;
+
+public:
+    // Same as Transport::send to the resolved node and port
+    virtual auto send(const char *data, std::size_t len) -> int = 0;
+    // Same as Transport::send_many, dgrams must all be addressed to the resolved node and port
+    virtual auto send_many(const outgoing *dgrams, std::size_t count) -> int
+    {
+        std::size_t sent = 0;
+        for(; sent < count; sent++)
+        {
+            int err;
+            if((err = send(dgrams[sent].data, dgrams[sent].len)) < 0)
+            {
+                return sent > 0 ? sent : err;
+            }
+        }
+        return sent;
+    }
+};
+
+/**
+ * What CommLayer sends and receives its datagrams through. Peers are addressed by their node id
+ * and a port, it's up to the transport to map those to whatever it sends to: RFC4193 addresses of
+ * a ZeroTier network (ZtTransport), IP addresses (UdpTransport) or other transports in the same
+ * process (LoopbackTransport).
+ */
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+public:
+    // nullptr if the port couldn't be bound
+    virtual auto bind(int port) -> std::unique_ptr<Endpoint> = 0;
+    // Up to count endpoints that share port, each receiving the datagrams of a subset of the
+    // senders (a sender always lands on the same one), so each can have its own thread.
+    // Transports that can't share a port bind just one, none means the port couldn't be bound
+    virtual auto bind_shared(int port, std::size_t /* count */) -> std::vector<std::unique_ptr<Endpoint>>
+    {
+        std::vector<std::unique_ptr<Endpoint>> endpoints;
+        if(auto endpoint = bind(port))
+        {
+            endpoints.push_back(std::move(endpoint));
+        }
+        return endpoints;
+    }
+    // Sends one datagram, returns len or a negative error. May be called from any thread
+    virtual auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int = 0;
+    // Sends the datagrams in order, returns how many went out or a negative error if none did.
+    // Transports that can batch (UdpTransport) need fewer syscalls than one send() per datagram
+    virtual auto send_many(const outgoing *dgrams, std::size_t count) -> int
+    {
+        std::size_t sent = 0;
+        for(; sent < count; sent++)
+        {
+            int err;
+            if((err = send(dgrams[sent].node_id, dgrams[sent].port, dgrams[sent].data, dgrams[sent].len)) < 0)
+            {
+                return sent > 0 ? sent : err;
+            }
+        }
+        return sent;
+    }
+    // A route to node_id and port (see Route), nullptr if the transport has nothing faster than send()
+    virtual auto resolve(uint64_t /* node_id */, int /* port */) -> std::unique_ptr<Route>
+    {
+        return nullptr;
+    }
+    virtual auto node_id() const -> uint64_t = 0;
+};
+
+} // namespace standby_network
+
+#endif // _TRANSPORT_H_
@@ -0,0 +1,976 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <udp_transport.h>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+// Kernel limits of a UDP_SEGMENT send: segments per call and the size of the whole buffer
+const std::size_t GSO_MAX_SEGMENTS = 64;
+const std::size_t GSO_MAX_BYTES = 65507;
+// Size of a receive buffer with UDP_GRO, the kernel never merges more than this
+const std::size_t GRO_BUFFER_SIZE = 65536;
+// Provided buffers of the io_uring engine, including the io_uring_recvmsg_out header and the sender's address
+const std::size_t URING_BUFFER_SIZE = 16384;
+const uint16_t URING_BUFFER_GROUP = 0;
+// The receive ring only carries the multishot receive and the buffers handed back
+const unsigned RECV_RING_ENTRIES = 16;
+
+// Whether b can follow a in one UDP_SEGMENT send
+auto segmentable(const outgoing &a, const outgoing &b) -> bool
+{
+    return a.node_id == b.node_id && a.port == b.port && a.len > 0 && b.len > 0 && b.len <= a.len;
+}
+
+// Attaches a UDP_SEGMENT control message to msg, control has to hold CMSG_SPACE(sizeof(uint16_t)) bytes
+auto set_segment_size(msghdr &msg, char *control, uint16_t size) -> void
+{
+    std::memset(control, 0, CMSG_SPACE(sizeof(uint16_t)));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    std::memcpy(CMSG_DATA(c), &size, sizeof(size));
+}
+
+// Whether a segmented send failed because the kernel or the route can't do it
+auto gso_unsupported(int err) -> bool
+{
+    return err == EIO || err == EINVAL || err == ENOPROTOOPT || err == EOPNOTSUPP;
+}
+
+// Parses an IPv6 or IPv4 address, the latter into its v4-mapped form
+auto parse_addr(const std::string &str, in6_addr &addr) -> bool
+{
+    if(inet_pton(AF_INET6, str.c_str(), &addr) > 0)
+    {
+        return true;
+    }
+    in_addr v4;
+    if(inet_pton(AF_INET, str.c_str(), &v4) > 0)
+    {
+        std::memset(&addr, 0, sizeof(addr));
+        addr.s6_addr[10] = 0xff;
+        addr.s6_addr[11] = 0xff;
+        std::memcpy(&addr.s6_addr[12], &v4, sizeof(v4));
+        return true;
+    }
+    return false;
+}
+
+auto sock_addr(const in6_addr &addr, int port) -> sockaddr_in6
+{
+    sockaddr_in6 sa = {};
+    sa.sin6_family = AF_INET6;
+    sa.sin6_port = htons(port);
+    sa.sin6_addr = addr;
+    return sa;
+}
+
+// reuse_port puts the socket into a group of sockets sharing port, the kernel spreads incoming flows over them
+auto create_udp_sock(const in6_addr &addr, int port, bool nonblocking, int buffer, bool reuse_port = false) -> int
+{
+    int fd;
+    if((fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0)) < 0)
+    {
+        return -errno;
+    }
+    int off = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    int on = 1;
+    if(reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    sockaddr_in6 sa = sock_addr(addr, port);
+    if(::bind(fd, (const sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    return fd;
+}
+
+class UdpEndpoint : public Endpoint
+{
+public:
+    UdpEndpoint(const UdpTransport &transport, int fd, const UdpOptions &options) :
+        transport(transport),
+        fd(fd),
+        wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        depth(std::max<std::size_t>(options.batch_depth, 1)),
+        msgs(depth),
+        iovs(depth),
+        addrs(depth)
+    {
+        int on = 1;
+        if(options.gro && setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0)
+        {
+            // a merged receive holds up to ~45 MTU sized datagrams, so a few buffers go a long way
+            std::size_t count = std::max<std::size_t>(depth / 16, 1);
+            gro_bufs.resize(count * GRO_BUFFER_SIZE);
+            controls.resize(count * CMSG_SPACE(sizeof(int)));
+        }
+    }
+
+    ~UdpEndpoint() override
+    {
+        close(fd);
+        close(wake_fd);
+    }
+
+public:
+    auto recv(datagram *dgrams, std::size_t count) -> int override
+    {
+        if(!gro_bufs.empty())
+        {
+            return recv_gro(dgrams, count);
+        }
+        // straight into the caller's buffers
+        const std::size_t n = std::min(count, depth);
+        for(std::size_t i = 0; i < n; i++)
+        {
+            iovs[i] = { dgrams[i].data, dgrams[i].cap };
+            msgs[i].msg_hdr = {};
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int recvd;
+        if((recvd = recvmmsg(fd, msgs.data(), n, MSG_DONTWAIT, nullptr)) < 0)
+        {
+            return 0;
+        }
+        for(int i = 0; i < recvd; i++)
+        {
+            // unknown senders and truncated datagrams are handed out as empty datagrams, which are ignored like wakeups
+            dgrams[i].node_id = transport.lookup(addrs[i].sin6_addr);
+            dgrams[i].len = dgrams[i].node_id ? msgs[i].msg_len : 0;
+            if(!dgrams[i].node_id && msgs[i].msg_len > 0)
+            {
+                std::cerr << "Dropping datagram from an address outside of the address book" << std::endl;
+            }
+            else if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                transport.drop_truncated(dgrams[i].cap);
+                dgrams[i].len = 0;
+            }
+        }
+        return recvd;
+    }
+
+    auto wait(std::chrono::milliseconds timeout) -> void override
+    {
+        if(gro_next < gro_count)
+        {
+            // merged datagrams are still waiting to be split
+            return;
+        }
+        pollfd pfds[2] = { { fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+        if(poll(pfds, 2, timeout.count()) < 0 && errno != EINTR)
+        {
+            std::cerr << "Couldn't poll the listening socket: errno: " << errno << std::endl;
+        }
+        uint64_t count;
+        if(pfds[1].revents && read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Couldn't reset the listener wakeup: errno: " << errno << std::endl;
+        }
+    }
+
+    auto wakeup() -> void override
+    {
+        // not a datagram to ourselves like the libzt transport: with SO_REUSEPORT it could land on another socket of the port
+        uint64_t one = 1;
+        if(write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Couldn't wake up the listener: errno: " << errno << std::endl;
+        }
+    }
+
+private:
+    auto recv_gro(datagram *dgrams, std::size_t count) -> int
+    {
+        std::size_t n = 0;
+        while(n < count)
+        {
+            if(gro_next == gro_count && !refill_gro())
+            {
+                break;
+            }
+            // split the current receive into its segments, the last one may be shorter
+            gro_msg &m = gro_msgs[gro_next];
+            const char *data = gro_bufs.data() + gro_next * GRO_BUFFER_SIZE;
+            while(n < count && m.offset < m.len)
+            {
+                std::size_t len = std::min(m.segment, m.len - m.offset);
+                if(len > dgrams[n].cap)
+                {
+                    transport.drop_truncated(dgrams[n].cap);
+                    m.offset += m.segment;
+                    continue;
+                }
+                std::copy(data + m.offset, data + m.offset + len, dgrams[n].data);
+                dgrams[n].len = len;
+                dgrams[n].node_id = m.node_id;
+                m.offset += m.segment;
+                n++;
+            }
+            if(m.offset >= m.len)
+            {
+                if(m.len == 0 && n < count)
+                {
+                    // a wakeup
+                    dgrams[n].len = 0;
+                    dgrams[n].node_id = 0;
+                    n++;
+                }
+                gro_next++;
+            }
+        }
+        return n;
+    }
+
+    auto refill_gro() -> bool
+    {
+        const std::size_t n = controls.size() / CMSG_SPACE(sizeof(int));
+        for(std::size_t i = 0; i < n; i++)
+        {
+            iovs[i] = { gro_bufs.data() + i * GRO_BUFFER_SIZE, GRO_BUFFER_SIZE };
+            msgs[i].msg_hdr = {};
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls.data() + i * CMSG_SPACE(sizeof(int));
+            msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(int));
+        }
+        int recvd;
+        if((recvd = recvmmsg(fd, msgs.data(), n, MSG_DONTWAIT, nullptr)) <= 0)
+        {
+            return false;
+        }
+        gro_msgs.resize(recvd);
+        for(int i = 0; i < recvd; i++)
+        {
+            gro_msg &m = gro_msgs[i];
+            m.len = msgs[i].msg_len;
+            m.segment = m.len;
+            m.offset = 0;
+            for(cmsghdr *c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c))
+            {
+                if(c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO)
+                {
+                    int segment;
+                    std::memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+                    m.segment = segment;
+                }
+            }
+            m.node_id = transport.lookup(addrs[i].sin6_addr);
+            if(!m.node_id && m.len > 0)
+            {
+                std::cerr << "Dropping datagram from an address outside of the address book" << std::endl;
+                m.offset = m.len;
+            }
+            else if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                // not even a single datagram fit, the merged ones are all the same size
+                transport.drop_truncated(GRO_BUFFER_SIZE);
+                m.offset = m.len;
+            }
+        }
+        gro_next = 0;
+        gro_count = recvd;
+        return true;
+    }
+
+private:
+    struct gro_msg
+    {
+        std::size_t len;
+        std::size_t segment;
+        std::size_t offset;
+        uint64_t node_id;
+    };
+
+    const UdpTransport &transport;
+    int fd;
+    int wake_fd;
+    const std::size_t depth;
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<sockaddr_in6> addrs;
+
+    // only used with UDP_GRO: gro_msgs[gro_next, gro_count) still have segments to hand out
+    std::vector<char> gro_bufs;
+    std::vector<char> controls;
+    std::vector<gro_msg> gro_msgs;
+    std::size_t gro_next = 0;
+    std::size_t gro_count = 0;
+};
+
+class UringUdpEndpoint : public Endpoint
+{
+public:
+    UringUdpEndpoint(const UdpTransport &transport, int fd, const UdpOptions &options) :
+        transport(transport),
+        fd(fd),
+        wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        ring(RECV_RING_ENTRIES, options.uring_buffers)
+    {
+        // the kernel only looks at the name and control lengths of a multishot recvmsg
+        recv_msg.msg_namelen = sizeof(sockaddr_in6);
+        ready = wake_fd >= 0 && ring.ok() && ring.setup_buffers(URING_BUFFER_GROUP, options.uring_buffers, URING_BUFFER_SIZE) &&
+            arm() && arm_wakeup() && ring.submit() >= 0;
+    }
+
+    ~UringUdpEndpoint() override
+    {
+        close(fd);
+        if(wake_fd >= 0)
+        {
+            close(wake_fd);
+        }
+    }
+
+public:
+    // false if io_uring (or one of the features used) isn't available
+    auto ok() const -> bool
+    {
+        return ready;
+    }
+
+    auto recv(datagram *dgrams, std::size_t count) -> int override
+    {
+        std::size_t n = 0;
+        io_uring_cqe *cqe;
+        while(n < count && (cqe = ring.peek_cqe()))
+        {
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            const bool wake = cqe->user_data == WAKE_USER_DATA;
+            ring.cqe_seen();
+            if(wake)
+            {
+                // wakeup() was called, the eventfd is read again right away
+                wake_armed = false;
+                continue;
+            }
+            if(!(flags & IORING_CQE_F_MORE))
+            {
+                // the multishot receive ended (out of buffers, most likely), it's rearmed below
+                armed = false;
+            }
+            if(!(flags & IORING_CQE_F_BUFFER))
+            {
+                if(res < 0 && res != -ENOBUFS)
+                {
+                    std::cerr << "Couldn't receive on the listening socket: errno: " << -res << std::endl;
+                }
+                continue;
+            }
+            const uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+            const char *buf = ring.buffer(id);
+            // the buffer holds io_uring_recvmsg_out | name | payload
+            io_uring_recvmsg_out out;
+            sockaddr_in6 name;
+            std::memcpy(&out, buf, sizeof(out));
+            std::memcpy(&name, buf + sizeof(out), sizeof(name));
+            const char *payload = buf + sizeof(out) + sizeof(name);
+            std::size_t len = out.payloadlen;
+            dgrams[n].node_id = transport.lookup(name.sin6_addr);
+            if(!dgrams[n].node_id && len > 0)
+            {
+                std::cerr << "Dropping datagram from an address outside of the address book" << std::endl;
+                len = 0;
+            }
+            else if((out.flags & MSG_TRUNC) || len > URING_BUFFER_SIZE - sizeof(out) - sizeof(name) || len > dgrams[n].cap)
+            {
+                transport.drop_truncated(std::min<std::size_t>(URING_BUFFER_SIZE - sizeof(out) - sizeof(name), dgrams[n].cap));
+                len = 0;
+            }
+            std::copy(payload, payload + len, dgrams[n].data);
+            dgrams[n].len = len;
+            ring.recycle_buffer(id);
+            n++;
+        }
+        // one submit hands the consumed buffers back and rearms whatever ended
+        bool queued = n > 0;
+        if(!armed)
+        {
+            queued |= arm();
+        }
+        if(!wake_armed)
+        {
+            queued |= arm_wakeup();
+        }
+        if(queued)
+        {
+            ring.submit();
+        }
+        return n;
+    }
+
+    auto wait(std::chrono::milliseconds timeout) -> void override
+    {
+        if(ring.peek_cqe())
+        {
+            return;
+        }
+        int err;
+        if((err = ring.submit(1, timeout)) < 0)
+        {
+            std::cerr << "Couldn't wait on the listening socket: errno: " << -err << std::endl;
+        }
+    }
+
+    auto wakeup() -> void override
+    {
+        // an eventfd read in the ring, for the same reason as the mmsg engine
+        uint64_t one = 1;
+        if(write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Couldn't wake up the listener: errno: " << errno << std::endl;
+        }
+    }
+
+private:
+    // these only queue their entry, the next submit hands it to the kernel
+    auto arm() -> bool
+    {
+        io_uring_sqe *sqe;
+        if(!(sqe = ring.get_sqe()))
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&recv_msg);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = RECV_USER_DATA;
+        armed = true;
+        return true;
+    }
+
+    auto arm_wakeup() -> bool
+    {
+        io_uring_sqe *sqe;
+        if(!(sqe = ring.get_sqe()))
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wake_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&wake_count);
+        sqe->len = sizeof(wake_count);
+        sqe->user_data = WAKE_USER_DATA;
+        wake_armed = true;
+        return true;
+    }
+
+private:
+    static constexpr uint64_t RECV_USER_DATA = 0;
+    static constexpr uint64_t WAKE_USER_DATA = 1;
+
+    const UdpTransport &transport;
+    int fd;
+    int wake_fd;
+    Uring ring;
+    msghdr recv_msg = {};
+    uint64_t wake_count = 0;
+    bool armed = false;
+    bool wake_armed = false;
+    bool ready = false;
+};
+
+class UdpRoute : public Route
+{
+public:
+    UdpRoute(UdpTransport &transport, const sockaddr_in6 &addr) :
+        transport(transport),
+        addr(addr)
+    {
+    }
+
+public:
+    auto send(const char *data, std::size_t len) -> int override
+    {
+        if(sendto(transport.send_fd, data, len, 0, (const sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            return -errno;
+        }
+        return len;
+    }
+
+    auto send_many(const outgoing *dgrams, std::size_t count) -> int override
+    {
+        return transport.send_many(dgrams, count, &addr);
+    }
+
+private:
+    UdpTransport &transport;
+    const sockaddr_in6 addr;
+};
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+UdpTransport::UdpTransport(uint64_t node_id, const std::unordered_map<uint64_t, std::string> &addresses, const UdpOptions &options) :
+    NODE_ID(node_id),
+    opts(options),
+    gso(options.gso)
+{
+    for(auto &a : addresses)
+    {
+        in6_addr addr;
+        if(!parse_addr(a.second, addr))
+        {
+            std::cerr << "Ignoring invalid address " << a.second << " of node " << std::hex << a.first << std::dec << std::endl;
+            continue;
+        }
+        nodes[a.first] = addr;
+        node_ids[key_of(addr)] = a.first;
+    }
+    auto self = nodes.find(NODE_ID);
+    if(self != nodes.end())
+    {
+        local_addr = self->second;
+    }
+    // a blocking socket, a full send buffer should slow the sender down rather than fail it
+    if((send_fd = create_udp_sock(local_addr, 0, false, opts.socket_buffer)) < 0)
+    {
+        std::cerr << "Couldn't create UDP socket. errno: " << -send_fd << std::endl;
+    }
+    if(opts.engine == UdpEngine::io_uring)
+    {
+        opts.batch_depth = std::max<std::size_t>(opts.batch_depth, 1);
+        send_ring = std::make_unique<Uring>(opts.batch_depth);
+        if(!send_ring->ok())
+        {
+            std::cerr << "Couldn't set up io_uring, falling back to sendmmsg/recvmmsg" << std::endl;
+            send_ring.reset();
+            opts.engine = UdpEngine::mmsg;
+        }
+    }
+}
+
+UdpTransport::~UdpTransport()
+{
+    if(send_fd >= 0)
+    {
+        close(send_fd);
+    }
+}
+
+auto UdpTransport::bind(int port) -> std::unique_ptr<Endpoint>
+{
+    return bind_endpoint(port, false);
+}
+
+auto UdpTransport::bind_shared(int port, std::size_t count) -> std::vector<std::unique_ptr<Endpoint>>
+{
+    std::vector<std::unique_ptr<Endpoint>> endpoints;
+    if(count <= 1)
+    {
+        if(auto endpoint = bind(port))
+        {
+            endpoints.push_back(std::move(endpoint));
+        }
+        return endpoints;
+    }
+    // the kernel hashes the sender's address and port to pick one of them, so a peer (which
+    // sends from a single socket) always lands on the same endpoint
+    for(std::size_t i = 0; i < count; i++)
+    {
+        auto endpoint = bind_endpoint(port, true);
+        if(!endpoint)
+        {
+            break;
+        }
+        endpoints.push_back(std::move(endpoint));
+    }
+    return endpoints;
+}
+
+auto UdpTransport::bind_endpoint(int port, bool reuse_port) -> std::unique_ptr<Endpoint>
+{
+    int fd;
+    if((fd = create_udp_sock(local_addr, port, true, opts.socket_buffer, reuse_port)) < 0)
+    {
+        std::cerr << "Couldn't bind port " << port << ": errno: " << -fd << std::endl;
+        return nullptr;
+    }
+    if(opts.engine == UdpEngine::io_uring)
+    {
+        auto endpoint = std::make_unique<UringUdpEndpoint>(*this, fd, opts);
+        if(endpoint->ok())
+        {
+            return endpoint;
+        }
+        std::cerr << "Couldn't set up an io_uring multishot receive, falling back to recvmmsg" << std::endl;
+        endpoint.reset();
+        // the endpoint closed the socket
+        if((fd = create_udp_sock(local_addr, port, true, opts.socket_buffer, reuse_port)) < 0)
+        {
+            return nullptr;
+        }
+    }
+    return std::make_unique<UdpEndpoint>(*this, fd, opts);
+}
+
+auto UdpTransport::send(uint64_t node_id, int port, const char *data, std::size_t len) -> int
+{
+    auto it = nodes.find(node_id);
+    if(it == nodes.end())
+    {
+        return -EHOSTUNREACH;
+    }
+    sockaddr_in6 sa = sock_addr(it->second, port);
+    if(sendto(send_fd, data, len, 0, (const sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        return -errno;
+    }
+    return len;
+}
+
+auto UdpTransport::send_many(const outgoing *dgrams, std::size_t count) -> int
+{
+    return send_many(dgrams, count, nullptr);
+}
+
+auto UdpTransport::send_many(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int
+{
+    if(send_ring)
+    {
+        return send_uring(dgrams, count, to);
+    }
+    std::size_t sent = 0;
+    while(sent < count)
+    {
+        std::size_t run = segment_run(dgrams + sent, count - sent);
+        int err;
+        if(run > 1)
+        {
+            err = send_segmented(dgrams + sent, run, to);
+        }
+        else
+        {
+            // everything up to the next segmentable run goes out in one sendmmsg
+            std::size_t batch = 1;
+            while(sent + batch < count && batch < opts.batch_depth &&
+                  !(gso && sent + batch + 1 < count && segmentable(dgrams[sent + batch], dgrams[sent + batch + 1])))
+            {
+                batch++;
+            }
+            err = send_batch(dgrams + sent, batch, to);
+        }
+        if(err < 0)
+        {
+            return sent > 0 ? sent : err;
+        }
+        sent += err;
+        if(err == 0)
+        {
+            break;
+        }
+    }
+    return sent;
+}
+
+auto UdpTransport::resolve(uint64_t node_id, int port) -> std::unique_ptr<Route>
+{
+    auto it = nodes.find(node_id);
+    if(it == nodes.end())
+    {
+        return nullptr;
+    }
+    return std::make_unique<UdpRoute>(*this, sock_addr(it->second, port));
+}
+
+auto UdpTransport::node_id() const -> uint64_t
+{
+    return NODE_ID;
+}
+
+auto UdpTransport::key_of(const in6_addr &addr) -> addr_key
+{
+    addr_key key;
+    std::memcpy(&key.hi, &addr.s6_addr[0], 8);
+    std::memcpy(&key.lo, &addr.s6_addr[8], 8);
+    return key;
+}
+
+auto UdpTransport::lookup(const in6_addr &addr) const -> uint64_t
+{
+    auto it = node_ids.find(key_of(addr));
+    return it != node_ids.end() ? it->second : 0;
+}
+
+auto UdpTransport::truncated() const -> uint64_t
+{
+    return truncated_dgrams.load(std::memory_order_relaxed);
+}
+
+auto UdpTransport::drop_truncated(std::size_t cap) const -> void
+{
+    // a cut off message would be handed on as if it was complete
+    truncated_dgrams.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "Dropping datagram longer than the receive buffer of " << cap << " bytes" << std::endl;
+}
+
+auto UdpTransport::destination(const outgoing &d, const sockaddr_in6 *to, sockaddr_in6 &sa) const -> bool
+{
+    if(to)
+    {
+        sa = *to;
+        return true;
+    }
+    auto it = nodes.find(d.node_id);
+    if(it == nodes.end())
+    {
+        return false;
+    }
+    sa = sock_addr(it->second, d.port);
+    return true;
+}
+
+auto UdpTransport::segment_run(const outgoing *dgrams, std::size_t count) const -> std::size_t
+{
+    // same peer, all of the first one's size but the last
+    std::size_t run = 1;
+    if(!gso)
+    {
+        return run;
+    }
+    std::size_t bytes = dgrams[0].len;
+    while(run < count && run < GSO_MAX_SEGMENTS)
+    {
+        if(!segmentable(dgrams[0], dgrams[run]) || dgrams[run - 1].len != dgrams[0].len || bytes + dgrams[run].len > GSO_MAX_BYTES)
+        {
+            break;
+        }
+        bytes += dgrams[run].len;
+        run++;
+    }
+    return run;
+}
+
+auto UdpTransport::send_segmented(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int
+{
+    sockaddr_in6 sa;
+    if(!destination(dgrams[0], to, sa))
+    {
+        return -EHOSTUNREACH;
+    }
+    iovec iovs[GSO_MAX_SEGMENTS];
+    for(std::size_t i = 0; i < count; i++)
+    {
+        iovs[i] = { const_cast<char *>(dgrams[i].data), dgrams[i].len };
+    }
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))];
+    msghdr msg = {};
+    msg.msg_name = &sa;
+    msg.msg_namelen = sizeof(sa);
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = count;
+    set_segment_size(msg, control, dgrams[0].len);
+    if(sendmsg(send_fd, &msg, 0) >= 0)
+    {
+        return count;
+    }
+    if(gso_unsupported(errno))
+    {
+        // no segmentation offload on this kernel or route, don't try again
+        std::cerr << "UDP_SEGMENT isn't supported here, falling back to sendmmsg. errno: " << errno << std::endl;
+        gso = false;
+        return send_batch(dgrams, count, to);
+    }
+    return -errno;
+}
+
+auto UdpTransport::send_batch(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int
+{
+    // sendmmsg takes one destination per message, so the addresses need somewhere to live
+    thread_local std::vector<mmsghdr> msgs;
+    thread_local std::vector<iovec> iovs;
+    thread_local std::vector<sockaddr_in6> addrs;
+    msgs.resize(count);
+    iovs.resize(count);
+    addrs.resize(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(!destination(dgrams[i], to, addrs[i]))
+        {
+            if(i == 0)
+            {
+                return -EHOSTUNREACH;
+            }
+            // the unknown peer fails the next call
+            count = i;
+            break;
+        }
+        iovs[i] = { const_cast<char *>(dgrams[i].data), dgrams[i].len };
+        msgs[i].msg_hdr = {};
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent;
+    if((sent = sendmmsg(send_fd, msgs.data(), count, 0)) < 0)
+    {
+        return -errno;
+    }
+    return sent;
+}
+
+auto UdpTransport::send_uring(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int
+{
+    std::lock_guard<std::mutex> lock(send_ring_mutex);
+    send_ops.resize(opts.batch_depth);
+    send_iovs.resize(count);
+    std::size_t sent = 0;
+    while(sent < count)
+    {
+        // one sendmsg per segmentable run or single datagram, linked so they go out in order
+        // and a failure cancels the rest
+        std::size_t ops = 0;
+        io_uring_sqe *prev = nullptr;
+        for(std::size_t i = sent; i < count && ops < opts.batch_depth; ops++)
+        {
+            sockaddr_in6 sa;
+            if(!destination(dgrams[i], to, sa))
+            {
+                if(ops == 0)
+                {
+                    return sent > 0 ? sent : -EHOSTUNREACH;
+                }
+                break;
+            }
+            io_uring_sqe *sqe;
+            if(!(sqe = send_ring->get_sqe()))
+            {
+                // the ring is full, whatever is queued goes first
+                if(ops == 0)
+                {
+                    return sent > 0 ? sent : -EBUSY;
+                }
+                break;
+            }
+            send_op &op = send_ops[ops];
+            op.count = segment_run(dgrams + i, count - i);
+            op.addr = sa;
+            op.msg = {};
+            op.msg.msg_name = &op.addr;
+            op.msg.msg_namelen = sizeof(op.addr);
+            op.msg.msg_iov = &send_iovs[i];
+            op.msg.msg_iovlen = op.count;
+            for(std::size_t j = 0; j < op.count; j++)
+            {
+                send_iovs[i + j] = { const_cast<char *>(dgrams[i + j].data), dgrams[i + j].len };
+            }
+            if(op.count > 1)
+            {
+                set_segment_size(op.msg, op.control, dgrams[i].len);
+            }
+            op.result = -ECANCELED;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = send_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&op.msg);
+            sqe->len = 1;
+            sqe->user_data = ops;
+            if(prev)
+            {
+                prev->flags |= IOSQE_IO_LINK;
+            }
+            prev = sqe;
+            i += op.count;
+        }
+        int err;
+        if((err = send_ring->submit(ops)) < 0)
+        {
+            return sent > 0 ? sent : err;
+        }
+        for(std::size_t reaped = 0; reaped < ops;)
+        {
+            io_uring_cqe *cqe;
+            if(!(cqe = send_ring->peek_cqe()))
+            {
+                send_ring->submit(1);
+                continue;
+            }
+            send_ops[cqe->user_data].result = cqe->res;
+            send_ring->cqe_seen();
+            reaped++;
+        }
+        for(std::size_t i = 0; i < ops; i++)
+        {
+            if(send_ops[i].result < 0)
+            {
+                if(send_ops[i].count > 1 && gso_unsupported(-send_ops[i].result))
+                {
+                    std::cerr << "UDP_SEGMENT isn't supported here, sending every datagram on its own. errno: " << -send_ops[i].result << std::endl;
+                    gso = false;
+                    break;
+                }
+                return sent > 0 ? sent : send_ops[i].result;
+            }
+            sent += send_ops[i].count;
+        }
+    }
+    return sent;
+}
+
+} // namespace standby_network
\ No newline at end of file
@@ -0,0 +1,168 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _UDP_TRANSPORT_H_
+#define _UDP_TRANSPORT_H_
+
+#include <bits/stdint-uintn.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <transport.h>
+#include <uring.h>
+
+namespace standby_network
+{
+
+enum class UdpEngine
+{
+    // recvmmsg/sendmmsg, parked in poll
+    mmsg,
+    // a multishot recvmsg into kernel provided buffers per endpoint, sends submitted as linked
+    // batches of sendmsg. Falls back to mmsg where io_uring isn't available
+    io_uring
+};
+
+struct UdpOptions
+{
+    UdpEngine engine = UdpEngine::mmsg;
+    // Most datagrams moved per recvmmsg/sendmmsg call
+    std::size_t batch_depth = 64;
+    // Runs of equally sized datagrams to the same peer (the fragments of a message) are handed to
+    // the kernel as one buffer and split there (UDP_SEGMENT). Turns itself off where unsupported
+    bool gso = true;
+    // The kernel may merge datagrams of a flow into one receive (UDP_GRO), the endpoint splits them
+    // again, at the cost of copying them out of its own receive buffers
+    bool gro = true;
+    // SO_RCVBUF and SO_SNDBUF of every socket (the kernel caps them at net.core.[rw]mem_max), the
+    // default is too small to absorb the burst of a fragmented message
+    int socket_buffer = 4 * 1024 * 1024;
+    // io_uring engine: receive buffers per endpoint, each holds one datagram of up to 16 KiB.
+    // UDP_GRO isn't used with this engine
+    unsigned uring_buffers = 256;
+};
+
+/**
+ * Datagrams over plain kernel UDP sockets, for peers that share a LAN or a host and don't need
+ * the overlay. Node ids are mapped to IP addresses (IPv4 or IPv6) by a fixed address book, every
+ * node listens on the same ports, just like on a ZeroTier network. The local node binds the
+ * address the book lists for it, so several nodes can share a host on distinct loopback
+ * addresses (127.0.0.2, 127.0.0.3, ...).
+ *
+ * Datagrams are received with recvmmsg and sent with sendmmsg, batch_depth at a time, or
+ * through io_uring, see UdpEngine.
+ */
+class UdpTransport : public Transport
+{
+public:
+    UdpTransport(uint64_t node_id, const std::unordered_map<uint64_t, std::string> &addresses, const UdpOptions &options = UdpOptions());
+    UdpTransport(const UdpTransport &) = delete;
+    ~UdpTransport() override;
+
+public:
+    auto operator=(const UdpTransport &) -> const UdpTransport & = delete;
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override;
+    // count sockets in one SO_REUSEPORT group
+    auto bind_shared(int port, std::size_t count) -> std::vector<std::unique_ptr<Endpoint>> override;
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override;
+    auto send_many(const outgoing *dgrams, std::size_t count) -> int override;
+    // The route keeps the peer's socket address and sends from the transport's socket, so the
+    // receiver sees it coming from the same place as the datagrams of send()
+    auto resolve(uint64_t node_id, int port) -> std::unique_ptr<Route> override;
+    auto node_id() const -> uint64_t override;
+    // Datagrams dropped because they were longer than the receive buffer
+    auto truncated() const -> uint64_t;
+
+private:
+    struct addr_key
+    {
+        uint64_t hi;
+        uint64_t lo;
+
+        auto operator==(const addr_key &other) const -> bool { return hi == other.hi && lo == other.lo; }
+    };
+
+    struct addr_hash
+    {
+        auto operator()(const addr_key &key) const -> std::size_t { return key.hi * 0x9e3779b97f4a7c15ULL ^ key.lo; }
+    };
+
+    friend class UdpEndpoint;
+    friend class UringUdpEndpoint;
+    friend class UdpRoute;
+
+    auto bind_endpoint(int port, bool reuse_port) -> std::unique_ptr<Endpoint>;
+    static auto key_of(const in6_addr &addr) -> addr_key;
+    // 0 if the address isn't in the address book
+    auto lookup(const in6_addr &addr) const -> uint64_t;
+    // counts a datagram the endpoints drop for not fitting in cap bytes
+    auto drop_truncated(std::size_t cap) const -> void;
+    // Socket address of d, to if there is one (all of a Route's datagrams go to the same place),
+    // otherwise the address book's. False if d's node isn't in it
+    auto destination(const outgoing &d, const sockaddr_in6 *to, sockaddr_in6 &sa) const -> bool;
+    // send_many, to the address of the book or to
+    auto send_many(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int;
+    // length of the run from dgrams[0] on the kernel can send as one segmented buffer
+    auto segment_run(const outgoing *dgrams, std::size_t count) const -> std::size_t;
+    // sends dgrams[0, count), all to the same peer and split by the kernel, returns how many went out
+    auto send_segmented(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int;
+    auto send_batch(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int;
+    auto send_uring(const outgoing *dgrams, std::size_t count, const sockaddr_in6 *to) -> int;
+
+private:
+    const uint64_t NODE_ID;
+    UdpOptions opts;
+    std::atomic<bool> gso;
+    // IPv4 addresses are kept v4-mapped, all sockets are dual stack
+    in6_addr local_addr = in6addr_any;
+    std::unordered_map<uint64_t, in6_addr> nodes;
+    std::unordered_map<addr_key, uint64_t, addr_hash> node_ids;
+    int send_fd = -1;
+    mutable std::atomic<uint64_t> truncated_dgrams{0};
+
+    // io_uring engine only
+    std::mutex send_ring_mutex;
+    std::unique_ptr<Uring> send_ring;
+    struct send_op
+    {
+        msghdr msg;
+        sockaddr_in6 addr;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))];
+        std::size_t count;
+        int result;
+    };
+    std::vector<send_op> send_ops;
+    std::vector<iovec> send_iovs;
+};
+
+} // namespace standby_network
+
+#endif // _UDP_TRANSPORT_H_
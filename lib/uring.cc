@@ -0,0 +1,296 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <uring.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+auto uring_setup(unsigned entries, io_uring_params *params) -> int
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+auto uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, std::size_t arg_size) -> int
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+auto uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) -> int
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template<typename T>
+auto offset_ptr(void *base, uint32_t offset) -> T *
+{
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+Uring::Uring(unsigned entries, unsigned cq_entries)
+{
+    if(cq_entries > 0)
+    {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+    }
+    if((fd = uring_setup(entries, &params)) < 0)
+    {
+        return;
+    }
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED)
+    {
+        sq_ring = nullptr;
+        close(fd);
+        fd = -1;
+        return;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_ring = sq_ring;
+    }
+    else if((cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        cq_ring = nullptr;
+        close(fd);
+        fd = -1;
+        return;
+    }
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if(sqes == MAP_FAILED)
+    {
+        sqes = nullptr;
+        close(fd);
+        fd = -1;
+        return;
+    }
+
+    sq_head = offset_ptr<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = offset_ptr<unsigned>(sq_ring, params.sq_off.tail);
+    sq_array = offset_ptr<unsigned>(sq_ring, params.sq_off.array);
+    sq_mask = *offset_ptr<unsigned>(sq_ring, params.sq_off.ring_mask);
+    cq_head = offset_ptr<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = offset_ptr<unsigned>(cq_ring, params.cq_off.tail);
+    cqes = offset_ptr<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    cq_mask = *offset_ptr<unsigned>(cq_ring, params.cq_off.ring_mask);
+    sqe_tail = *sq_tail;
+}
+
+Uring::~Uring()
+{
+    // closing the ring cancels whatever is still in flight, after that the buffers can go
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    if(sqes)
+    {
+        munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+    }
+    if(cq_ring && cq_ring != sq_ring)
+    {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if(sq_ring)
+    {
+        munmap(sq_ring, sq_ring_size);
+    }
+    if(buf_ring)
+    {
+        munmap(buf_ring, buf_ring_size);
+    }
+    if(bufs)
+    {
+        munmap(bufs, bufs_size);
+    }
+}
+
+auto Uring::ok() const -> bool
+{
+    return fd >= 0;
+}
+
+auto Uring::get_sqe() -> io_uring_sqe *
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(sqe_tail - head >= params.sq_entries)
+    {
+        return nullptr;
+    }
+    unsigned index = sqe_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sqe_tail++;
+    return sqe;
+}
+
+auto Uring::submit(unsigned wait_nr, std::chrono::milliseconds timeout) -> int
+{
+    flush_recycled();
+    unsigned to_submit = sqe_tail - *sq_tail;
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    if(to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg = {};
+    void *argp = nullptr;
+    std::size_t arg_size = 0;
+    if(wait_nr > 0 && timeout.count() >= 0)
+    {
+        ts.tv_sec = timeout.count() / 1000;
+        ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        argp = &arg;
+        arg_size = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int ret;
+    if((ret = uring_enter(fd, to_submit, wait_nr, flags, argp, arg_size)) < 0)
+    {
+        // a timeout or signal with nothing completed isn't an error for the caller
+        return (errno == ETIME || errno == EINTR) ? 0 : -errno;
+    }
+    return ret;
+}
+
+auto Uring::peek_cqe() -> io_uring_cqe *
+{
+    unsigned head = *cq_head;
+    if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    return &cqes[head & cq_mask];
+}
+
+auto Uring::cqe_seen() -> void
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+auto Uring::setup_buffers(uint16_t group, unsigned count, std::size_t size) -> bool
+{
+    // the kernel wants a power of two entries, at most 32768
+    unsigned entries = 1;
+    while(entries < count)
+    {
+        entries <<= 1;
+    }
+    if(count == 0 || entries > 32768)
+    {
+        return false;
+    }
+    bufs_size = count * size;
+    void *mem = mmap(nullptr, bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        bufs_size = 0;
+        return false;
+    }
+    bufs = static_cast<char *>(mem);
+    buf_size = size;
+
+    // the ring has to be page aligned, which mmap gives us
+    buf_ring_size = entries * sizeof(io_uring_buf);
+    mem = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        buf_ring_size = 0;
+        return false;
+    }
+    buf_ring = static_cast<io_uring_buf *>(mem);
+    buf_ring_mask = entries - 1;
+
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    // a kernel without provided buffer rings is found out here
+    if(uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = nullptr;
+        buf_ring_size = 0;
+        return false;
+    }
+    for(unsigned id = 0; id < count; id++)
+    {
+        recycle_buffer(id);
+    }
+    flush_recycled();
+    return true;
+}
+
+auto Uring::buffer(uint16_t id) -> char *
+{
+    return bufs + id * buf_size;
+}
+
+auto Uring::recycle_buffer(uint16_t id) -> void
+{
+    // the fields one by one, the tail shares its slot with the resv of the first entry
+    io_uring_buf *buf = &buf_ring[(buf_ring_tail + recycled_count) & buf_ring_mask];
+    buf->addr = reinterpret_cast<uint64_t>(buffer(id));
+    buf->len = buf_size;
+    buf->bid = id;
+    recycled_count++;
+}
+
+auto Uring::flush_recycled() -> void
+{
+    if(recycled_count == 0)
+    {
+        return;
+    }
+    buf_ring_tail += recycled_count;
+    // the entries must be visible before the kernel sees the tail move over them
+    __atomic_store_n(&buf_ring[0].resv, buf_ring_tail, __ATOMIC_RELEASE);
+    recycled_count = 0;
+}
+
+} // namespace standby_network
\ No newline at end of file
@@ -0,0 +1,110 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <bits/stdint-uintn.h>
+#include <chrono>
+#include <cstddef>
+
+#include <linux/io_uring.h>
+
+namespace standby_network
+{
+
+/**
+ * The little of io_uring the kernel UDP transport needs, straight on top of the syscalls:
+ * a submission and a completion queue, plus one provided buffer ring (IORING_REGISTER_PBUF_RING)
+ * for multishot receives. Buffers go back to the kernel by publishing the ring's tail, no
+ * submission needed. Not thread safe, every user has its own ring.
+ */
+class Uring
+{
+public:
+    // entries is rounded up to a power of two by the kernel, cq_entries defaults to twice that.
+    // Check ok() afterwards
+    Uring(unsigned entries, unsigned cq_entries = 0);
+    Uring(const Uring &) = delete;
+    ~Uring();
+
+public:
+    auto operator=(const Uring &) -> const Uring & = delete;
+
+public:
+    auto ok() const -> bool;
+    // A zeroed submission entry, nullptr if the queue is full
+    auto get_sqe() -> io_uring_sqe *;
+    // Submits the entries got since the last call and waits for wait_nr completions,
+    // at most timeout if it isn't negative. Returns the number submitted or a negative error
+    auto submit(unsigned wait_nr = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)) -> int;
+    // The oldest unseen completion, nullptr if there is none
+    auto peek_cqe() -> io_uring_cqe *;
+    auto cqe_seen() -> void;
+
+    // Registers a buffer ring of count buffers of size bytes as buffer group group
+    auto setup_buffers(uint16_t group, unsigned count, std::size_t size) -> bool;
+    auto buffer(uint16_t id) -> char *;
+    // Hands buffer id back to the kernel once its data was consumed, with the next submit
+    auto recycle_buffer(uint16_t id) -> void;
+
+private:
+    // publishes the recycled buffers to the kernel
+    auto flush_recycled() -> void;
+
+private:
+    int fd = -1;
+    io_uring_params params = {};
+
+    void *sq_ring = nullptr;
+    std::size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    std::size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    io_uring_cqe *cqes;
+    unsigned cq_mask;
+    // entries got by get_sqe, only published to the kernel by submit
+    unsigned sqe_tail = 0;
+
+    char *bufs = nullptr;
+    std::size_t bufs_size = 0;
+    std::size_t buf_size = 0;
+    // the ring as plain entries, the tail is the resv of the first one. Not io_uring_buf_ring,
+    // its flexible array sits 8 bytes in when the header is compiled as C++
+    io_uring_buf *buf_ring = nullptr;
+    std::size_t buf_ring_size = 0;
+    unsigned buf_ring_mask = 0;
+    // the tail the kernel knows, recycled buffers are added behind it until flush_recycled
+    uint16_t buf_ring_tail = 0;
+    unsigned recycled_count = 0;
+};
+
+} // namespace standby_network
+
+#endif // _URING_H_
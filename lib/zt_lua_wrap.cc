@@ -22,6 +22,9 @@ SOFTWARE. */
 
 #include <zt_lua_wrap.h>
 
+#include <cstring>
+#include <new>
+
 #include <lua.hpp>
 
 namespace standby_network
@@ -29,18 +32,55 @@ namespace standby_network
 
 //--------------------------------------------------------------helpers-----------------------------------------------------------------
 
+// "control", "interactive" or "bulk", false for anything else
+auto lua_to_priority(lua_State *l, int index, UdpPriority &priority) -> bool
+{
+    const char *names[] = { "control", "interactive", "bulk" };
+    if(lua_type(l, index) != LUA_TSTRING)
+    {
+        return false;
+    }
+    for(std::size_t p = 0; p < UDP_PRIORITIES; p++)
+    {
+        if(std::strcmp(lua_tostring(l, index), names[p]) == 0)
+        {
+            priority = static_cast<UdpPriority>(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+// udp_send(node_id[, channel], msg[, priority]): priority is "control", "interactive" (the default) or "bulk".
+// A nil channel is channel 0, so udp_send(node_id, nil, msg, "control") gives a priority without one
 auto udp_send(lua_State *l) -> int
 {
-    if(lua_isinteger(l, -2))
+    const bool has_channel = lua_gettop(l) >= 3;
+    UdpPriority priority = UdpPriority::interactive;
+    if(lua_gettop(l) >= 4 && !lua_isnil(l, 4) && !lua_to_priority(l, 4, priority))
     {
-        if(lua_isstring(l, -1))
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The priority must be \"control\", \"interactive\" or \"bulk\"");
+        return 2;
+    }
+    if(has_channel && !lua_isnil(l, 2) && !(lua_isinteger(l, 2) && lua_tointeger(l, 2) >= 0 && lua_tointeger(l, 2) < UDP_CHANNELS))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The channel must be an integer in [0, 255]");
+        return 2;
+    }
+    if(lua_isinteger(l, 1))
+    {
+        if(lua_isstring(l, has_channel ? 3 : 2))
         {
             CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
-            uint64_t node_id = lua_tointeger(l, -2);
-            const char *msg = lua_tostring(l, -1);
+            uint64_t node_id = lua_tointeger(l, 1);
+            uint8_t channel = has_channel ? lua_tointeger(l, 2) : 0;
+            std::size_t len;
+            const char *msg = lua_tolstring(l, has_channel ? 3 : 2, &len);
 
             int err;
-            if((err = c->udp_send(node_id, msg)) >= 0)
+            if((err = c->udp_send(node_id, channel, std::string_view(msg, len), priority)) >= 0)
             {
                 lua_pushinteger(l, err);
                 return 1;
@@ -57,7 +97,7 @@ auto udp_send(lua_State *l) -> int
         {
             /* not a string */
             lua_pushinteger(l, -1);
-            lua_pushstring(l, "The second argument must be a string");
+            lua_pushstring(l, "The message must be a string");
             return 2;
         }
     }
@@ -70,18 +110,226 @@ auto udp_send(lua_State *l) -> int
     }
 }
 
+// Reads the optional [channel[, priority]] arguments of the batch functions starting at index, pushes the error if they're wrong.
+// nil stands for the default of either
+auto lua_to_channel_priority(lua_State *l, int index, uint8_t &channel, UdpPriority &priority) -> bool
+{
+    channel = 0;
+    priority = UdpPriority::interactive;
+    if(lua_gettop(l) >= index && !lua_isnil(l, index))
+    {
+        if(!(lua_isinteger(l, index) && lua_tointeger(l, index) >= 0 && lua_tointeger(l, index) < UDP_CHANNELS))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The channel must be an integer in [0, 255]");
+            return false;
+        }
+        channel = lua_tointeger(l, index);
+    }
+    if(lua_gettop(l) > index && !lua_isnil(l, index + 1) && !lua_to_priority(l, index + 1, priority))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The priority must be \"control\", \"interactive\" or \"bulk\"");
+        return false;
+    }
+    return true;
+}
+
+// Sends the batch collected by udp_send_many/udp_send_multi with a single CommLayer call.
+// In async mode it pushes the table of the queued messages' tickets instead of their number
+auto lua_send_batch(lua_State *l, CommLayer *c, const std::vector<outgoing_msg> &batch) -> int
+{
+    static thread_local std::vector<int> tickets;
+    tickets.clear();
+    int err = 0;
+    if(batch.empty() || (err = c->udp_send_many(batch.data(), batch.size(), &tickets)) >= 0)
+    {
+        if(!c->async_send())
+        {
+            lua_pushinteger(l, err);
+            return 1;
+        }
+        lua_createtable(l, static_cast<int>(tickets.size()), 0);
+        for(std::size_t i = 0; i < tickets.size(); i++)
+        {
+            lua_pushinteger(l, tickets[i]);
+            lua_rawseti(l, -2, static_cast<lua_Integer>(i + 1));
+        }
+        return 1;
+    }
+    lua_pushinteger(l, err);
+    lua_pushstring(l, "Couldn't send the data");
+    return 2;
+}
+
+// udp_send_many(node_id, {msg, ...}[, channel[, priority]]) -> number of messages sent ({ticket, ...} in async mode)
+auto udp_send_many(lua_State *l) -> int
+{
+    if(!lua_isinteger(l, 1) || !lua_istable(l, 2))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The arguments must be an integer and a table of strings");
+        return 2;
+    }
+    uint8_t channel;
+    UdpPriority priority;
+    if(!lua_to_channel_priority(l, 3, channel, priority))
+    {
+        return 2;
+    }
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    const uint64_t node_id = lua_tointeger(l, 1);
+    // the strings stay referenced by the table (on the stack) until the batch is sent
+    static thread_local std::vector<outgoing_msg> batch;
+    batch.clear();
+    const lua_Integer n = luaL_len(l, 2);
+    for(lua_Integer i = 1; i <= n; i++)
+    {
+        if(lua_rawgeti(l, 2, i) != LUA_TSTRING)
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The messages must be strings");
+            return 2;
+        }
+        std::size_t len;
+        const char *msg = lua_tolstring(l, -1, &len);
+        batch.push_back({ node_id, channel, priority, std::string_view(msg, len) });
+        lua_pop(l, 1);
+    }
+    return lua_send_batch(l, c, batch);
+}
+
+// udp_send_multi({[node_id] = msg, ...}[, channel[, priority]]) -> number of messages sent ({ticket, ...} in async mode)
+auto udp_send_multi(lua_State *l) -> int
+{
+    if(!lua_istable(l, 1))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The argument must be a table of node ids to strings");
+        return 2;
+    }
+    uint8_t channel;
+    UdpPriority priority;
+    if(!lua_to_channel_priority(l, 2, channel, priority))
+    {
+        return 2;
+    }
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    static thread_local std::vector<outgoing_msg> batch;
+    batch.clear();
+    lua_pushnil(l);
+    while(lua_next(l, 1))
+    {
+        if(!lua_isinteger(l, -2) || lua_type(l, -1) != LUA_TSTRING)
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The table must map integer node ids to strings");
+            return 2;
+        }
+        std::size_t len;
+        const char *msg = lua_tolstring(l, -1, &len);
+        batch.push_back({ static_cast<uint64_t>(lua_tointeger(l, -2)), channel, priority, std::string_view(msg, len) });
+        lua_pop(l, 1);
+    }
+    return lua_send_batch(l, c, batch);
+}
+
+// udp_recv_many(node_id, max[, out[, channel]]) -> out, count: fills out[1..count] (a new table
+// if no out is given) and clears the entries after them, so a script can reuse one table
+auto udp_recv_many(lua_State *l) -> int
+{
+    if(!lua_isinteger(l, 1) || !lua_isinteger(l, 2))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The node id and the maximum must be integers");
+        return 2;
+    }
+    const bool reuse = lua_gettop(l) >= 3 && !lua_isnil(l, 3);
+    if(reuse && !lua_istable(l, 3))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The third argument must be a table");
+        return 2;
+    }
+    uint8_t channel = 0;
+    if(lua_gettop(l) >= 4)
+    {
+        if(!(lua_isinteger(l, 4) && lua_tointeger(l, 4) >= 0 && lua_tointeger(l, 4) < UDP_CHANNELS))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The channel must be an integer in [0, 255]");
+            return 2;
+        }
+        channel = lua_tointeger(l, 4);
+    }
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    static thread_local std::vector<MsgRef> msgs;
+    msgs.clear();
+    c->udp_recv_many(lua_tointeger(l, 1), channel, std::max<lua_Integer>(lua_tointeger(l, 2), 0), msgs);
+
+    if(reuse)
+    {
+        lua_pushvalue(l, 3);
+    }
+    else
+    {
+        lua_createtable(l, msgs.size(), 0);
+    }
+    for(std::size_t i = 0; i < msgs.size(); i++)
+    {
+        lua_pushlstring(l, msgs[i].data(), msgs[i].size());
+        lua_rawseti(l, -2, i + 1);
+    }
+    if(reuse)
+    {
+        for(lua_Integer i = msgs.size() + 1; lua_rawgeti(l, -1, i) != LUA_TNIL; i++)
+        {
+            lua_pop(l, 1);
+            lua_pushnil(l);
+            lua_rawseti(l, -2, i);
+        }
+        lua_pop(l, 1);
+    }
+    lua_pushinteger(l, msgs.size());
+    // the buffers go back to their pool now rather than on the next call, all at once
+    BufferPool::release(msgs);
+    return 2;
+}
+
+// udp_recv(node_id[, timeout_ms[, channel]]): without a timeout it doesn't block, a negative timeout waits forever
 auto udp_recv(lua_State *l) -> int
 {
-    if(lua_isinteger(l, -1))
+    if(lua_isinteger(l, 1))
     {
         CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
-        uint64_t node_id = lua_tointeger(l, -1);
-        
-        std::optional<std::string> msg = c->udp_recv(node_id);
-        if(static_cast<bool>(msg))
+        uint64_t node_id = lua_tointeger(l, 1);
+        std::chrono::milliseconds timeout(0);
+        uint8_t channel = 0;
+        if(lua_gettop(l) >= 2)
         {
-            std::string s = msg.value();
-            lua_pushstring(l, s.c_str());
+            if(!lua_isinteger(l, 2))
+            {
+                lua_pushinteger(l, -1);
+                lua_pushstring(l, "The timeout must be an integer");
+                return 2;
+            }
+            timeout = std::chrono::milliseconds(lua_tointeger(l, 2));
+        }
+        if(lua_gettop(l) >= 3)
+        {
+            if(!(lua_isinteger(l, 3) && lua_tointeger(l, 3) >= 0 && lua_tointeger(l, 3) < UDP_CHANNELS))
+            {
+                lua_pushinteger(l, -1);
+                lua_pushstring(l, "The channel must be an integer in [0, 255]");
+                return 2;
+            }
+            channel = lua_tointeger(l, 3);
+        }
+
+        MsgRef msg = c->udp_recv_buf(node_id, channel, timeout);
+        if(msg)
+        {
+            lua_pushlstring(l, msg.data(), msg.size());
             return 1;
         }
         return 0;
@@ -94,20 +342,347 @@ auto udp_recv(lua_State *l) -> int
     }
 }
 
-auto rudp_send(lua_State *l) -> int
+// udp_recv_any([timeout_ms]) -> node_id, msg, channel: the next message of any peer and channel
+auto udp_recv_any(lua_State *l) -> int
 {
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    std::chrono::milliseconds timeout(0);
+    if(lua_gettop(l) >= 1)
+    {
+        if(!lua_isinteger(l, 1))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The timeout must be an integer");
+            return 2;
+        }
+        timeout = std::chrono::milliseconds(lua_tointeger(l, 1));
+    }
+
+    uint64_t node_id;
+    uint8_t channel;
+    MsgRef msg = c->udp_recv_any_buf(node_id, channel, timeout);
+    if(msg)
+    {
+        lua_pushinteger(l, node_id);
+        lua_pushlstring(l, msg.data(), msg.size());
+        lua_pushinteger(l, channel);
+        return 3;
+    }
     return 0;
 }
 
-auto rudp_recv(lua_State *l) -> int
+// udp_coalesce(node_id, enable): pack small messages to node_id into shared datagrams
+auto udp_coalesce(lua_State *l) -> int
+{
+    if(lua_isinteger(l, 1))
+    {
+        CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+        c->udp_coalesce(lua_tointeger(l, 1), lua_toboolean(l, 2));
+        return 0;
+    }
+    else
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The first argument must be an integer");
+        return 2;
+    }
+}
+
+// udp_flush([node_id]): send the pending coalesced messages of one peer, or of all of them
+auto udp_flush(lua_State *l) -> int
+{
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    int err;
+    if(lua_gettop(l) >= 1)
+    {
+        if(!lua_isinteger(l, 1))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The argument must be an integer");
+            return 2;
+        }
+        err = c->udp_flush(lua_tointeger(l, 1));
+    }
+    else
+    {
+        err = c->udp_flush();
+    }
+    lua_pushinteger(l, err);
+    if(err != 0)
+    {
+        lua_pushstring(l, "Couldn't send the data");
+        return 2;
+    }
+    return 1;
+}
+
+// udp_completions([max]) -> {{ticket=, node=, channel=, result=}, ...}: results of the async mode sends, oldest first
+auto udp_completions(lua_State *l) -> int
+{
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    std::size_t max = SIZE_MAX;
+    if(lua_gettop(l) >= 1)
+    {
+        if(!lua_isinteger(l, 1))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The argument must be an integer");
+            return 2;
+        }
+        max = std::max<lua_Integer>(lua_tointeger(l, 1), 0);
+    }
+
+    std::vector<send_completion> done = c->udp_completions(max);
+    lua_createtable(l, done.size(), 0);
+    for(std::size_t i = 0; i < done.size(); i++)
+    {
+        lua_createtable(l, 0, 4);
+        lua_pushinteger(l, done[i].ticket);
+        lua_setfield(l, -2, "ticket");
+        lua_pushinteger(l, done[i].node_id);
+        lua_setfield(l, -2, "node");
+        lua_pushinteger(l, done[i].channel);
+        lua_setfield(l, -2, "channel");
+        lua_pushinteger(l, done[i].result);
+        lua_setfield(l, -2, "result");
+        lua_rawseti(l, -2, i + 1);
+    }
+    return 1;
+}
+
+// The handle at index, nullptr if it isn't one. The udp_peer functions get the metatable all
+// handles share as their upvalue, so this is a pointer comparison rather than a registry lookup
+auto lua_to_peer(lua_State *l, int index) -> UdpPeer *
+{
+    UdpPeer *peer = static_cast<UdpPeer *>(lua_touserdata(l, index));
+    if(!peer || !lua_getmetatable(l, index))
+    {
+        return nullptr;
+    }
+    const bool is_peer = lua_rawequal(l, -1, lua_upvalueindex(1));
+    lua_pop(l, 1);
+    return is_peer ? peer : nullptr;
+}
+
+// udp_peer(node_id) -> handle with :send(msg[, channel[, priority]]), :recv([timeout_ms[, channel]]),
+// :stats() and :close(), which skip the per-call lookups of udp_send/udp_recv (see UdpPeer)
+auto udp_peer(lua_State *l) -> int
+{
+    if(!lua_isinteger(l, 1))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The argument must be an integer");
+        return 2;
+    }
+    CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+    new (lua_newuserdata(l, sizeof(UdpPeer))) UdpPeer(c->udp_peer(lua_tointeger(l, 1)));
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_setmetatable(l, -2);
+    return 1;
+}
+
+// peer:send(msg[, channel[, priority]]), same results as udp_send
+auto udp_peer_send(lua_State *l) -> int
+{
+    UdpPeer *peer = lua_to_peer(l, 1);
+    if(!peer || !lua_isstring(l, 2))
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The arguments must be a peer handle and a string");
+        return 2;
+    }
+    uint8_t channel;
+    UdpPriority priority;
+    if(!lua_to_channel_priority(l, 3, channel, priority))
+    {
+        return 2;
+    }
+    std::size_t len;
+    const char *msg = lua_tolstring(l, 2, &len);
+    int err;
+    if((err = peer->send(std::string_view(msg, len), channel, priority)) >= 0)
+    {
+        lua_pushinteger(l, err);
+        return 1;
+    }
+    lua_pushinteger(l, err);
+    lua_pushstring(l, peer->closed() ? "The peer handle is closed" : "Couldn't send the data");
+    return 2;
+}
+
+// peer:recv([timeout_ms[, channel]]), same results as udp_recv
+auto udp_peer_recv(lua_State *l) -> int
+{
+    UdpPeer *peer = lua_to_peer(l, 1);
+    if(!peer)
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The first argument must be a peer handle");
+        return 2;
+    }
+    std::chrono::milliseconds timeout(0);
+    uint8_t channel = 0;
+    if(lua_gettop(l) >= 2)
+    {
+        if(!lua_isinteger(l, 2))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The timeout must be an integer");
+            return 2;
+        }
+        timeout = std::chrono::milliseconds(lua_tointeger(l, 2));
+    }
+    if(lua_gettop(l) >= 3)
+    {
+        if(!(lua_isinteger(l, 3) && lua_tointeger(l, 3) >= 0 && lua_tointeger(l, 3) < UDP_CHANNELS))
+        {
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The channel must be an integer in [0, 255]");
+            return 2;
+        }
+        channel = lua_tointeger(l, 3);
+    }
+
+    MsgRef msg = timeout.count() == 0 ? peer->recv(channel) : peer->recv(channel, timeout);
+    if(msg)
+    {
+        lua_pushlstring(l, msg.data(), msg.size());
+        return 1;
+    }
+    return 0;
+}
+
+// peer:stats() -> {node=, sent_msgs=, sent_bytes=, send_errors=, recvd_msgs=, recvd_bytes=, queued_msgs=, queued_bytes=}
+auto udp_peer_stats(lua_State *l) -> int
+{
+    UdpPeer *peer = lua_to_peer(l, 1);
+    if(!peer)
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The first argument must be a peer handle");
+        return 2;
+    }
+    const peer_stats s = peer->stats();
+    lua_createtable(l, 0, 8);
+    lua_pushinteger(l, peer->node_id());
+    lua_setfield(l, -2, "node");
+    lua_pushinteger(l, s.sent_msgs);
+    lua_setfield(l, -2, "sent_msgs");
+    lua_pushinteger(l, s.sent_bytes);
+    lua_setfield(l, -2, "sent_bytes");
+    lua_pushinteger(l, s.send_errors);
+    lua_setfield(l, -2, "send_errors");
+    lua_pushinteger(l, s.recvd_msgs);
+    lua_setfield(l, -2, "recvd_msgs");
+    lua_pushinteger(l, s.recvd_bytes);
+    lua_setfield(l, -2, "recvd_bytes");
+    lua_pushinteger(l, s.queued_msgs);
+    lua_setfield(l, -2, "queued_msgs");
+    lua_pushinteger(l, s.queued_bytes);
+    lua_setfield(l, -2, "queued_bytes");
+    return 1;
+}
+
+// peer:close(): releases the handle's sockets right away instead of on garbage collection
+auto udp_peer_close(lua_State *l) -> int
 {
+    UdpPeer *peer = lua_to_peer(l, 1);
+    if(peer)
+    {
+        peer->close();
+    }
     return 0;
 }
 
+auto udp_peer_gc(lua_State *l) -> int
+{
+    UdpPeer *peer = lua_to_peer(l, 1);
+    if(peer)
+    {
+        peer->~UdpPeer();
+        // without its metatable the userdata is no handle anymore: a resurrected one can't reach
+        // the destroyed peer and a second __gc finds nothing to destroy
+        lua_pushnil(l);
+        lua_setmetatable(l, 1);
+    }
+    return 0;
+}
+
+auto rudp_send(lua_State *l) -> int
+{
+    if(lua_isinteger(l, -2))
+    {
+        if(lua_isstring(l, -1))
+        {
+            CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+            uint64_t node_id = lua_tointeger(l, -2);
+            std::size_t len;
+            const char *msg = lua_tolstring(l, -1, &len);
+
+            int err;
+            if((err = c->rudp_send(node_id, std::string_view(msg, len))) >= 0)
+            {
+                lua_pushinteger(l, err);
+                return 1;
+            }
+            else
+            {
+                /* couldn't queue it */
+                lua_pushinteger(l, err);
+                lua_pushstring(l, "Couldn't send the data");
+                return 2;
+            }
+        }
+        else
+        {
+            /* not a string */
+            lua_pushinteger(l, -1);
+            lua_pushstring(l, "The second argument must be a string");
+            return 2;
+        }
+    }
+    else
+    {
+        /* not an int */
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The first argument must be an integeer");
+        return 2;
+    }
+}
+
+auto rudp_recv(lua_State *l) -> int
+{
+    if(lua_isinteger(l, -1))
+    {
+        CommLayer *c = *static_cast<CommLayer **>(lua_getextraspace(l));
+        uint64_t node_id = lua_tointeger(l, -1);
+
+        MsgRef msg = c->rudp_recv_buf(node_id);
+        if(msg)
+        {
+            lua_pushlstring(l, msg.data(), msg.size());
+            return 1;
+        }
+        return 0;
+    }
+    else
+    {
+        lua_pushinteger(l, -1);
+        lua_pushstring(l, "The argument must be an integer");
+        return 2;
+    }
+}
+
 //--------------------------------------------------------------memebers----------------------------------------------------------------
 
-ZTLua::ZTLua(uint64_t nwid, int port) : 
-    c(nwid, port)
+ZTLua::ZTLua(uint64_t nwid, int port, const CommOptions &options) : 
+    c(nwid, port, options)
+{
+
+}
+
+ZTLua::ZTLua(std::shared_ptr<Transport> transport, int port, const CommOptions &options) : 
+    c(transport, port, options)
 {
 
 }
@@ -122,6 +697,42 @@ auto ZTLua::register_wrappers(lua_State *l) -> void
     lua_setglobal(l, "udp_send");
     lua_pushcfunction(l, udp_recv);
     lua_setglobal(l, "udp_recv");
+    lua_pushcfunction(l, udp_recv_any);
+    lua_setglobal(l, "udp_recv_any");
+    lua_pushcfunction(l, udp_send_many);
+    lua_setglobal(l, "udp_send_many");
+    lua_pushcfunction(l, udp_send_multi);
+    lua_setglobal(l, "udp_send_multi");
+    lua_pushcfunction(l, udp_recv_many);
+    lua_setglobal(l, "udp_recv_many");
+    lua_pushcfunction(l, udp_coalesce);
+    lua_setglobal(l, "udp_coalesce");
+    lua_pushcfunction(l, udp_flush);
+    lua_setglobal(l, "udp_flush");
+    lua_pushcfunction(l, udp_completions);
+    lua_setglobal(l, "udp_completions");
+    // one metatable for all the udp_peer handles, the functions get it as their upvalue. The
+    // methods live in a table of their own and __metatable hides the metatable, so scripts can
+    // neither reach __gc nor swap the metatable of a handle
+    const luaL_Reg peer_methods[] = {
+        { "send", udp_peer_send },
+        { "recv", udp_peer_recv },
+        { "stats", udp_peer_stats },
+        { "close", udp_peer_close },
+        { nullptr, nullptr }
+    };
+    luaL_newmetatable(l, "udp_peer");
+    lua_pushvalue(l, -1);
+    lua_pushcclosure(l, udp_peer_gc, 1);
+    lua_setfield(l, -2, "__gc");
+    lua_pushboolean(l, 0);
+    lua_setfield(l, -2, "__metatable");
+    lua_createtable(l, 0, 4);
+    lua_pushvalue(l, -2);
+    luaL_setfuncs(l, peer_methods, 1);
+    lua_setfield(l, -2, "__index");
+    lua_pushcclosure(l, udp_peer, 1);
+    lua_setglobal(l, "udp_peer");
     lua_pushcfunction(l, rudp_send);
     lua_setglobal(l, "rudp_send");
     lua_pushcfunction(l, rudp_recv);
@@ -33,14 +33,15 @@ namespace standby_network
 class ZTLua
 {
 public:
-    ZTLua(uint64_t nwid, int port = 9000);
+    ZTLua(uint64_t nwid, int port = 9000, const CommOptions &options = CommOptions());
+    ZTLua(std::shared_ptr<Transport> transport, int port = 9000, const CommOptions &options = CommOptions());
     ZTLua(const ZTLua &) = delete;
-    ZTLua(ZTLua &&move);
+    ZTLua(ZTLua &&) = delete;
     ~ZTLua();
 
 public:
     auto operator=(const ZTLua &) -> const ZTLua & = delete;
-    auto operator=(ZTLua &&move) -> const ZTLua &;
+    auto operator=(ZTLua &&) -> const ZTLua & = delete;
 
 public:
     auto register_wrappers(lua_State *l) -> void;
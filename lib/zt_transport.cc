@@ -0,0 +1,494 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <zt_transport.h>
+
+#include <iostream>
+#include <optional>
+
+namespace standby_network
+{
+
+//--------------------------------------------------------------helpers-----------------------------------------------------------------
+
+// Builds the RFC4193 address of a node: fd | nwid (8 bytes) | 99 93 | node id (5 bytes)
+auto node_addr(uint64_t nwid, uint64_t node_id, int port) -> zts_sockaddr_in6
+{
+    zts_sockaddr_in6 addr = {};
+    addr.sin6_len = sizeof(addr);
+    addr.sin6_family = ZTS_AF_INET6;
+    addr.sin6_port = zts_htons(port);
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&addr.sin6_addr);
+    bytes[0] = 0xfd;
+    for(int i = 0; i < 8; i++)
+    {
+        bytes[1 + i] = static_cast<uint8_t>(nwid >> (56 - 8 * i));
+    }
+    bytes[9] = 0x99;
+    bytes[10] = 0x93;
+    for(int i = 0; i < 5; i++)
+    {
+        bytes[11 + i] = static_cast<uint8_t>(node_id >> (32 - 8 * i));
+    }
+    return addr;
+}
+
+// Inverse of node_addr, nullopt if the address isn't an RFC4193 address of our network
+auto addr_to_node_id(uint64_t nwid, const zts_sockaddr_in6 &addr) -> std::optional<uint64_t>
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&addr.sin6_addr);
+    if(bytes[0] != 0xfd || bytes[9] != 0x99 || bytes[10] != 0x93)
+    {
+        return std::nullopt;
+    }
+    for(int i = 0; i < 8; i++)
+    {
+        if(bytes[1 + i] != static_cast<uint8_t>(nwid >> (56 - 8 * i)))
+        {
+            return std::nullopt;
+        }
+    }
+    uint64_t node_id = 0;
+    for(int i = 0; i < 5; i++)
+    {
+        node_id = (node_id << 8) | bytes[11 + i];
+    }
+    return node_id;
+}
+
+auto create_sock() -> int
+{
+    return zts_socket(ZTS_PF_INET6, ZTS_SOCK_DGRAM, 0);
+}
+
+auto create_bound_sock(int port) -> int
+{
+    int fd;
+    if((fd = create_sock()) < 0)
+    {
+        return fd;
+    }
+    zts_sockaddr_in6 addr = {};
+    addr.sin6_family = ZTS_AF_INET6;
+    addr.sin6_port = zts_htons(port);
+    int err;
+    if((err = zts_bind(fd, (const zts_sockaddr *)&addr, sizeof(addr))) < 0)
+    {
+        zts_close(fd);
+        return err;
+    }
+    return fd;
+}
+
+class ZtEndpoint : public Endpoint
+{
+public:
+    ZtEndpoint(const ZtTransport &transport, int port, int fd) :
+        transport(transport),
+        NWID(transport.nwid()),
+        PORT(port),
+        fd(fd)
+    {
+    }
+
+    ~ZtEndpoint() override
+    {
+        zts_close(fd);
+    }
+
+public:
+    auto recv(datagram *dgrams, std::size_t count) -> int override
+    {
+        std::size_t n = 0;
+        while(n < count)
+        {
+            int recvd;
+            zts_sockaddr_in6 recv_addr;
+            // one byte past the buffer tells a datagram that didn't fit from one that just filled it
+            char spare;
+            zts_iovec iov[2] = { { dgrams[n].data, dgrams[n].cap }, { &spare, 1 } };
+            zts_msghdr msg = {};
+            msg.msg_name = &recv_addr;
+            msg.msg_namelen = sizeof(recv_addr);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            if((recvd = zts_recvmsg(fd, &msg, 0)) < 0)
+            {
+                break;
+            }
+            auto node_id = addr_to_node_id(NWID, recv_addr);
+            if(!node_id)
+            {
+                std::cerr << "Dropping datagram from an address outside of our network" << std::endl;
+                continue;
+            }
+            if(static_cast<std::size_t>(recvd) > dgrams[n].cap)
+            {
+                transport.drop_truncated(dgrams[n].cap);
+                continue;
+            }
+            dgrams[n].len = recvd;
+            dgrams[n].node_id = node_id.value();
+            n++;
+        }
+        return n;
+    }
+
+    auto wait(std::chrono::milliseconds timeout) -> void override
+    {
+        zts_pollfd pfd = { fd, ZTS_POLLIN, 0 };
+        int err;
+        if((err = zts_poll(&pfd, 1, timeout.count())) < 0)
+        {
+            std::cerr << "Couldn't poll the listening socket: err: " << err << " zts_errno: " << zts_errno << std::endl;
+            zts_delay_ms(timeout.count());
+        }
+    }
+
+    auto wakeup() -> void override
+    {
+        // an empty datagram to ourselves makes the poll return right away, in the worst
+        // case the owner notices it should stop after its poll timeout
+        int wake_fd;
+        if((wake_fd = create_sock()) < 0)
+        {
+            return;
+        }
+        zts_sockaddr_in6 addr = node_addr(NWID, zts_get_node_id(), PORT);
+        zts_sendto(wake_fd, "", 0, 0, (const zts_sockaddr *)&addr, sizeof(addr));
+        zts_close(wake_fd);
+    }
+
+private:
+    const ZtTransport &transport;
+    const uint64_t NWID;
+    const int PORT;
+    int fd;
+};
+
+class ZtRoute : public Route
+{
+public:
+    ZtRoute(uint64_t nwid, uint64_t node_id, int port) :
+        NWID(nwid),
+        NODE_ID(node_id),
+        PORT(port)
+    {
+    }
+
+    ~ZtRoute() override
+    {
+        if(fd >= 0)
+        {
+            zts_close(fd);
+        }
+    }
+
+public:
+    auto send(const char *data, std::size_t len) -> int override
+    {
+        uint64_t current = ZtTransport::net_generation;
+        if(current != generation && fd >= 0)
+        {
+            // the network changed since we connected, the socket may point to the wrong place
+            zts_close(fd);
+            fd = -1;
+        }
+        if(fd < 0)
+        {
+            int err;
+            if((err = connect()) < 0)
+            {
+                std::cerr << "Couldn't create UDP socket. err: " << err << " zts_errno: " << zts_errno << std::endl;
+                return -zts_errno;
+            }
+            generation = current;
+        }
+        int err;
+        if((err = zts_send(fd, data, len, 0)) < 0)
+        {
+            err = -zts_errno;
+            // the socket may be in a broken state, the next send gets a fresh one
+            zts_close(fd);
+            fd = -1;
+        }
+        return err;
+    }
+
+private:
+    auto connect() -> int
+    {
+        int err;
+        if((err = create_bound_sock(0)) < 0)
+        {
+            return err;
+        }
+        fd = err;
+        zts_sockaddr_in6 addr = node_addr(NWID, NODE_ID, PORT);
+        if((err = zts_connect(fd, (const zts_sockaddr *)&addr, sizeof(addr))) < 0)
+        {
+            zts_close(fd);
+            fd = -1;
+        }
+        return err;
+    }
+
+private:
+    const uint64_t NWID;
+    const uint64_t NODE_ID;
+    const int PORT;
+    int fd = -1;
+    uint64_t generation = 0;
+};
+
+//--------------------------------------------------------------members-----------------------------------------------------------------
+
+std::atomic<uint64_t> ZtTransport::net_generation(0);
+
+ZtTransport::ZtTransport(uint64_t nwid, const ZtOptions &options) :
+    NWID(nwid),
+    opts(options)
+{
+}
+
+ZtTransport::~ZtTransport()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    close_peers();
+}
+
+auto ZtTransport::bind(int port) -> std::unique_ptr<Endpoint>
+{
+    int fd;
+    if((fd = create_bound_sock(port)) < 0)
+    {
+        std::cerr << "Couldn't bind port " << port << ": err: " << fd << " zts_errno: " << zts_errno << std::endl;
+        return nullptr;
+    }
+    int err;
+    if((err = zts_fcntl(fd, ZTS_F_SETFL, ZTS_O_NONBLOCK)) < 0)
+    {
+        std::cerr << "Couldn't set socket to be non blocking: err: " << err << " zts_errno: " << zts_errno << std::endl;
+        zts_close(fd);
+        return nullptr;
+    }
+    return std::make_unique<ZtEndpoint>(*this, port, fd);
+}
+
+auto ZtTransport::send(uint64_t node_id, int port, const char *data, std::size_t len) -> int
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    peer_entry *peer = peer_for(node_id, port);
+    int fd;
+    if((fd = send_sock_for(*peer)) < 0)
+    {
+        std::cerr << "Couldn't create UDP socket. err: " << fd << " zts_errno: " << zts_errno << std::endl;
+        return -zts_errno;
+    }
+    int err;
+    if(opts.per_peer_send_socks)
+    {
+        err = zts_send(fd, data, len, 0);
+    }
+    else
+    {
+        err = zts_sendto(fd, data, len, 0, (const zts_sockaddr *)&peer->addr, sizeof(peer->addr));
+    }
+    if(err < 0)
+    {
+        err = -zts_errno;
+        // the socket may be in a broken state, the next send gets a fresh one
+        drop_send_sock(*peer);
+    }
+    evict_peers(peer->last_used);
+    return err;
+}
+
+auto ZtTransport::resolve(uint64_t node_id, int port) -> std::unique_ptr<Route>
+{
+    return std::make_unique<ZtRoute>(NWID, node_id, port);
+}
+
+auto ZtTransport::node_id() const -> uint64_t
+{
+    return zts_get_node_id();
+}
+
+auto ZtTransport::nwid() const -> uint64_t
+{
+    return NWID;
+}
+
+auto ZtTransport::truncated() const -> uint64_t
+{
+    return truncated_dgrams.load(std::memory_order_relaxed);
+}
+
+auto ZtTransport::network_changed() -> void
+{
+    net_generation++;
+}
+
+auto ZtTransport::peer_for(uint64_t node_id, int port) -> peer_entry *
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t generation = net_generation;
+    const uint64_t key = node_id << 16 | static_cast<uint16_t>(port);
+    auto it = peers.find(key);
+    if(it != peers.end())
+    {
+        peer_entry &peer = it->second;
+        if(peer.generation != generation)
+        {
+            // the network changed since we resolved this peer, so a connected socket may point to the wrong place
+            if(peer.fd >= 0)
+            {
+                zts_close(peer.fd);
+                peer.fd = -1;
+            }
+            peer.addr = node_addr(NWID, node_id, port);
+            peer.generation = generation;
+        }
+        peer.last_used = now;
+        return &peer;
+    }
+
+    if(peers.size() >= opts.max_cached_peers && !peers.empty())
+    {
+        auto lru = peers.begin();
+        for(auto i = peers.begin(); i != peers.end(); i++)
+        {
+            if(i->second.last_used < lru->second.last_used)
+            {
+                lru = i;
+            }
+        }
+        if(lru->second.fd >= 0)
+        {
+            zts_close(lru->second.fd);
+        }
+        peers.erase(lru);
+    }
+
+    peer_entry &peer = peers[key];
+    peer = { node_addr(NWID, node_id, port), -1, generation, now };
+    return &peer;
+}
+
+auto ZtTransport::send_sock_for(peer_entry &peer) -> int
+{
+    if(!opts.per_peer_send_socks)
+    {
+        if(shared_send_fd < 0)
+        {
+            shared_send_fd = create_bound_sock(0);
+        }
+        return shared_send_fd;
+    }
+
+    if(peer.fd >= 0)
+    {
+        return peer.fd;
+    }
+    int fd;
+    if((fd = create_bound_sock(0)) < 0)
+    {
+        return fd;
+    }
+    int err;
+    if((err = zts_connect(fd, (const zts_sockaddr *)&peer.addr, sizeof(peer.addr))) < 0)
+    {
+        zts_close(fd);
+        return err;
+    }
+    peer.fd = fd;
+    return fd;
+}
+
+auto ZtTransport::drop_send_sock(peer_entry &peer) -> void
+{
+    if(!opts.per_peer_send_socks)
+    {
+        if(shared_send_fd >= 0)
+        {
+            zts_close(shared_send_fd);
+            shared_send_fd = -1;
+        }
+        return;
+    }
+    if(peer.fd >= 0)
+    {
+        zts_close(peer.fd);
+        peer.fd = -1;
+    }
+}
+
+auto ZtTransport::evict_peers(std::chrono::steady_clock::time_point now) -> void
+{
+    // a full sweep is only worth it every half timeout, a peer stays cached at most 1.5 timeouts that way
+    if(now - last_eviction < opts.peer_idle_timeout / 2)
+    {
+        return;
+    }
+    last_eviction = now;
+    for(auto it = peers.begin(); it != peers.end();)
+    {
+        if(now - it->second.last_used >= opts.peer_idle_timeout)
+        {
+            if(it->second.fd >= 0)
+            {
+                zts_close(it->second.fd);
+            }
+            it = peers.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+auto ZtTransport::close_peers() -> void
+{
+    for(auto &p : peers)
+    {
+        if(p.second.fd >= 0)
+        {
+            zts_close(p.second.fd);
+        }
+    }
+    peers.clear();
+    if(shared_send_fd >= 0)
+    {
+        zts_close(shared_send_fd);
+        shared_send_fd = -1;
+    }
+}
+
+auto ZtTransport::drop_truncated(std::size_t cap) const -> void
+{
+    // a cut off message would be handed on as if it was complete
+    truncated_dgrams.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "Dropping datagram longer than the receive buffer of " << cap << " bytes" << std::endl;
+}
+
+} // namespace standby_network
@@ -0,0 +1,116 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _ZT_TRANSPORT_H_
+#define _ZT_TRANSPORT_H_
+
+#include <bits/stdint-uintn.h>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include <ZeroTierSockets.h>
+
+#include <transport.h>
+
+namespace standby_network
+{
+
+struct ZtOptions
+{
+    // Keep a zts_connect()ed socket per peer instead of sending everything through one shared socket
+    bool per_peer_send_socks = false;
+    // Cached peers (resolved address and per-peer socket) which weren't used for this long get dropped
+    std::chrono::milliseconds peer_idle_timeout = std::chrono::seconds(30);
+    // Maximum number of cached peers, the least recently used one is dropped above this
+    std::size_t max_cached_peers = 256;
+};
+
+/**
+ * Datagrams over the libzt user space stack of the ZeroTier network nwid. A node is reached at
+ * its RFC4193 address, which is derived from the network and node ids, so no lookup is needed.
+ */
+class ZtTransport : public Transport
+{
+public:
+    ZtTransport(uint64_t nwid, const ZtOptions &options = ZtOptions());
+    ZtTransport(const ZtTransport &) = delete;
+    ~ZtTransport() override;
+
+public:
+    auto operator=(const ZtTransport &) -> const ZtTransport & = delete;
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override;
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override;
+    // The route keeps the peer's address and a zts_connect()ed socket of its own, which bypass
+    // the peer cache and its mutex. It re-resolves on network changes like the cache does
+    auto resolve(uint64_t node_id, int port) -> std::unique_ptr<Route> override;
+    auto node_id() const -> uint64_t override;
+    auto nwid() const -> uint64_t;
+    // Datagrams dropped because they were longer than the receive buffer
+    auto truncated() const -> uint64_t;
+
+public:
+    // Call this on ZeroTier network events, every ZtTransport re-resolves its cached peers on their next send
+    static auto network_changed() -> void;
+
+private:
+    friend class ZtEndpoint;
+    friend class ZtRoute;
+
+    struct peer_entry
+    {
+        zts_sockaddr_in6 addr;
+        // only valid with per_peer_send_socks, -1 otherwise
+        int fd;
+        uint64_t generation;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    // these expect mutex to be locked
+    auto peer_for(uint64_t node_id, int port) -> peer_entry *;
+    auto send_sock_for(peer_entry &peer) -> int;
+    auto drop_send_sock(peer_entry &peer) -> void;
+    auto evict_peers(std::chrono::steady_clock::time_point now) -> void;
+    auto close_peers() -> void;
+    // counts a datagram the endpoints drop for not fitting in cap bytes
+    auto drop_truncated(std::size_t cap) const -> void;
+
+private:
+    const uint64_t NWID;
+    ZtOptions opts;
+
+    std::mutex mutex;
+    int shared_send_fd = -1;
+    // keyed by node id << 16 | port
+    std::unordered_map<uint64_t, peer_entry> peers;
+    std::chrono::steady_clock::time_point last_eviction = std::chrono::steady_clock::now();
+    mutable std::atomic<uint64_t> truncated_dgrams{0};
+
+    static std::atomic<uint64_t> net_generation;
+};
+
+} // namespace standby_network
+
+#endif // _ZT_TRANSPORT_H_
@@ -0,0 +1,132 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+using namespace std::chrono;
+
+namespace
+{
+
+const uint64_t A = 0xa;
+const uint64_t B = 0xb;
+const milliseconds FOREVER(-1);
+
+auto options() -> CommOptions
+{
+    CommOptions options;
+    options.shm.enabled = false;
+    return options;
+}
+
+auto elapsed(steady_clock::time_point start) -> milliseconds
+{
+    return duration_cast<milliseconds>(steady_clock::now() - start);
+}
+
+// With nothing to receive the blocking variants return empty once the timeout is over, not before
+auto timeout_expiry() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000, options());
+
+    auto start = steady_clock::now();
+    CHECK(!b.udp_recv(A, milliseconds(100)));
+    CHECK(elapsed(start) >= milliseconds(100) && elapsed(start) < seconds(2));
+    start = steady_clock::now();
+    CHECK(!b.udp_recv(A, 5, milliseconds(100)));
+    CHECK(elapsed(start) >= milliseconds(100) && elapsed(start) < seconds(2));
+    start = steady_clock::now();
+    CHECK(!b.udp_recv_any(milliseconds(100)));
+    CHECK(elapsed(start) >= milliseconds(100) && elapsed(start) < seconds(2));
+}
+
+// A receiver parked with a long timeout returns as soon as its message arrives, one waiting for
+// another peer or channel keeps waiting
+auto wakeup_on_arrival() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommLayer a(std::make_shared<LoopbackTransport>(net, A), 9000, options());
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000, options());
+
+    std::optional<std::string> msg;
+    std::optional<std::pair<uint64_t, std::string>> any;
+    std::optional<std::string> other;
+    milliseconds took(0);
+    std::thread receiver([&]() {
+        const auto start = steady_clock::now();
+        msg = b.udp_recv(A, seconds(10));
+        took = elapsed(start);
+    });
+    std::thread any_receiver([&]() { any = b.udp_recv_any(seconds(10)); });
+    std::thread other_receiver([&]() { other = b.udp_recv(A, 7, milliseconds(500)); });
+    std::this_thread::sleep_for(milliseconds(50));
+    CHECK(a.udp_send(B, "first") == 5);
+    CHECK(a.udp_send(B, "second") == 6);
+    receiver.join();
+    any_receiver.join();
+    other_receiver.join();
+    CHECK(msg && any && any->first == A);
+    // whichever of the two got there first took "first"
+    CHECK((*msg == "first" && any->second == "second") || (*msg == "second" && any->second == "first"));
+    CHECK(took >= milliseconds(40) && took < seconds(2));
+    CHECK(!other);
+}
+
+// Receivers blocked forever are released by the destructor, which waits for them to leave
+auto destructor_wakeup() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    auto b = std::make_unique<CommLayer>(std::make_shared<LoopbackTransport>(net, B), 9000, options());
+    CommLayer *comm = b.get();
+
+    bool got_msg = true;
+    bool got_any = true;
+    std::thread receiver([&]() { got_msg = static_cast<bool>(comm->udp_recv(A, FOREVER)); });
+    std::thread any_receiver([&]() { got_any = static_cast<bool>(comm->udp_recv_any(FOREVER)); });
+    std::this_thread::sleep_for(milliseconds(50));
+    const auto start = steady_clock::now();
+    b.reset();
+    CHECK(elapsed(start) < seconds(2));
+    receiver.join();
+    any_receiver.join();
+    CHECK(!got_msg && !got_any);
+}
+
+}
+
+auto main() -> int
+{
+    timeout_expiry();
+    wakeup_on_arrival();
+    destructor_wakeup();
+    return test_result();
+}
@@ -0,0 +1,179 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <unistd.h>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <udp_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const uint64_t A = 0xa;
+const uint64_t B = 0xb;
+const std::chrono::milliseconds TIMEOUT(500);
+
+// The same traffic over every backend: plain, oversized and reliable messages, coalescing
+// and channels. Whatever carries it, the receiving side has to see the same thing
+auto check_backend(const char *name, CommLayer &a, CommLayer &b) -> void
+{
+    const int failures = test_failures;
+
+    for(int i = 0; i < 200; i++)
+    {
+        std::string msg(i * 53 + 1, static_cast<char>('a' + i % 26));
+        CHECK(a.udp_send(B, msg) >= 0);
+        auto received = b.udp_recv(A, TIMEOUT);
+        CHECK(received && *received == msg);
+    }
+
+    // fragmented, with a zero byte in it
+    std::string big(100000, 'q');
+    big[7] = 0;
+    a.udp_send(B, big);
+    auto received = b.udp_recv(A, TIMEOUT);
+    CHECK(received && *received == big);
+
+    for(int i = 0; i < 100; i++)
+    {
+        CHECK(a.rudp_send(B, "r" + std::to_string(i)) >= 0);
+    }
+    int rudp_received = 0;
+    wait_until([&] {
+        while(auto msg = b.rudp_recv(A))
+        {
+            CHECK(*msg == "r" + std::to_string(rudp_received));
+            rudp_received++;
+        }
+        return rudp_received == 100;
+    }, std::chrono::seconds(2));
+    CHECK(rudp_received == 100);
+
+    a.udp_coalesce(B, true);
+    for(int i = 0; i < 1000; i++)
+    {
+        a.udp_send(B, "c" + std::to_string(i));
+    }
+    for(int i = 0; i < 1000; i++)
+    {
+        auto msg = b.udp_recv(A, TIMEOUT);
+        CHECK(msg && *msg == "c" + std::to_string(i));
+    }
+    a.udp_coalesce(B, false);
+
+    // every channel keeps its own order, whatever the others do
+    for(int i = 0; i < 50; i++)
+    {
+        a.udp_send(B, 7, "ch7-" + std::to_string(i));
+        a.udp_send(B, 0, "ch0-" + std::to_string(i));
+    }
+    std::string big_channel(50000, 'z');
+    a.udp_send(B, 200, big_channel);
+    a.udp_coalesce(B, true);
+    a.udp_send(B, 9, "co9");
+    a.udp_send(B, 9, "co9b");
+    a.udp_flush(B);
+    a.udp_coalesce(B, false);
+    for(int i = 0; i < 50; i++)
+    {
+        auto msg = b.udp_recv(A, 7, TIMEOUT);
+        CHECK(msg && *msg == "ch7-" + std::to_string(i));
+    }
+    for(int i = 0; i < 50; i++)
+    {
+        auto msg = b.udp_recv(A, TIMEOUT);
+        CHECK(msg && *msg == "ch0-" + std::to_string(i));
+    }
+    received = b.udp_recv(A, 200, TIMEOUT);
+    CHECK(received && *received == big_channel);
+    uint64_t node_id = 0;
+    uint8_t channel = 0;
+    auto any = b.udp_recv_any_buf(node_id, channel, TIMEOUT);
+    CHECK(any && node_id == A && channel == 9 && any.str() == "co9");
+    // the flusher may have sent the bundle before co9b got into it
+    received = b.udp_recv(A, 9, TIMEOUT);
+    CHECK(received && *received == "co9b");
+
+    // through a UdpPeer's route: the fragments go out in batches and the bundles it fills up are
+    // flushed by its send
+    UdpPeer peer = a.udp_peer(B);
+    CHECK(peer.send(big) >= 0);
+    received = b.udp_recv(A, TIMEOUT);
+    CHECK(received && *received == big);
+    a.udp_coalesce(B, true);
+    for(int i = 0; i < 1000; i++)
+    {
+        peer.send("p" + std::to_string(i), 3);
+    }
+    a.udp_flush(B);
+    a.udp_coalesce(B, false);
+    for(int i = 0; i < 1000; i++)
+    {
+        auto msg = b.udp_recv(A, 3, TIMEOUT);
+        CHECK(msg && *msg == "p" + std::to_string(i));
+    }
+    CHECK(peer.stats().sent_msgs == 1001);
+
+    std::cout << name << ": " << (test_failures == failures ? "ok" : "FAILED") << std::endl;
+}
+
+}
+
+auto main() -> int
+{
+    const std::unordered_map<uint64_t, std::string> book = { { A, "127.0.0.2" }, { B, "127.0.0.3" } };
+    int port = 9400;
+    for(unsigned threads : { 1, 4 })
+    {
+        for(int engine = 0; engine < 4; engine++)
+        {
+            const char *names[] = { "mmsg", "mmsg+gro", "io_uring", "io_uring without gso" };
+            UdpOptions options;
+            options.engine = engine >= 2 ? UdpEngine::io_uring : UdpEngine::mmsg;
+            options.gro = engine == 1;
+            options.gso = engine != 3;
+            CommOptions comm_options;
+            comm_options.listener_threads = threads;
+            CommLayer a(std::make_shared<UdpTransport>(A, book, options), port, comm_options);
+            CommLayer b(std::make_shared<UdpTransport>(B, book, options), port, comm_options);
+            port += 2;
+            check_backend((std::string(names[engine]) + " x" + std::to_string(threads)).c_str(), a, b);
+        }
+    }
+    for(int backend = 0; backend < 3; backend++)
+    {
+        const char *names[] = { "loopback", "loopback x4", "shm" };
+        auto network = std::make_shared<LoopbackNetwork>();
+        CommOptions comm_options;
+        comm_options.listener_threads = backend == 1 ? 4 : 1;
+        comm_options.shm.enabled = backend == 2;
+        comm_options.shm.scope = "conformance" + std::to_string(getpid());
+        CommLayer a(std::make_shared<LoopbackTransport>(network, A), 9700, comm_options);
+        CommLayer b(std::make_shared<LoopbackTransport>(network, B), 9700, comm_options);
+        check_backend(names[backend], a, b);
+    }
+    return test_result();
+}
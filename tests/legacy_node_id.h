@@ -0,0 +1,116 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _LEGACY_NODE_ID_H_
+#define _LEGACY_NODE_ID_H_
+
+#include <optional>
+#include <string>
+
+#include <ZeroTierSockets.h>
+
+namespace standby_network
+{
+
+// The helpers of zt_transport.cc under test
+auto node_addr(uint64_t nwid, uint64_t node_id, int port) -> zts_sockaddr_in6;
+auto addr_to_node_id(uint64_t nwid, const zts_sockaddr_in6 &addr) -> std::optional<uint64_t>;
+
+namespace legacy
+{
+
+// What the udp listener did before addr_to_node_id (its long comments aside), kept as the reference
+
+inline auto addr_to_string(zts_sockaddr_in6 *addr) -> std::optional<std::string>
+{
+    char ad[ZTS_INET6_ADDRSTRLEN];
+    if(zts_inet_ntop(ZTS_AF_INET6, &(addr->sin6_addr), ad, ZTS_INET6_ADDRSTRLEN))
+    {
+        std::string s(ad);
+
+        return s;
+    }
+    return std::nullopt;
+}
+
+inline auto addr_str_to_id(const std::string addr) -> uint64_t
+{
+    constexpr int max_zeroes_to_fill = 3;
+    std::string num_str("");
+    int position_in_addr = addr.length() - 1;
+    // states: 0 -> 4 more digits needed before the next colon comes, 1 -> 3 more digits ..., 2 -> 2 more, 3 -> 1 more
+    int state = 0;
+    while(num_str.length() != 10)
+    {
+        if(!state)
+        {
+            num_str = addr[position_in_addr--] + num_str;
+            state++;
+            continue;
+        }
+        char c;
+        if((c = addr[position_in_addr--]) == ':')
+        {
+            for(int i = 0; i < max_zeroes_to_fill - state; i++)
+            {
+                num_str = "0" + num_str;
+            }
+            if(num_str.length() == 8)
+            {
+                state = 2;
+            }
+            else
+            {
+                state = 0;
+            }
+            continue;
+        }
+        else
+        {
+            num_str = (char)c + num_str;
+            if(state == 3)
+            {
+                if(num_str.length() == 8)
+                {
+                    state = 2;
+                }
+                else
+                {
+                    state = 0;
+                }
+                position_in_addr--;
+                continue;
+            }
+            else
+            {
+                state++;
+            }
+        }
+    }
+    return std::stoull(num_str, 0, 16);
+}
+
+} // namespace legacy
+
+} // namespace standby_network
+
+#endif // _LEGACY_NODE_ID_H_
@@ -0,0 +1,221 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <loopback_transport.h>
+#include <zt_lua_wrap.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// Runs chunk on l, it passes if it returns true. Otherwise its error (or second result) is printed
+auto lua_check(lua_State *l, const char *chunk) -> bool
+{
+    bool ok = false;
+    if(luaL_dostring(l, chunk))
+    {
+        std::cerr << lua_tostring(l, -1) << std::endl;
+    }
+    else if(!(ok = lua_toboolean(l, 1)) && lua_gettop(l) >= 2)
+    {
+        std::cerr << luaL_tolstring(l, 2, nullptr) << std::endl;
+    }
+    lua_settop(l, 0);
+    return ok;
+}
+
+// Two ZTLuas over a loopback network, each with its own lua_State
+struct lua_pair
+{
+    std::shared_ptr<LoopbackNetwork> network = std::make_shared<LoopbackNetwork>();
+    ZTLua a;
+    ZTLua b;
+    lua_State *la = luaL_newstate();
+    lua_State *lb = luaL_newstate();
+
+    lua_pair(const CommOptions &options = CommOptions())
+        : a(std::make_shared<LoopbackTransport>(network, 0xa), 9000, options),
+          b(std::make_shared<LoopbackTransport>(network, 0xb), 9000, options)
+    {
+        luaL_openlibs(la);
+        luaL_openlibs(lb);
+        a.register_wrappers(la);
+        b.register_wrappers(lb);
+    }
+    // before the ZTLuas, nothing of the scripts may outlive their CommLayer
+    ~lua_pair()
+    {
+        lua_close(la);
+        lua_close(lb);
+    }
+};
+
+// In async mode udp_send_many and udp_send_multi return the tickets of the queued messages
+auto async_send_many() -> void
+{
+    CommOptions options;
+    options.async_send = true;
+    lua_pair p(options);
+    CHECK(lua_check(p.la, R"(
+        local t = udp_send_many(0xb, { "a", "b", "c" })
+        if type(t) ~= "table" or #t ~= 3 then return false, t end
+        local m = udp_send_multi({ [0xb] = "d" }, 1)
+        if type(m) ~= "table" or #m ~= 1 then return false, m end
+        tickets = { t[1], t[2], t[3], m[1] }
+        return t[1] > 0 and t[1] ~= t[2] and t[2] ~= t[3] and t[3] ~= m[1]
+    )"));
+    CHECK(wait_until([&] {
+        return lua_check(p.la, R"(
+            for _, c in ipairs(udp_completions()) do
+                for i = 1, #tickets do
+                    if tickets[i] == c.ticket and c.result == 1 then table.remove(tickets, i) break end
+                end
+            end
+            return #tickets == 0
+        )");
+    }));
+}
+
+// udp_recv_many refills the table it's given and clears what's left of the last batch
+auto recv_many() -> void
+{
+    lua_pair p;
+    CHECK(lua_check(p.la, "local t = {} for i = 1, 100 do t[i] = 'm' .. i end return udp_send_many(0xb, t) == 100"));
+    // the loopback listener queues them right away
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(lua_check(p.lb, R"(
+        local out, c = udp_recv_many(0xa, 64)
+        if c ~= 64 or #out ~= 64 or out[1] ~= "m1" or out[64] ~= "m64" then return false, c end
+        local same, c2 = udp_recv_many(0xa, 64, out)
+        if same ~= out or c2 ~= 36 or #out ~= 36 or out[1] ~= "m65" or out[36] ~= "m100" or out[37] ~= nil then return false, c2 end
+        local _, c3 = udp_recv_many(0xa, 64, out)
+        return c3 == 0 and next(out) == nil
+    )"));
+}
+
+// A nil channel is channel 0, and every channel keeps its messages to itself
+auto channels() -> void
+{
+    lua_pair p;
+    CHECK(lua_check(p.la, R"(
+        return udp_send(0xb, 3, "three") == 5 and udp_send(0xb, nil, "zero", "bulk") == 4 and
+               udp_send(0xb, nil, "urgent", "control") == 6 and udp_send_many(0xb, { "many" }, nil, "bulk") == 1
+    )"));
+    CHECK(lua_check(p.la, "local err = udp_send(0xb, nil, 'x', 'urgent') return err == -1"));
+    // all of them queued, so the priorities decide the order
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(lua_check(p.lb, R"(
+        local got = {}
+        for i = 1, 3 do got[i] = udp_recv(0xa, 1000) end
+        if got[1] ~= "urgent" or got[2] ~= "zero" or got[3] ~= "many" then return false, table.concat(got, ",") end
+        if udp_recv(0xa, 100) ~= nil then return false, "channel 3 leaked into channel 0" end
+        return udp_recv(0xa, 0, 3) == "three" and udp_recv(0xa, 0, 3) == nil
+    )"));
+}
+
+// UdpPeer keeps its own counters and finds the queues its peer opens after a first stats()
+auto peer_stats_queues() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    CommLayer a(std::make_shared<LoopbackTransport>(network, 0xa), 9000);
+    CommLayer b(std::make_shared<LoopbackTransport>(network, 0xb), 9000);
+    UdpPeer to_b = a.udp_peer(0xb);
+    UdpPeer from_a = b.udp_peer(0xa);
+    CHECK(from_a.stats().queued_msgs == 0);
+
+    CHECK(to_b.send("one") == 3);
+    CHECK(to_b.send("two", 5, UdpPriority::bulk) == 3);
+    CHECK(wait_until([&] { return from_a.stats().queued_msgs == 2; }));
+    CHECK(to_b.send("three", 9) == 5);
+    CHECK(wait_until([&] { return from_a.stats().queued_msgs == 3; }));
+
+    MsgRef msg = from_a.recv(5);
+    CHECK(msg && msg.str() == "two");
+    msg = from_a.recv(9, std::chrono::milliseconds(100));
+    CHECK(msg && msg.str() == "three");
+    peer_stats s = from_a.stats();
+    CHECK(s.queued_msgs == 1 && s.recvd_msgs == 2 && s.recvd_bytes == 8);
+    s = to_b.stats();
+    CHECK(s.sent_msgs == 3 && s.sent_bytes == 11 && s.send_errors == 0);
+
+    from_a.close();
+    CHECK(from_a.closed() && !from_a.recv(0) && from_a.stats().queued_msgs == 0);
+    to_b.close();
+    CHECK(to_b.send("four") == -EBADF);
+    // what the closed handle didn't take is still there for udp_recv
+    auto left = b.udp_recv(0xa);
+    CHECK(left && *left == "one");
+}
+
+// The udp_peer handle: send, recv, stats, close, and __gc running twice on the same userdata
+auto peer_handle() -> void
+{
+    lua_pair p;
+    CHECK(lua_check(p.la, R"(
+        b = udp_peer(0xb)
+        return b:send("hi") == 2 and b:send("ch", 4, "control") == 2
+    )"));
+    CHECK(lua_check(p.lb, R"(
+        a = udp_peer(0xa)
+        local m = a:recv(1000)
+        if m ~= "hi" then return false, m end
+        m = a:recv(1000, 4)
+        if m ~= "ch" then return false, m end
+        if a:recv() ~= nil then return false, "nothing should be left" end
+        local s = a:stats()
+        return s.node == 0xa and s.recvd_msgs == 2 and s.recvd_bytes == 4 and s.queued_msgs == 0
+    )"));
+    CHECK(lua_check(p.la, R"(
+        local s = b:stats()
+        if s.sent_msgs ~= 2 or s.sent_bytes ~= 4 or s.send_errors ~= 0 then return false, s.sent_msgs end
+        b:close()
+        local err, why = b:send("x")
+        return err < 0 and type(why) == "string"
+    )"));
+    CHECK(lua_check(p.lb, R"(
+        if getmetatable(a) ~= false then return false, "the metatable should be hidden" end
+        -- only the debug library gets past __metatable
+        local gc = debug.getmetatable(a).__gc
+        gc(a)
+        gc(a)
+        -- no handle anymore, so no methods either
+        if pcall(function() return a:send("x") end) then return false, "a dead handle sent" end
+        local err = udp_peer("x")
+        a = nil
+        collectgarbage()
+        return err == -1
+    )"));
+}
+
+}
+
+auto main() -> int
+{
+    async_send_many();
+    recv_many();
+    channels();
+    peer_stats_queues();
+    peer_handle();
+    return test_result();
+}
@@ -0,0 +1,115 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <legacy_node_id.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const uint64_t NWID = 0x8056c2e21c000001;
+// 40 bit node ids
+const uint64_t NODE_MASK = (1ull << 40) - 1;
+
+uint64_t compared = 0;
+uint64_t legacy_wrong = 0;
+
+// The old parser counts digits backwards from the end of the string, it only gets the id
+// right when the two last groups are printed with all 4 digits (the 93xx group always is)
+auto legacy_parses(uint64_t node_id) -> bool
+{
+    return (node_id >> 16 & 0xffff) >= 0x1000 && (node_id & 0xffff) >= 0x1000;
+}
+
+auto check_node(uint64_t node_id) -> void
+{
+    zts_sockaddr_in6 addr = node_addr(NWID, node_id, 9000);
+    auto decoded = addr_to_node_id(NWID, addr);
+    CHECK(decoded && *decoded == node_id);
+    auto str = legacy::addr_to_string(&addr);
+    CHECK(str);
+    if(legacy_parses(node_id))
+    {
+        compared++;
+        CHECK(legacy::addr_str_to_id(*str) == node_id);
+    }
+    else if(legacy::addr_str_to_id(*str) != node_id)
+    {
+        legacy_wrong++;
+    }
+}
+
+}
+
+auto main() -> int
+{
+    // every value of each of the three groups the node id spans (the low byte of 93xx, and the
+    // two full groups after it) against edge values of the others
+    const std::vector<uint64_t> edges = { 0x0000, 0x0001, 0x000f, 0x0010, 0x00ff, 0x0100, 0x0fff, 0x1000, 0xffff };
+    for(uint64_t hi = 0; hi < 256; hi++)
+    {
+        for(uint64_t mid : edges)
+        {
+            for(uint64_t lo : edges)
+            {
+                check_node(hi << 32 | mid << 16 | lo);
+            }
+        }
+    }
+    for(uint64_t group = 0; group < 0x10000; group++)
+    {
+        for(uint64_t hi : { 0x00ull, 0x01ull, 0x10ull, 0xffull })
+        {
+            for(uint64_t other : edges)
+            {
+                check_node(hi << 32 | group << 16 | other);
+                check_node(hi << 32 | other << 16 | group);
+            }
+        }
+    }
+    std::mt19937_64 rng(42);
+    for(int i = 0; i < 1000000; i++)
+    {
+        check_node(rng() & NODE_MASK);
+    }
+
+    // addresses outside of our network (or not RFC4193 at all) are rejected
+    zts_sockaddr_in6 addr = node_addr(NWID, 0x1234567890, 9000);
+    CHECK(!addr_to_node_id(NWID ^ 1, addr));
+    CHECK(!addr_to_node_id(NWID ^ (1ull << 63), addr));
+    for(std::size_t byte : { 0, 9, 10 })
+    {
+        zts_sockaddr_in6 bad = addr;
+        reinterpret_cast<uint8_t *>(&bad.sin6_addr)[byte] ^= 0x01;
+        CHECK(!addr_to_node_id(NWID, bad));
+    }
+
+    std::cout << compared << " addresses compared with the old parser, " << legacy_wrong
+              << " others it decoded wrong" << std::endl;
+    return test_result();
+}
@@ -0,0 +1,173 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <thread>
+#include <vector>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <outbox.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const std::size_t PRODUCERS = 4;
+
+// Producers racing for the last room never take the outbox over its caps, and every rejected
+// reservation is taken back
+auto caps() -> void
+{
+    const std::size_t max_msgs = 100;
+    const std::size_t max_bytes = 1000;
+    Outbox outbox;
+    std::atomic<std::size_t> pushed{0};
+    std::vector<std::thread> threads;
+    for(std::size_t p = 0; p < PRODUCERS; p++)
+    {
+        threads.emplace_back([&, p] {
+            for(int i = 0; i < 10000; i++)
+            {
+                const std::size_t len = 1 + (i + p) % 20;
+                if(outbox.reserve(len, max_msgs, max_bytes))
+                {
+                    outbox.push(new outbox_entry{ {nullptr}, { p, 0, UdpPriority::interactive, std::string(len, 'x'), i } });
+                    pushed++;
+                }
+            }
+        });
+    }
+    for(auto &t : threads)
+    {
+        t.join();
+    }
+    // a failed reservation raises the counters for a moment, so only the end result is checked
+    CHECK(outbox.size() == pushed);
+    CHECK(outbox.size() <= max_msgs);
+    CHECK(outbox.bytes() <= max_bytes);
+    std::size_t bytes = 0;
+    std::size_t popped = 0;
+    while(outbox_entry *e = outbox.pop())
+    {
+        bytes += e->msg.data.size();
+        popped++;
+        outbox.release(e->msg.data.size());
+        delete e;
+    }
+    CHECK(popped == pushed);
+    CHECK(outbox.size() == 0 && outbox.bytes() == 0);
+    CHECK(bytes <= max_bytes);
+}
+
+// With a consumer popping while they push, every producer's messages come out once and in order
+auto ordered() -> void
+{
+    const int per_producer = 100000;
+    Outbox outbox;
+    std::vector<std::thread> threads;
+    for(std::size_t p = 0; p < PRODUCERS; p++)
+    {
+        threads.emplace_back([&, p] {
+            for(int i = 0; i < per_producer; i++)
+            {
+                while(!outbox.reserve(1, 1024, 0))
+                {
+                    std::this_thread::yield();
+                }
+                outbox.push(new outbox_entry{ {nullptr}, { p, 0, UdpPriority::interactive, "m", i } });
+            }
+        });
+    }
+    std::vector<int> next(PRODUCERS, 0);
+    std::size_t popped = 0;
+    while(popped < PRODUCERS * per_producer)
+    {
+        outbox_entry *e = outbox.pop();
+        if(!e)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK(e->msg.ticket == next[e->msg.node_id]);
+        next[e->msg.node_id] = e->msg.ticket + 1;
+        popped++;
+        outbox.release(e->msg.data.size());
+        delete e;
+    }
+    for(auto &t : threads)
+    {
+        t.join();
+    }
+    CHECK(outbox.empty() && outbox.size() == 0);
+}
+
+// In async mode udp_send_many hands out one ticket per queued message and stops at the first
+// message the outbox can't take, which is the returned count
+auto send_many_tickets() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.async_send = true;
+    options.send_limits.total_bytes = 1000;
+    CommLayer a(std::make_shared<LoopbackTransport>(net, 0xa), 9000, options);
+    CommLayer b(std::make_shared<LoopbackTransport>(net, 0xb), 9000);
+
+    const std::string small(10, 's');
+    const std::string large(2000, 'l');
+    std::vector<outgoing_msg> msgs(8, { 0xb, 0, UdpPriority::interactive, small });
+    msgs[5].data = large;
+    std::vector<int> tickets;
+    CHECK(a.udp_send_many(msgs.data(), msgs.size(), &tickets) == 5);
+    CHECK(tickets.size() == 5);
+    for(std::size_t i = 0; i < tickets.size(); i++)
+    {
+        CHECK(tickets[i] > 0);
+        CHECK(i == 0 || tickets[i] != tickets[i - 1]);
+    }
+
+    std::vector<send_completion> done;
+    CHECK(wait_until([&] {
+        auto more = a.udp_completions();
+        done.insert(done.end(), more.begin(), more.end());
+        return done.size() >= tickets.size();
+    }));
+    CHECK(done.size() == tickets.size());
+    for(std::size_t i = 0; i < done.size() && i < tickets.size(); i++)
+    {
+        CHECK(done[i].ticket == tickets[i]);
+        CHECK(done[i].result == static_cast<int>(small.size()));
+    }
+    CHECK(a.udp_send_many(&msgs[5], 1, &tickets) == -EAGAIN);
+    CHECK(tickets.size() == 5);
+}
+
+}
+
+auto main() -> int
+{
+    caps();
+    ordered();
+    send_many_tickets();
+    return test_result();
+}
@@ -0,0 +1,223 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <string>
+#include <vector>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <send_lanes.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const uint64_t A = 0xa;
+const uint64_t B = 0xb;
+const std::size_t CAP = 64;
+const std::size_t FLOOD = 10 * CAP;
+const OverflowPolicy POLICIES[] = { OverflowPolicy::drop_newest, OverflowPolicy::drop_oldest, OverflowPolicy::reject };
+
+auto policy_name(OverflowPolicy policy) -> const char *
+{
+    switch(policy)
+    {
+    case OverflowPolicy::drop_newest:
+        return "drop_newest";
+    case OverflowPolicy::drop_oldest:
+        return "drop_oldest";
+    default:
+        return "reject";
+    }
+}
+
+// Message i of a flood, its number is what the receiver checks the order with
+auto flood_msg(std::size_t i) -> std::string
+{
+    std::string msg = std::to_string(i);
+    msg.resize(100, '.');
+    return msg;
+}
+
+// A receiver flooded with ten times what its recv_limits hold keeps exactly that many (every
+// datagram holds a MSG_MAX_LENGTH buffer), counts the rest and its buffer pools don't grow past
+// the queued messages and the listener's batch. Which messages are kept depends on the policy
+auto flood_receiver(OverflowPolicy policy, bool by_bytes) -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    options.recv_limits = by_bytes ? QueueLimits{ 0, 0, 0, CAP * MSG_MAX_LENGTH, policy } : QueueLimits{ 0, 0, CAP, 0, policy };
+    CommLayer a(std::make_shared<LoopbackTransport>(net, A), 9000);
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000, options);
+
+    for(std::size_t i = 0; i < FLOOD; i++)
+    {
+        CHECK(a.udp_send(B, flood_msg(i)) >= 0);
+    }
+    CHECK(wait_until([&] {
+        const queue_stats s = b.udp_recv_stats();
+        return s.msgs + s.dropped + s.rejected == FLOOD;
+    }));
+    const queue_stats s = b.udp_recv_stats();
+    CHECK(s.msgs == CAP);
+    CHECK(s.bytes == CAP * MSG_MAX_LENGTH);
+    CHECK(policy == OverflowPolicy::reject ? (s.rejected == FLOOD - CAP && s.dropped == 0) : (s.dropped == FLOOD - CAP && s.rejected == 0));
+    CHECK(b.udp_recv_memory() <= (CAP + 2 * options.recv_batch_size) * MSG_MAX_LENGTH + 64 * SMALL_MSG_LENGTH);
+
+    // drop_oldest keeps the newest ones, the others the first ones
+    const std::size_t first = policy == OverflowPolicy::drop_oldest ? FLOOD - CAP : 0;
+    for(std::size_t i = first; i < first + CAP; i++)
+    {
+        auto msg = b.udp_recv(A);
+        CHECK(msg && *msg == flood_msg(i));
+    }
+    CHECK(!b.udp_recv(A));
+    CHECK(b.udp_recv_stats().msgs == 0 && b.udp_recv_stats().bytes == 0);
+}
+
+// SendLanes flooded by several peers and classes: the same with the send_limits
+auto flood_lanes(OverflowPolicy policy, bool by_bytes) -> void
+{
+    const std::string msg(100, 'm');
+    SendLanes lanes(by_bytes ? QueueLimits{ 0, 0, 0, CAP * msg.size(), policy } : QueueLimits{ 0, 0, CAP, 0, policy }, 1024, 1024);
+    std::vector<pending_msg> evicted;
+    std::size_t refused = 0;
+    for(std::size_t i = 0; i < FLOOD; i++)
+    {
+        const UdpPriority priority = static_cast<UdpPriority>(i % UDP_PRIORITIES);
+        // every lane is full by then, drop_oldest evicts from the message's own one
+        refused += !lanes.push({ i % 4, 0, priority, msg, 0 }, &evicted);
+        CHECK(lanes.size() <= CAP);
+    }
+    const queue_stats s = lanes.stats();
+    CHECK(s.msgs == CAP && s.bytes == CAP * msg.size());
+    if(policy == OverflowPolicy::drop_oldest)
+    {
+        CHECK(refused == 0);
+        CHECK(evicted.size() == FLOOD - CAP && s.dropped == FLOOD - CAP);
+    }
+    else
+    {
+        CHECK(refused == FLOOD - CAP && evicted.empty());
+        CHECK(policy == OverflowPolicy::reject ? (s.rejected == refused && s.dropped == 0) : (s.dropped == refused && s.rejected == 0));
+    }
+    pending_msg m;
+    std::size_t popped = 0;
+    while(lanes.pop(m))
+    {
+        popped++;
+    }
+    CHECK(popped == CAP && lanes.stats().msgs == 0 && lanes.stats().bytes == 0);
+}
+
+// An async mode sender flooded with ten times its send_limits: the outbox and the send lanes
+// together never hold more, every message is either queued (and completed later) or refused
+auto flood_sender(OverflowPolicy policy) -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    options.async_send = true;
+    options.send_limits = { 0, 0, CAP, 0, policy };
+    options.completion_capacity = FLOOD;
+    CommLayer a(std::make_shared<LoopbackTransport>(net, A), 9000, options);
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000);
+
+    const std::string msg(100, 'm');
+    std::size_t queued = 0;
+    std::size_t refused = 0;
+    for(std::size_t i = 0; i < FLOOD; i++)
+    {
+        const int ticket = a.udp_send(B, 0, msg);
+        CHECK(ticket > 0 || ticket == -EAGAIN);
+        (ticket > 0 ? queued : refused)++;
+        CHECK(a.udp_send_stats().msgs <= CAP);
+    }
+    std::size_t completed = 0;
+    CHECK(wait_until([&] {
+        completed += a.udp_completions().size();
+        return completed == queued;
+    }));
+    const queue_stats s = a.udp_send_stats();
+    CHECK(s.msgs == 0 && s.bytes == 0);
+    CHECK(s.rejected == refused);
+}
+
+// A peer going through the channels opens at most max_queues_per_peer receive queues, its
+// datagrams for any other one are dropped. Other peers still get queues of their own
+auto queue_cap() -> void
+{
+    const uint64_t C = 0xc;
+    auto net = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    options.max_queues_per_peer = 4;
+    CommLayer a(std::make_shared<LoopbackTransport>(net, A), 9000);
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000, options);
+    CommLayer c(std::make_shared<LoopbackTransport>(net, C), 9000);
+
+    for(uint8_t channel = 0; channel < 10; channel++)
+    {
+        CHECK(a.udp_send(B, channel, "a" + std::to_string(channel)) >= 0);
+    }
+    // a new priority class on a channel it has is one more queue as well
+    CHECK(a.udp_send(B, 0, "a0 bulk", UdpPriority::bulk) >= 0);
+    CHECK(c.udp_send(B, 9, "c9") >= 0);
+    CHECK(wait_until([&] {
+        const queue_stats s = b.udp_recv_stats();
+        return s.msgs + s.dropped == 12;
+    }));
+    CHECK(b.udp_recv_stats().msgs == 5 && b.udp_recv_stats().dropped == 7);
+    for(uint8_t channel = 0; channel < 4; channel++)
+    {
+        auto msg = b.udp_recv(A, channel);
+        CHECK(msg && *msg == "a" + std::to_string(channel));
+    }
+    for(uint8_t channel = 4; channel < 10; channel++)
+    {
+        CHECK(!b.udp_recv(A, channel));
+    }
+    CHECK(!b.udp_recv(A, 0));
+    auto msg = b.udp_recv(C, 9);
+    CHECK(msg && *msg == "c9");
+}
+
+}
+
+auto main() -> int
+{
+    for(OverflowPolicy policy : POLICIES)
+    {
+        const int failures = test_failures;
+        flood_receiver(policy, false);
+        flood_receiver(policy, true);
+        flood_lanes(policy, false);
+        flood_lanes(policy, true);
+        flood_sender(policy);
+        std::cout << policy_name(policy) << (test_failures == failures ? ": OK" : ": FAILED") << std::endl;
+    }
+    queue_cap();
+    return test_result();
+}
@@ -0,0 +1,219 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const uint64_t A = 0xa;
+const uint64_t B = 0xb;
+const std::size_t MSG_LENGTH = 1000;
+
+// A LoopbackTransport whose sends wait while it's held, so the messages of concurrent udp_send
+// calls pile up in the send lanes. It logs the last byte of every datagram and fails the ones
+// ending in 'x'
+class GatedTransport : public Transport
+{
+public:
+    GatedTransport(std::shared_ptr<LoopbackNetwork> network, uint64_t node_id) :
+        inner(std::move(network), node_id)
+    {
+    }
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override
+    {
+        return inner.bind(port);
+    }
+
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        entered = true;
+        cv.notify_all();
+        cv.wait(lock, [this]() { return !held; });
+        log.push_back(data[len - 1]);
+        if(data[len - 1] == 'x')
+        {
+            return -EIO;
+        }
+        lock.unlock();
+        return inner.send(node_id, port, data, len);
+    }
+
+    auto node_id() const -> uint64_t override
+    {
+        return inner.node_id();
+    }
+
+    auto hold() -> void
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        held = true;
+        entered = false;
+    }
+
+    // waits until a send is stuck in the gate
+    auto wait_entered() -> void
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return entered; });
+    }
+
+    auto release() -> void
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        held = false;
+        cv.notify_all();
+    }
+
+    auto sent() -> std::string
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return log;
+    }
+
+private:
+    LoopbackTransport inner;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool held = false;
+    bool entered = false;
+    std::string log;
+};
+
+auto options() -> CommOptions
+{
+    CommOptions options;
+    options.shm.enabled = false;
+    options.interactive_quantum = 2 * MSG_LENGTH;
+    options.bulk_quantum = MSG_LENGTH;
+    return options;
+}
+
+// Blocks a first send in the gate, then has a thread per message queue it behind. Returns the
+// results of the queued udp_send calls
+auto send_queued(CommLayer &a, GatedTransport &gate, const std::vector<std::pair<UdpPriority, char>> &msgs) -> std::vector<int>
+{
+    gate.hold();
+    std::thread first([&a]() { a.udp_send(B, 0, std::string(MSG_LENGTH, 'f')); });
+    gate.wait_entered();
+    std::vector<int> results(msgs.size());
+    std::vector<std::thread> senders;
+    for(std::size_t i = 0; i < msgs.size(); i++)
+    {
+        senders.emplace_back([&a, &msgs, &results, i]() { results[i] = a.udp_send(B, 0, std::string(MSG_LENGTH, msgs[i].second), msgs[i].first); });
+        // one lane per class and peer keeps the order of the pushes
+        CHECK(wait_until([&a, i]() { return a.udp_send_stats().msgs == i + 1; }));
+    }
+    gate.release();
+    first.join();
+    for(auto &t : senders)
+    {
+        t.join();
+    }
+    return results;
+}
+
+// Control messages go out first, then interactive and bulk share the rest two to one as set by
+// their quanta. Every caller gets its own message's result
+auto order() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    auto gate = std::make_shared<GatedTransport>(net, A);
+    CommLayer a(gate, 9000, options());
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000);
+
+    std::vector<std::pair<UdpPriority, char>> msgs;
+    for(int i = 0; i < 6; i++)
+    {
+        msgs.push_back({ UdpPriority::bulk, 'b' });
+    }
+    for(int i = 0; i < 6; i++)
+    {
+        msgs.push_back({ UdpPriority::interactive, 'i' });
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        msgs.push_back({ UdpPriority::control, 'c' });
+    }
+    for(int result : send_queued(a, *gate, msgs))
+    {
+        CHECK(result == static_cast<int>(MSG_LENGTH));
+    }
+    const std::string sent = gate->sent();
+    std::cout << "sent: " << sent << std::endl;
+    CHECK(sent.size() == 15 && sent[0] == 'f');
+    CHECK(sent.substr(1, 2) == "cc");
+    // after the first round's credit, two interactive messages for every bulk one
+    CHECK(sent.substr(3) == "iibbiibiibbb");
+}
+
+// A queued message that fails hands its error to its own caller, the others still succeed
+auto queued_error() -> void
+{
+    auto net = std::make_shared<LoopbackNetwork>();
+    auto gate = std::make_shared<GatedTransport>(net, A);
+    CommLayer a(gate, 9000, options());
+    CommLayer b(std::make_shared<LoopbackTransport>(net, B), 9000);
+
+    const std::vector<int> results = send_queued(a, *gate, { { UdpPriority::interactive, 'i' }, { UdpPriority::interactive, 'x' }, { UdpPriority::bulk, 'b' } });
+    CHECK(results.size() == 3 && results[0] == static_cast<int>(MSG_LENGTH) && results[1] == -EIO && results[2] == static_cast<int>(MSG_LENGTH));
+
+    // udp_send_many reports the first of its queued messages that failed
+    gate->hold();
+    std::thread first([&a]() { a.udp_send(B, 0, std::string(MSG_LENGTH, 'f')); });
+    gate->wait_entered();
+    int result = 0;
+    std::thread many([&a, &result]() {
+        const std::string ok(MSG_LENGTH, 'o');
+        const std::string bad(MSG_LENGTH, 'x');
+        const outgoing_msg msgs[] = { { B, 0, UdpPriority::interactive, ok }, { B, 0, UdpPriority::interactive, bad }, { B, 0, UdpPriority::bulk, ok } };
+        result = a.udp_send_many(msgs, 3);
+    });
+    CHECK(wait_until([&a]() { return a.udp_send_stats().msgs == 3; }));
+    gate->release();
+    first.join();
+    many.join();
+    CHECK(result == 1);
+}
+
+}
+
+auto main() -> int
+{
+    order();
+    queued_error();
+    return test_result();
+}
@@ -0,0 +1,186 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <string>
+#include <vector>
+
+#include <frame.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const std::size_t MAX_MESSAGE = 100000;
+const std::chrono::milliseconds TIMEOUT(50);
+
+// The count FRAME_FRAGMENT datagrams msg is cut into
+auto fragments(uint32_t msg_id, const std::string &msg, uint16_t count) -> std::vector<std::string>
+{
+    fragment_header h{ msg_id, 0, count, static_cast<uint32_t>(msg.size()) };
+    const std::size_t chunk = fragment_chunk(h);
+    std::vector<std::string> out;
+    for(uint16_t i = 0; i < count; i++)
+    {
+        h.index = i;
+        const std::string payload = msg.substr(i * chunk, chunk);
+        std::string dgram(FRAGMENT_HEADER_LENGTH, '\0');
+        write_fragment_header(&dgram[0], 0, h);
+        out.push_back(dgram + payload);
+    }
+    return out;
+}
+
+// Feeds the datagrams, returns the message they completed (empty if none did)
+auto feed(Reassembler &r, uint64_t node_id, const std::vector<std::string> &dgrams) -> std::string
+{
+    std::string done;
+    for(const std::string &d : dgrams)
+    {
+        if(recv_buffer *buf = r.add(node_id, d.data(), d.size()))
+        {
+            CHECK(done.empty());
+            done.assign(buf->data, buf->len);
+            BufferPool::release(buf);
+        }
+    }
+    return done;
+}
+
+auto message(std::size_t len, char c) -> std::string
+{
+    std::string msg(len, c);
+    msg[0] = 'x';
+    msg[len - 1] = 'y';
+    return msg;
+}
+
+// Fragments in any order, duplicates ignored, two senders using the same id don't mix
+auto out_of_order() -> void
+{
+    BufferPool pool(1000);
+    Reassembler r(pool, MAX_MESSAGE, MAX_MESSAGE * 4, TIMEOUT);
+    const std::string msg = message(10001, 'a');
+    std::vector<std::string> f = fragments(7, msg, 10);
+    std::vector<std::string> shuffled = { f[3], f[9], f[0], f[3], f[1], f[2], f[8], f[4], f[5], f[6], f[9] };
+    CHECK(feed(r, 1, shuffled).empty());
+    CHECK(r.memory() == msg.size());
+    const std::string other = message(5000, 'b');
+    CHECK(feed(r, 2, fragments(7, other, 5)) == other);
+    CHECK(feed(r, 1, { f[7] }) == msg);
+    CHECK(r.memory() == 0 && r.dropped() == 0);
+    // a late duplicate starts a new partial message, which expires
+    CHECK(feed(r, 1, { f[0] }).empty());
+    r.expire(std::chrono::steady_clock::now() + TIMEOUT);
+    CHECK(r.memory() == 0 && r.dropped() == 1);
+}
+
+// A message missing a fragment is given up after the timeout, not before
+auto missing() -> void
+{
+    BufferPool pool(1000);
+    Reassembler r(pool, MAX_MESSAGE, MAX_MESSAGE, TIMEOUT);
+    std::vector<std::string> f = fragments(1, message(3000, 'c'), 3);
+    CHECK(feed(r, 1, { f[0], f[2] }).empty());
+    r.expire(std::chrono::steady_clock::now());
+    CHECK(r.memory() == 3000 && r.dropped() == 0);
+    r.expire(std::chrono::steady_clock::now() + TIMEOUT);
+    CHECK(r.memory() == 0 && r.dropped() == 1);
+    CHECK(feed(r, 1, { f[1] }).empty());
+    CHECK(r.memory() == 3000);
+}
+
+// Over the memory cap the oldest partial messages go first, a message bigger than the cap is dropped
+auto cap() -> void
+{
+    BufferPool pool(1000);
+    Reassembler r(pool, MAX_MESSAGE, 10000, std::chrono::seconds(60));
+    std::vector<std::vector<std::string>> f;
+    for(uint32_t id = 0; id < 4; id++)
+    {
+        f.push_back(fragments(id, message(3000, 'd' + id), 2));
+        CHECK(feed(r, 1, { f[id][0] }).empty());
+    }
+    // the fourth one pushed out the first
+    CHECK(r.memory() == 9000 && r.dropped() == 1);
+    CHECK(feed(r, 1, { f[0][1] }).empty());
+    CHECK(r.dropped() == 2);
+    CHECK(feed(r, 1, { f[2][1] }) == message(3000, 'd' + 2));
+    CHECK(feed(r, 1, { f[3][1] }) == message(3000, 'd' + 3));
+    // every fragment of it is refused, without giving up the others
+    CHECK(feed(r, 1, fragments(9, message(10001, 'e'), 2)).empty());
+    CHECK(r.dropped() == 4 && r.memory() == 3000);
+
+    // evicting stays cheap with many partial messages: 10000 of them held, 40000 evicted
+    Reassembler many(pool, MAX_MESSAGE, 1000000, std::chrono::seconds(60));
+    const auto start = std::chrono::steady_clock::now();
+    for(uint32_t id = 0; id < 50000; id++)
+    {
+        feed(many, 2, { fragments(id, message(100, 'f'), 2)[0] });
+    }
+    CHECK(many.memory() == 1000000 && many.dropped() == 40000);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+}
+
+// A new message reusing the id of a partial one replaces it
+auto id_reuse() -> void
+{
+    BufferPool pool(1000);
+    Reassembler r(pool, MAX_MESSAGE, MAX_MESSAGE, TIMEOUT);
+    std::vector<std::string> old = fragments(5, message(4000, 'g'), 4);
+    CHECK(feed(r, 1, { old[0], old[1] }).empty());
+    const std::string msg = message(2500, 'h');
+    CHECK(feed(r, 1, fragments(5, msg, 3)) == msg);
+    CHECK(r.memory() == 0 && r.dropped() == 1);
+}
+
+// Fragments with an inconsistent header are ignored
+auto bad_header() -> void
+{
+    BufferPool pool(1000);
+    Reassembler r(pool, 5000, MAX_MESSAGE, TIMEOUT);
+    std::vector<std::string> f = fragments(3, message(3000, 'i'), 3);
+    // too short, payload length off, index out of range, no fragments, over max_message_size
+    std::string too_short = f[0].substr(0, FRAGMENT_HEADER_LENGTH - 1);
+    std::string longer = f[0] + "z";
+    std::string bad_index = f[0];
+    bad_index[6] = 3;
+    std::string no_count = f[0];
+    no_count[8] = 0;
+    CHECK(feed(r, 1, { too_short, longer, bad_index, no_count }).empty());
+    CHECK(feed(r, 1, fragments(4, message(5001, 'j'), 2)).empty());
+    CHECK(r.memory() == 0 && r.dropped() == 0);
+    CHECK(feed(r, 1, f) == message(3000, 'i'));
+}
+
+}
+
+auto main() -> int
+{
+    out_of_order();
+    missing();
+    cap();
+    id_reuse();
+    bad_header();
+    return test_result();
+}
@@ -0,0 +1,120 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <cstdlib>
+#include <new>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// Every thread's heap allocations, except the ones made while not_counted is set on it
+std::atomic<uint64_t> allocations{0};
+thread_local bool not_counted = false;
+
+}
+
+auto operator new(std::size_t size) -> void *
+{
+    if(!not_counted)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// gcc takes the replaced operator delete freeing what the replaced operator new malloc()ed for a mismatch
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+auto operator delete(void *p) noexcept -> void
+{
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+auto operator delete(void *p, std::size_t) noexcept -> void
+{
+    operator delete(p);
+}
+
+namespace
+{
+
+const std::size_t BATCH = 32;
+
+// Sends a batch (its allocations aren't the receive path's) and receives it, through the
+// listener, the peer table and udp_recv_buf
+auto round_trip(CommLayer &sender, CommLayer &receiver, const std::string &msg) -> std::size_t
+{
+    not_counted = true;
+    for(std::size_t i = 0; i < BATCH; i++)
+    {
+        sender.udp_send(0xb, msg);
+    }
+    not_counted = false;
+    std::size_t received = 0;
+    for(std::size_t i = 0; i < BATCH; i++)
+    {
+        MsgRef m = receiver.udp_recv_buf(0xa, std::chrono::milliseconds(1000));
+        received += m && m.size() == msg.size();
+    }
+    return received;
+}
+
+}
+
+// Steady-state receive makes no heap allocations: once the buffer pool and the queues grew to
+// the working set, a datagram goes from the listener to the consumer in pooled buffers only
+auto main() -> int
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    CommOptions options;
+    options.shm.enabled = false;
+    CommLayer sender(std::make_shared<LoopbackTransport>(network, 0xa), 9000, options);
+    CommLayer receiver(std::make_shared<LoopbackTransport>(network, 0xb), 9000, options);
+
+    const std::string msg(200, 'm');
+    for(int i = 0; i < 100; i++)
+    {
+        CHECK(round_trip(sender, receiver, msg) == BATCH);
+    }
+    const uint64_t before = allocations.load();
+    std::size_t received = 0;
+    for(int i = 0; i < 1000; i++)
+    {
+        received += round_trip(sender, receiver, msg);
+    }
+    const uint64_t allocated = allocations.load() - before;
+    CHECK(received == 1000 * BATCH);
+    CHECK(allocated == 0);
+    std::cout << received << " messages received with " << allocated << " heap allocations" << std::endl;
+    return test_result();
+}
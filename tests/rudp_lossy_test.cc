@@ -0,0 +1,213 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <cerrno>
+#include <random>
+#include <set>
+
+#include <comm_layer.h>
+#include <loopback_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+// A LoopbackTransport losing a share of the datagrams it sends, or all of them while blackholed
+class LossyTransport : public Transport
+{
+public:
+    LossyTransport(std::shared_ptr<LoopbackNetwork> network, uint64_t node_id, double loss) :
+        loss(loss),
+        blackhole(false),
+        inner(std::move(network), node_id),
+        rng(node_id)
+    {
+    }
+
+public:
+    auto bind(int port) -> std::unique_ptr<Endpoint> override
+    {
+        return inner.bind(port);
+    }
+
+    auto send(uint64_t node_id, int port, const char *data, std::size_t len) -> int override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(blackhole || std::uniform_real_distribution<double>(0, 1)(rng) < loss)
+            {
+                return len;
+            }
+        }
+        return inner.send(node_id, port, data, len);
+    }
+
+    auto node_id() const -> uint64_t override
+    {
+        return inner.node_id();
+    }
+
+public:
+    std::atomic<double> loss;
+    std::atomic<bool> blackhole;
+
+private:
+    LoopbackTransport inner;
+    std::mutex mutex;
+    std::mt19937_64 rng;
+};
+
+auto fast_options() -> CommOptions
+{
+    CommOptions options;
+    options.shm.enabled = false;
+    options.rudp.initial_rto = std::chrono::milliseconds(20);
+    options.rudp.min_rto = std::chrono::milliseconds(5);
+    options.rudp.max_rto = std::chrono::milliseconds(200);
+    return options;
+}
+
+// Sends count messages tagged with first.., waiting out a full backlog
+auto send_all(CommLayer &sender, uint64_t to, int first, int count) -> bool
+{
+    for(int i = first; i < first + count; i++)
+    {
+        int err;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while((err = sender.rudp_send(to, "m" + std::to_string(i))) == -EAGAIN && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(err < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Receives until every message tagged first..first + count - 1 arrived, false on a timeout or a duplicate
+auto recv_all(CommLayer &receiver, uint64_t from, int first, int count) -> bool
+{
+    std::set<std::string> got;
+    bool duplicate = false;
+    bool done = wait_until([&] {
+        std::optional<std::string> msg;
+        while((msg = receiver.rudp_recv(from)))
+        {
+            duplicate |= !got.insert(*msg).second;
+        }
+        return got.size() >= static_cast<std::size_t>(count);
+    }, std::chrono::seconds(30));
+    for(int i = first; i < first + count; i++)
+    {
+        done &= got.count("m" + std::to_string(i)) == 1;
+    }
+    return done && !duplicate;
+}
+
+auto lossy_link() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    CommLayer a(std::make_shared<LossyTransport>(network, 0xa, 0.2), 9000, fast_options());
+    CommLayer b(std::make_shared<LossyTransport>(network, 0xb, 0.2), 9000, fast_options());
+    CHECK(send_all(a, 0xb, 0, 3000));
+    CHECK(recv_all(b, 0xa, 0, 3000));
+}
+
+// A given up message must not stall the receiver's window, more than a window of messages follows it
+auto given_up() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    auto lossy = std::make_shared<LossyTransport>(network, 0xa, 0);
+    CommOptions options = fast_options();
+    options.rudp.max_retries = 2;
+    CommLayer a(lossy, 9000, options);
+    CommLayer b(std::make_shared<LossyTransport>(network, 0xb, 0), 9000, options);
+    lossy->blackhole = true;
+    CHECK(send_all(a, 0xb, 0, 10));
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    lossy->blackhole = false;
+    CHECK(send_all(a, 0xb, 10, 2 * Rudp::MAX_WINDOW));
+    CHECK(recv_all(b, 0xa, 10, 2 * Rudp::MAX_WINDOW));
+}
+
+// Either side starting over must not leave the other one waiting for sequence numbers of its previous run
+auto restarts() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    auto b = std::make_unique<CommLayer>(std::make_shared<LossyTransport>(network, 0xb, 0), 9000, fast_options());
+    {
+        CommLayer a(std::make_shared<LossyTransport>(network, 0xa, 0), 9000, fast_options());
+        CHECK(send_all(a, 0xb, 0, 1500));
+        CHECK(recv_all(*b, 0xa, 0, 1500));
+    }
+    CommLayer a(std::make_shared<LossyTransport>(network, 0xa, 0), 9000, fast_options());
+    CHECK(send_all(a, 0xb, 0, 100));
+    CHECK(recv_all(*b, 0xa, 0, 100));
+
+    CHECK(send_all(a, 0xb, 100, 1500));
+    CHECK(recv_all(*b, 0xa, 100, 1500));
+    b.reset();
+    b = std::make_unique<CommLayer>(std::make_shared<LossyTransport>(network, 0xb, 0), 9000, fast_options());
+    CHECK(send_all(a, 0xb, 0, 100));
+    CHECK(recv_all(*b, 0xa, 0, 100));
+}
+
+auto limits() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    auto lossy = std::make_shared<LossyTransport>(network, 0xa, 0);
+    CommOptions options = fast_options();
+    options.rudp.window = 4;
+    options.rudp.max_backlog = 16;
+    CommLayer a(lossy, 9000, options);
+    CommLayer b(std::make_shared<LossyTransport>(network, 0xb, 0), 9000, options);
+
+    // the window fills up, then the backlog
+    lossy->blackhole = true;
+    int queued = 0;
+    while(queued < 100 && a.rudp_send(0xb, "x") == 0)
+    {
+        queued++;
+    }
+    CHECK(queued == 4 + 16);
+    CHECK(a.rudp_send(0xb, "x") == -EAGAIN);
+
+    // messages go out in a single datagram
+    const std::size_t longest = options.max_datagram_size - Rudp::DATA_HEADER;
+    CHECK(a.rudp_send(0xc, std::string(longest, 'l')) == 0);
+    CHECK(a.rudp_send(0xc, std::string(longest + 1, 'l')) == -1);
+}
+
+}
+
+auto main() -> int
+{
+    lossy_link();
+    given_up();
+    restarts();
+    limits();
+    return test_result();
+}
@@ -0,0 +1,299 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <shm_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const int PORT = 9000;
+const std::size_t CAP = 2048;
+
+auto options() -> ShmOptions
+{
+    ShmOptions opts;
+    opts.enabled = true;
+    opts.scope = "shm_transport_test" + std::to_string(getpid());
+    return opts;
+}
+
+// The abstract socket ShmTransport listens on for node_id and port
+auto listen_addr(const std::string &scope, uint64_t node_id, int port, socklen_t &len) -> sockaddr_un
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    int n = std::snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "%s/%llx:%d", scope.c_str(), static_cast<unsigned long long>(node_id), port);
+    len = offsetof(sockaddr_un, sun_path) + 1 + n;
+    return addr;
+}
+
+// Receives on its own thread like CommLayer's listener, the endpoint takes handshakes only then
+class Receiver
+{
+public:
+    explicit Receiver(std::unique_ptr<Endpoint> endpoint) :
+        endpoint(std::move(endpoint)),
+        run(true),
+        thread(&Receiver::receive, this)
+    {
+    }
+
+    ~Receiver()
+    {
+        run = false;
+        endpoint->wakeup();
+        thread.join();
+    }
+
+public:
+    // what arrived after at most a second of waiting for count datagrams
+    auto received(std::size_t count) -> std::vector<std::string>
+    {
+        wait_until([&] {
+            std::lock_guard<std::mutex> lock(mutex);
+            return msgs.size() >= count;
+        }, std::chrono::seconds(1));
+        std::lock_guard<std::mutex> lock(mutex);
+        return msgs;
+    }
+
+private:
+    auto receive() -> void
+    {
+        std::vector<char> storage(CAP * 16);
+        datagram dgrams[16];
+        while(run)
+        {
+            for(std::size_t i = 0; i < 16; i++)
+            {
+                dgrams[i] = { storage.data() + i * CAP, CAP, 0, 0 };
+            }
+            int n = endpoint->recv(dgrams, 16);
+            if(n == 0)
+            {
+                endpoint->wait(std::chrono::milliseconds(10));
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int i = 0; i < n; i++)
+            {
+                msgs.emplace_back(dgrams[i].data, dgrams[i].len);
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<Endpoint> endpoint;
+    std::atomic<bool> run;
+    std::mutex mutex;
+    std::vector<std::string> msgs;
+    std::thread thread;
+};
+
+// Datagrams of one sender arrive in order, a full ring is reported instead of overwritten
+auto ordered() -> void
+{
+    ShmTransport a(0xa, options());
+    ShmTransport b(0xb, options());
+    Receiver receiver(b.bind(PORT));
+    CHECK(a.send(0xc, PORT, "x", 1) == -EHOSTUNREACH);
+
+    const int count = 100000;
+    for(int i = 0; i < count;)
+    {
+        const std::string msg = std::to_string(i);
+        int err = a.send(0xb, PORT, msg.data(), msg.size());
+        if(err == -ENOBUFS)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK(err == static_cast<int>(msg.size()));
+        i++;
+    }
+    const std::vector<std::string> received = receiver.received(count);
+    CHECK(received.size() == count);
+    for(std::size_t i = 0; i < received.size(); i++)
+    {
+        CHECK(received[i] == std::to_string(i));
+    }
+}
+
+// A peer whose handshake hangs doesn't hold up the sends to the others
+auto slow_handshake() -> void
+{
+    const ShmOptions opts = options();
+    ShmTransport a(0xa, opts);
+    ShmTransport b(0xb, opts);
+    Receiver receiver(b.bind(PORT));
+    CHECK(a.send(0xb, PORT, "first", 5) == 5);
+
+    // listens under the name of node e, but never accepts
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    socklen_t len;
+    sockaddr_un addr = listen_addr(opts.scope, 0xe, PORT, len);
+    CHECK(bind(fd, (const sockaddr *)&addr, len) == 0 && listen(fd, 8) == 0);
+
+    std::atomic<bool> done(false);
+    int result = 0;
+    std::thread stuck([&] {
+        result = a.send(0xe, PORT, "x", 1);
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(a.send(0xb, PORT, "second", 6) == 6);
+    // the other sends to e don't wait for the handshake either
+    CHECK(a.send(0xe, PORT, "y", 1) == -EHOSTUNREACH);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+    CHECK(!done);
+    stuck.join();
+    CHECK(result == -EHOSTUNREACH);
+    close(fd);
+    CHECK((receiver.received(2) == std::vector<std::string>{ "first", "second" }));
+}
+
+// A sender that connects but never introduces itself doesn't hold up the listener, which gives up
+// on it after the handshake timeout
+auto silent_sender() -> void
+{
+    const ShmOptions opts = options();
+    ShmTransport a(0xa, opts);
+    ShmTransport b(0xb, opts);
+    Receiver receiver(b.bind(PORT));
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    socklen_t len;
+    sockaddr_un addr = listen_addr(opts.scope, 0xb, PORT, len);
+    CHECK(connect(fd, (const sockaddr *)&addr, len) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(a.send(0xb, PORT, "meanwhile", 9) == 9);
+    CHECK((receiver.received(1) == std::vector<std::string>{ "meanwhile" }));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+
+    pollfd pfd = { fd, POLLIN, 0 };
+    CHECK(poll(&pfd, 1, 3000) == 1);
+    char c;
+    CHECK(recv(fd, &c, 1, 0) == 0);
+    close(fd);
+}
+
+// Routes keep working while the entries of peers that aren't local are pruned
+auto pruned() -> void
+{
+    ShmTransport a(0xa, options());
+    ShmTransport b(0xb, options());
+    Receiver receiver(b.bind(PORT));
+    auto route = a.resolve(0xb, PORT);
+    for(int port = 1; port <= 1000; port++)
+    {
+        CHECK(a.send(0xc, port, "x", 1) == -EHOSTUNREACH);
+    }
+    CHECK(route->send("route", 5) == 5);
+    CHECK(a.send(0xb, PORT, "send", 4) == 4);
+    CHECK((receiver.received(2) == std::vector<std::string>{ "route", "send" }));
+}
+
+// Neither side of a handshake shares a ring with a process of another user
+auto other_user() -> void
+{
+    if(geteuid() != 0)
+    {
+        std::cout << "other_user: skipped, needs root to switch users" << std::endl;
+        return;
+    }
+    const ShmOptions opts = options();
+    ShmTransport a(0xa, opts);
+    auto endpoint = a.bind(PORT);
+    int to_child[2], to_parent[2];
+    CHECK(pipe(to_child) == 0 && pipe(to_parent) == 0);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        // nobody: listens as node d and tries the handshake with a by hand
+        if(setuid(65534) != 0)
+        {
+            _exit(2);
+        }
+        ShmTransport d(0xd, opts);
+        auto child_endpoint = d.bind(PORT);
+        char c = child_endpoint ? 1 : 0;
+        write(to_parent[1], &c, 1);
+
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        socklen_t len;
+        sockaddr_un addr = listen_addr(opts.scope, 0xa, PORT, len);
+        const uint64_t node_id = 0xd;
+        uint64_t size = 0;
+        // a hangs up as soon as it sees who connected, the send may fail already
+        bool refused = connect(fd, (const sockaddr *)&addr, len) == 0 &&
+                       (send(fd, &node_id, sizeof(node_id), MSG_NOSIGNAL) < 0 || recv(fd, &size, sizeof(size), 0) <= 0);
+        c = refused ? 1 : 0;
+        write(to_parent[1], &c, 1);
+        read(to_child[0], &c, 1);
+        _exit(0);
+    }
+    char bound = 0, refused = 0;
+    CHECK(read(to_parent[0], &bound, 1) == 1 && bound);
+    // d listens, but as another user
+    CHECK(a.send(0xd, PORT, "x", 1) == -EHOSTUNREACH);
+    wait_until([&] {
+        endpoint->wait(std::chrono::milliseconds(10));
+        pollfd pfd = { to_parent[0], POLLIN, 0 };
+        return poll(&pfd, 1, 0) > 0;
+    });
+    CHECK(read(to_parent[0], &refused, 1) == 1 && refused);
+    write(to_child[1], &refused, 1);
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+}
+
+auto main() -> int
+{
+    other_user();
+    ordered();
+    slow_handshake();
+    silent_sender();
+    pruned();
+    return test_result();
+}
@@ -0,0 +1,87 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace standby_network
+{
+
+// Failed CHECKs of the running test, test_result() turns them into the exit code
+inline int test_failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if(!(cond)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond << std::endl; \
+            standby_network::test_failures++; \
+        } \
+    } while(0)
+
+inline auto test_result() -> int
+{
+    if(test_failures > 0)
+    {
+        std::cerr << test_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+// Polls cond every millisecond for at most timeout, returns whether it became true
+template<typename F>
+auto wait_until(F cond, std::chrono::milliseconds timeout = std::chrono::seconds(5)) -> bool
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(!cond())
+    {
+        if(std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Nanoseconds per call of f, averaged over count calls
+template<typename F>
+auto ns_per_op(std::size_t count, F f) -> double
+{
+    const auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < count; i++)
+    {
+        f();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+} // namespace standby_network
+
+#endif // _TEST_UTIL_H_
@@ -0,0 +1,138 @@
+/* MIT License
+
+Copyright (c) 2020 StandBy.Network
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE. */
+
+#include <functional>
+
+#include <loopback_transport.h>
+#include <udp_transport.h>
+#include <zt_transport.h>
+#include <test_util.h>
+
+using namespace standby_network;
+
+namespace
+{
+
+const std::size_t CAP = 1000;
+
+// Datagrams longer than the receive buffer are dropped and counted instead of handed on cut off.
+// send sends a datagram from node sender to endpoint, truncated is the receiving transport's counter
+auto check_endpoint(const char *name, Endpoint &endpoint, uint64_t sender, std::function<int(const std::string &)> send,
+                    std::function<uint64_t()> truncated) -> void
+{
+    const std::vector<std::size_t> sizes = { 100, CAP, CAP + 1, 5000, 20000, 10, CAP };
+    for(std::size_t size : sizes)
+    {
+        std::string data(size, static_cast<char>('a' + size % 26));
+        CHECK(send(data) >= 0);
+    }
+
+    std::vector<std::size_t> received;
+    std::vector<char> storage(CAP * 8);
+    wait_until([&] {
+        datagram dgrams[8];
+        for(std::size_t i = 0; i < 8; i++)
+        {
+            dgrams[i] = { storage.data() + i * CAP, CAP, 0, 0 };
+        }
+        int n = endpoint.recv(dgrams, 8);
+        for(int i = 0; i < n; i++)
+        {
+            if(dgrams[i].len > 0)
+            {
+                CHECK(dgrams[i].node_id == sender);
+                CHECK(dgrams[i].data[0] == static_cast<char>('a' + dgrams[i].len % 26));
+                received.push_back(dgrams[i].len);
+            }
+        }
+        if(n == 0)
+        {
+            endpoint.wait(std::chrono::milliseconds(10));
+        }
+        return received.size() == 4 && truncated() == 3;
+    }, std::chrono::seconds(2));
+
+    CHECK((received == std::vector<std::size_t>{ 100, CAP, 10, CAP }));
+    CHECK(truncated() == 3);
+    std::cout << name << ": " << received.size() << " received, " << truncated() << " truncated dropped" << std::endl;
+}
+
+auto check_engine(const char *name, const UdpOptions &options, int port) -> void
+{
+    const std::unordered_map<uint64_t, std::string> book = { { 0xa, "127.0.0.2" }, { 0xb, "127.0.0.3" } };
+    UdpTransport sender(0xa, book, options);
+    UdpTransport receiver(0xb, book, options);
+    auto endpoint = receiver.bind(port);
+    CHECK(endpoint);
+    if(endpoint)
+    {
+        check_endpoint(name, *endpoint, 0xa, [&](const std::string &data) { return sender.send(0xb, port, data.data(), data.size()); },
+                       [&] { return receiver.truncated(); });
+    }
+}
+
+auto check_loopback() -> void
+{
+    auto network = std::make_shared<LoopbackNetwork>();
+    LoopbackTransport sender(network, 0xa);
+    LoopbackTransport receiver(network, 0xb);
+    auto endpoint = receiver.bind(9306);
+    CHECK(endpoint);
+    if(endpoint)
+    {
+        check_endpoint("loopback", *endpoint, 0xa, [&](const std::string &data) { return sender.send(0xb, 9306, data.data(), data.size()); },
+                       [&] { return receiver.truncated(); });
+    }
+}
+
+// Sends to itself, skipped where there's no libzt node running
+auto check_zt() -> void
+{
+    const uint64_t nwid = 0x8056c2e21c000001;
+    zts_join(nwid);
+    ZtTransport transport(nwid);
+    auto endpoint = transport.bind(9308);
+    if(!endpoint)
+    {
+        std::cout << "zt: no libzt node, skipped" << std::endl;
+        return;
+    }
+    const uint64_t self = transport.node_id();
+    check_endpoint("zt", *endpoint, self, [&](const std::string &data) { return transport.send(self, 9308, data.data(), data.size()); },
+                   [&] { return transport.truncated(); });
+}
+
+}
+
+auto main() -> int
+{
+    UdpOptions mmsg;
+    mmsg.gro = false;
+    check_engine("mmsg", mmsg, 9300);
+    check_engine("mmsg+gro", UdpOptions(), 9302);
+    UdpOptions uring;
+    uring.engine = UdpEngine::io_uring;
+    check_engine("io_uring", uring, 9304);
+    check_loopback();
+    check_zt();
+    return test_result();
+}